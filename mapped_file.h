@@ -0,0 +1,101 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cerrno>
+#include <cstddef>
+#include <string>
+#include <system_error>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace cxx {
+
+    /* Read-only shared mapping of a whole file. Pages come straight from
+     * the page cache, so every process mapping the same file shares them.
+     * Failures of the system calls are reported with std::system_error.
+     */
+    class mapped_file {
+        public:
+            mapped_file() noexcept = default;
+
+            explicit mapped_file(std::string const &path) {
+                int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+                if (fd < 0) {
+                    throw std::system_error(errno, std::generic_category(),
+                                            "mapped_file, open " + path);
+                }
+                struct stat st;
+                if (::fstat(fd, &st) != 0) {
+                    int err = errno;
+                    ::close(fd);
+                    throw std::system_error(err, std::generic_category(),
+                                            "mapped_file, stat " + path);
+                }
+                size_ = static_cast<std::size_t>(st.st_size);
+                if (size_ > 0) {
+                    void *addr = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED,
+                                        fd, 0);
+                    if (addr == MAP_FAILED) {
+                        int err = errno;
+                        ::close(fd);
+                        throw std::system_error(err, std::generic_category(),
+                                                "mapped_file, mmap " + path);
+                    }
+                    data_ = static_cast<char const *>(addr);
+                }
+                // Mapping keeps the file alive on its own.
+                ::close(fd);
+            }
+
+            mapped_file(mapped_file const &) = delete;
+            mapped_file & operator=(mapped_file const &) = delete;
+
+            mapped_file(mapped_file &&other) noexcept
+                : data_(std::exchange(other.data_, nullptr)),
+                  size_(std::exchange(other.size_, 0)) {}
+
+            mapped_file & operator=(mapped_file &&other) noexcept {
+                if (this != &other) {
+                    unmap();
+                    data_ = std::exchange(other.data_, nullptr);
+                    size_ = std::exchange(other.size_, 0);
+                }
+                return *this;
+            }
+
+            ~mapped_file() {
+                unmap();
+            }
+
+            char const *data() const noexcept {
+                return data_;
+            }
+
+            std::size_t size() const noexcept {
+                return size_;
+            }
+
+            // Hint for the kernel, mapping will be read front to back.
+            void advise_sequential() const noexcept {
+                if (data_)
+                    ::madvise(const_cast<char *>(data_), size_,
+                              MADV_SEQUENTIAL);
+            }
+
+        private:
+            char const *data_ = nullptr;
+            std::size_t size_ = 0;
+
+            void unmap() noexcept {
+                if (data_)
+                    ::munmap(const_cast<char *>(data_), size_);
+            }
+    };
+
+} // namespace cxx
+
+#endif //MAPPED_FILE_H
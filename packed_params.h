@@ -0,0 +1,309 @@
+#ifndef PACKED_PARAMS_H
+#define PACKED_PARAMS_H
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+#include <vector>
+
+#include "playlist_format.h"
+
+namespace cxx {
+
+    /* Compressed column of trivially copyable params. P is treated as an
+     * array of 32-bit lanes (8-bit if its size is not a multiple of 4),
+     * values are grouped in blocks of block_size and every lane of a block
+     * is stored frame-of-reference: minimum of the block plus the
+     * differences bit-packed with the smallest sufficient width. Identical
+     * windows cost no bits at all, near-identical ones a few, and any
+     * single value decodes in O(1) without touching its neighbours.
+     *
+     * Block layout: lane base[lanes], uint8 width[lanes], padding to 4,
+     * then for every lane ceil(count * width / 32) uint32 words.
+     */
+    namespace packed {
+        inline constexpr std::size_t block_size = 128;
+
+        template <typename P>
+        using lane_t = std::conditional_t<sizeof(P) % 4 == 0,
+                                          std::uint32_t, std::uint8_t>;
+
+        template <typename P>
+        inline constexpr std::size_t lanes = sizeof(P) / sizeof(lane_t<P>);
+
+        template <typename P>
+        constexpr std::size_t header_bytes() noexcept {
+            std::size_t n = lanes<P> * (sizeof(lane_t<P>) + 1);
+            return (n + 3) / 4 * 4;
+        }
+
+        constexpr std::size_t lane_words(std::size_t count,
+                                         unsigned width) noexcept {
+            return (count * width + 31) / 32;
+        }
+
+        // Appends encoding of count (<= block_size) values to out.
+        template <typename P>
+        void encode_block(P const *values, std::size_t count,
+                          std::vector<char> &out) {
+            using lane = lane_t<P>;
+            constexpr std::size_t L = lanes<P>;
+            lane base[L], top[L];
+            unsigned char width[L];
+
+            auto value = [&](std::size_t i, std::size_t l) {
+                lane v;
+                std::memcpy(&v, reinterpret_cast<char const *>(values + i)
+                                + l * sizeof(lane), sizeof(lane));
+                return v;
+            };
+
+            for (std::size_t l = 0; l < L; ++l) {
+                base[l] = top[l] = value(0, l);
+                for (std::size_t i = 1; i < count; ++i) {
+                    base[l] = std::min(base[l], value(i, l));
+                    top[l] = std::max(top[l], value(i, l));
+                }
+                width[l] = static_cast<unsigned char>(
+                    std::bit_width(static_cast<std::uint32_t>(top[l] -
+                                                              base[l])));
+            }
+
+            std::size_t at = out.size();
+            std::size_t size = header_bytes<P>();
+            for (std::size_t l = 0; l < L; ++l)
+                size += lane_words(count, width[l]) * sizeof(std::uint32_t);
+            out.resize(at + size, 0);
+
+            char *p = out.data() + at;
+            std::memcpy(p, base, sizeof(base));
+            std::memcpy(p + sizeof(base), width, sizeof(width));
+            p += header_bytes<P>();
+
+            for (std::size_t l = 0; l < L; ++l) {
+                std::size_t words = lane_words(count, width[l]);
+                std::vector<std::uint32_t> bits(words + 1, 0);
+                for (std::size_t i = 0; i < count && width[l] > 0; ++i) {
+                    std::uint64_t delta = static_cast<std::uint32_t>(
+                        value(i, l) - base[l]);
+                    std::size_t bit = i * width[l];
+                    std::uint64_t word = bits[bit / 32] |
+                        (static_cast<std::uint64_t>(bits[bit / 32 + 1]) << 32);
+                    word |= delta << (bit % 32);
+                    bits[bit / 32] = static_cast<std::uint32_t>(word);
+                    bits[bit / 32 + 1] = static_cast<std::uint32_t>(word >> 32);
+                }
+                std::memcpy(p, bits.data(), words * sizeof(std::uint32_t));
+                p += words * sizeof(std::uint32_t);
+            }
+        }
+
+        // i-th value of a block holding count values.
+        template <typename P>
+        P decode(char const *block, std::size_t count, std::size_t i) noexcept {
+            using lane = lane_t<P>;
+            constexpr std::size_t L = lanes<P>;
+            alignas(P) unsigned char res[sizeof(P)];
+
+            char const *bits = block + header_bytes<P>();
+            for (std::size_t l = 0; l < L; ++l) {
+                lane base;
+                std::memcpy(&base, block + l * sizeof(lane), sizeof(lane));
+                unsigned width = static_cast<unsigned char>(
+                    block[L * sizeof(lane) + l]);
+
+                std::uint32_t delta = 0;
+                if (width > 0) {
+                    std::size_t bit = i * width;
+                    std::uint32_t w[2] = {0, 0};
+                    std::size_t words = lane_words(count, width);
+                    std::size_t n = bit / 32 + 1 < words ? 2 : 1;
+                    std::memcpy(w, bits + bit / 32 * 4, n * 4);
+                    std::uint64_t word = w[0] |
+                        (static_cast<std::uint64_t>(w[1]) << 32);
+                    delta = static_cast<std::uint32_t>(
+                        (word >> (bit % 32)) &
+                        ((std::uint64_t{1} << width) - 1));
+                }
+                lane v = static_cast<lane>(base + delta);
+                std::memcpy(res + l * sizeof(lane), &v, sizeof(lane));
+                bits += lane_words(count, width) * sizeof(std::uint32_t);
+            }
+            return format::from_bytes<P>(res);
+        }
+
+        // Encoded size of a block, from its header; widths over 32 bits
+        // (corrupt input) make it infinite.
+        template <typename P>
+        std::size_t block_bytes(char const *block, std::size_t count) noexcept {
+            std::size_t res = header_bytes<P>();
+            for (std::size_t l = 0; l < lanes<P>; ++l) {
+                unsigned width = static_cast<unsigned char>(
+                    block[lanes<P> * sizeof(lane_t<P>) + l]);
+                if (width > 32)
+                    return SIZE_MAX;
+                res += lane_words(count, width) * sizeof(std::uint32_t);
+            }
+            return res;
+        }
+
+        // Values in block number b of a column of n values.
+        inline std::size_t block_count(std::size_t n, std::size_t b) noexcept {
+            return std::min(block_size, n - b * block_size);
+        }
+
+        /* Encodes a whole column as: uint64 offsets[blocks + 1] (counted
+         * from the end of the table), then the blocks.
+         */
+        template <typename P>
+        class column_writer {
+            public:
+                void push_back(P const &p) {
+                    pending_.push_back(p);
+                    if (pending_.size() == block_size)
+                        seal();
+                }
+
+                // Finished column, the writer is left empty.
+                std::vector<char> finish() {
+                    if (!pending_.empty())
+                        seal();
+                    std::size_t table = offsets_.size() + 1;
+                    std::vector<char> res(table * sizeof(std::uint64_t));
+                    offsets_.push_back(blocks_.size());
+                    std::memcpy(res.data(), offsets_.data(), res.size());
+                    res.insert(res.end(), blocks_.begin(), blocks_.end());
+                    offsets_.clear();
+                    blocks_.clear();
+                    return res;
+                }
+
+            private:
+                std::vector<P> pending_;
+                std::vector<std::uint64_t> offsets_;
+                std::vector<char> blocks_;
+
+                void seal() {
+                    offsets_.push_back(blocks_.size());
+                    encode_block(pending_.data(), pending_.size(), blocks_);
+                    pending_.clear();
+                }
+        };
+
+        // Random access to a column laid out by column_writer.
+        template <typename P>
+        class column_reader {
+            public:
+                column_reader() = default;
+
+                /* Only the table size is checked here, blocks are checked
+                 * as they are read, so that opening a mapped column costs
+                 * nothing.
+                 */
+                column_reader(char const *data, std::size_t bytes,
+                              std::size_t n)
+                    : data_(data), n_(n) {
+                    std::size_t blocks = (n + block_size - 1) / block_size;
+                    table_ = (blocks + 1) * sizeof(std::uint64_t);
+                    if (bytes < table_) {
+                        throw std::runtime_error(
+                            "deserialize, corrupt params");
+                    }
+                    bytes_ = bytes - table_;
+                }
+
+                P operator[](std::size_t i) const {
+                    std::size_t b = i / block_size;
+                    auto off = format::from_bytes<std::uint64_t>(
+                        data_ + b * sizeof(std::uint64_t));
+                    auto next = format::from_bytes<std::uint64_t>(
+                        data_ + (b + 1) * sizeof(std::uint64_t));
+                    std::size_t count = block_count(n_, b);
+                    char const *block = data_ + table_ + off;
+                    if (off > next || next > bytes_
+                        || next - off < header_bytes<P>()
+                        || block_bytes<P>(block, count) > next - off) {
+                        throw std::runtime_error(
+                            "deserialize, corrupt params");
+                    }
+                    return decode<P>(block, count, i % block_size);
+                }
+
+                std::size_t size() const noexcept {
+                    return n_;
+                }
+
+            private:
+                char const *data_ = nullptr;
+                std::size_t table_ = 0;
+                std::size_t bytes_ = 0;
+                std::size_t n_ = 0;
+        };
+    } // namespace packed
+
+    /* In-memory packed column, for archives of plays that are appended and
+     * read but not edited.
+     */
+    template <typename P>
+        requires serializable_params<P>
+    class packed_params {
+        public:
+            static constexpr std::size_t block_size = packed::block_size;
+
+            packed_params() = default;
+
+            template <std::input_iterator It>
+            packed_params(It first, It last) {
+                for (; first != last; ++first)
+                    push_back(*first);
+                shrink_to_fit();
+            }
+
+            void push_back(P const &p) {
+                tail_.push_back(p);
+                if (tail_.size() == block_size) {
+                    offsets_.push_back(blocks_.size());
+                    packed::encode_block(tail_.data(), block_size, blocks_);
+                    tail_.clear();
+                }
+            }
+
+            // Gives back the spare capacity left by geometric growth; for
+            // when appending is over.
+            void shrink_to_fit() {
+                blocks_.shrink_to_fit();
+                offsets_.shrink_to_fit();
+            }
+
+            P operator[](std::size_t i) const noexcept {
+                std::size_t b = i / block_size;
+                if (b == offsets_.size())
+                    return tail_[i % block_size];
+                return packed::decode<P>(blocks_.data() + offsets_[b],
+                                         block_size, i % block_size);
+            }
+
+            std::size_t size() const noexcept {
+                return offsets_.size() * block_size + tail_.size();
+            }
+
+            // Bytes held, to compare with size() * sizeof(P).
+            std::size_t memory_bytes() const noexcept {
+                return blocks_.capacity() +
+                       offsets_.capacity() * sizeof(std::size_t) +
+                       tail_.capacity() * sizeof(P);
+            }
+
+        private:
+            std::vector<char> blocks_;
+            std::vector<std::size_t> offsets_;
+            std::vector<P> tail_;
+    };
+
+} // namespace cxx
+
+#endif //PACKED_PARAMS_H
@@ -1,58 +1,84 @@
 #ifndef PLAYLIST_H
 #define PLAYLIST_H
 
+#include <algorithm>
 #include <cstdlib>
 #include <cstddef>
+#include <cstdint>
 #include <compare>
 #include <memory>
-#include <map>
+#include <optional>
+#include <utility>
 #include <vector>
 #include <iterator>
-#include <list>
 #include <stdexcept>
+#include <string>
+#include <string_view>
+#include <istream>
+#include <ostream>
+#include <array>
+
+#include "packed_params.h"
+#include "playlist_counts.h"
+#include "playlist_format.h"
+#include "playlist_index.h"
+#include "playlist_policies.h"
+#include "playlist_shuffle.h"
+#include "playlist_stats.h"
+#include "playlist_storage.h"
 
 namespace cxx {
 
-    template <typename T, typename P>
+    template <typename T, typename P, playlist_policy... Policies>
     class playlist {
         private:
             ///////////////// DATA TYPES DEFINITIONS /////////////////
 
-            // Forward declaration
-            struct playNode; 
-
-            // Actual playlist, holds playNodes
-            using p_queue = std::list<playNode>;
-            using p_queue_iter = typename p_queue::iterator;
-
-            // Map that holds singular copies of tracks. Besides that
-            // it holds list of iters to positions where track is played.
-            using track_map = std::map<T, std::list<p_queue_iter>>;
+            // Plays live in a slab (playlist_storage.h) and refer to their
+            // track by id, tracks live in a sorted index (playlist_index.h)
+            // that keeps for every track the list of its plays. By default
+            // integral tracks get a radix index, others a std::map; see
+            // playlist_policies.h for the other choices.
+            using policies = playlist_policies<T, P, Policies...>;
+            using allocator_type = typename policies::allocator;
+            using storage_type = typename policies::storage;
+            using index_type = typename policies::index;
+            using sharing = typename policies::sharing;
+            using durations_type = typename policies::durations;
+            using counts_type = typename policies::counts;
+            using instrumentation = typename policies::instrumentation;
 
-            /* Data about singular play, holds unique params for that play.
-             * Has track_nod_ptr to 'download' track from a track_map. Self_ptr,
-             * is used only when deleting, to quickly erase info that track_map
-             * holds, pointing at this-to-be-deleted node.
-             */
-            struct playNode {
-                typename track_map::iterator track_nod_ptr;
-                std::list<p_queue_iter>::iterator self_ptr;
-                P params;
-            };
+            // Here actual playlist data is stored. Nothing in it is a
+            // pointer, so the default copy constructor makes a correct copy;
+            // it shares chunks of plays with the original (see play_slab),
+            // which are copied when first written to.
+            using owner_list = std::vector<std::shared_ptr<void const>>;
 
-            // Here actual playlist data is stored. It provides save deep
-            // copy-constructor that rebuilds pointer structure.
             struct playlistData {
-                p_queue play_queue{};
-                track_map tracks{};
+                // Objects that tracks or params may point into (e.g. mapped
+                // log files), released together with the data. The list is
+                // shared by copies of the data and by extracted nodes and
+                // never changed in place; null when empty.
+                std::shared_ptr<owner_list const> owners{};
+                index_type tracks{};
+                // Track ids by number of plays, for top_k().
+                [[no_unique_address]] counts_type counts{};
+                storage_type plays{};
+                [[no_unique_address]] durations_type durations{};
+                slot_t head = no_slot;
+                slot_t tail = no_slot;
 
                 playlistData() = default;
-                playlistData(const playlistData & other) {
-                    const p_queue & pq = other.play_queue;
-                    for (auto it = pq.begin(); it != pq.end(); ++it) {
-                        push_back(it->track_nod_ptr->first, it->params);
-                    }
-                }
+                playlistData(const playlistData & other) = default;
+
+                // Copy sharing no chunks, for when references to params
+                // were given out.
+                playlistData(const playlistData & other, deep_copy_t)
+                    : owners(other.owners), tracks(other.tracks),
+                      counts(other.counts), plays(other.plays, deep_copy),
+                      durations(other.durations), head(other.head),
+                      tail(other.tail) {}
+
                 playlistData(playlistData && other) = default;
                 ~playlistData() = default;
 
@@ -62,78 +88,448 @@ namespace cxx {
 
                 /* Functions that correctly handles pointer-pinning when adding
                  * a single play to a playlist. Guarantees nothing is added / 
-                 * changed when exception is thrown.
+                 * changed when exception is thrown. Rvalues are moved from
+                 * (for a node_type): the track only with an index that can
+                 * hand it back on failure (take).
                  */
-                void push_back (T const &track, P const &params) {
-                    // emplace już gwarantuje strong excp-safety....
-                    auto [map_it, added] = tracks.emplace(track, 
-                                        std::list<p_queue_iter>{});
+                template <typename U, typename Q>
+                slot_t push_back (U &&track, Q &&params,
+                                  slot_t before = no_slot) {
+                    constexpr bool move_track = !std::is_lvalue_reference_v<U>
+                        && requires (std::uint32_t id) { tracks.take(id); };
+                    // insert już gwarantuje strong excp-safety....
+                    auto [id, added] = move_track
+                                       ? tracks.insert(std::move(track))
+                                       : tracks.insert(std::as_const(track));
 
                     try {
-                        play_queue.push_back({map_it, {}, params});
+                        return append(id, std::forward<Q>(params), before);
                     } catch (...) {
-                        // rollback 1, push_back failed
-                        if (added)
-                            tracks.erase(map_it);
+                        // rollback 1, append failed
+                        if constexpr (move_track) {
+                            if (added)
+                                track = tracks.take(id);
+                        } else if (added) {
+                            tracks.erase(id);
+                        }
                         throw;
                     }
+                }
+
+                /* Adds a play of track already present in the index, in
+                 * the queue before the play in slot before (at the end for
+                 * no_slot); among plays of the track it is always the
+                 * last. Same guarantees as push_back.
+                 */
+                template <typename Q>
+                slot_t append(std::uint32_t id, Q &&params,
+                              slot_t before = no_slot) {
+                    track_info &info = tracks.info(id);
+                    slot_t prev = before == no_slot
+                                  ? tail : std::as_const(plays).link(before).prev;
+                    counts.reserve(id);
+                    // chunks written below are made private first; the one
+                    // of the new slot by allocate
+                    for (slot_t n : {prev, before, info.tail}) {
+                        if (n != no_slot)
+                            plays.own(n);
+                    }
+                    durations.reserve(plays.slot_bound());
+                    slot_t s = plays.allocate(std::forward<Q>(params));
+
+                    // after here, only links change, so nothing can throw
+                    plays.link(s) = {no_slot, no_slot, info.tail, no_slot, id};
+                    attach(s, before);
+                    durations.insert_after(prev, s, plays.params(s));
+
+                    if (info.tail != no_slot)
+                        plays.link(info.tail).occ_next = s;
+                    else
+                        info.head = s;
+                    info.tail = s;
+                    ++info.count;
+                    counts.increment(id, info.count);
+                    count_changed(id, 1);
+                    return s;
+                }
+
+                // Indexes that sum counts over ranges of tracks
+                // (treap_index) follow every change of a count.
+                void count_changed(std::uint32_t id, std::ptrdiff_t delta)
+                noexcept {
+                    if constexpr (requires { tracks.add_plays(id, delta); })
+                        tracks.add_plays(id, delta);
+                }
+
+                // Makes private the chunks that erase(s) writes to.
+                void own_around(slot_t s) {
+                    play_link l = std::as_const(plays).link(s);
+                    plays.own(s);
+                    for (slot_t n : {l.prev, l.next, l.occ_prev, l.occ_next}) {
+                        if (n != no_slot)
+                            plays.own(n);
+                    }
+                }
+
+                // Same for erase_track(id).
+                void own_track(std::uint32_t id) {
+                    for (slot_t s = tracks.info(id).head; s != no_slot;) {
+                        play_link l = std::as_const(plays).link(s);
+                        plays.own(s);
+                        if (l.prev != no_slot)
+                            plays.own(l.prev);
+                        if (l.next != no_slot)
+                            plays.own(l.next);
+                        s = l.occ_next;
+                    }
+                }
+
+                // Puts play s in the queue before the play in slot before
+                // (at the end for no_slot). Chunks have to be owned.
+                void attach(slot_t s, slot_t before) noexcept {
+                    play_link &l = plays.link(s);
+                    l.prev = before == no_slot ? tail : plays.link(before).prev;
+                    l.next = before;
+                    if (l.prev != no_slot)
+                        plays.link(l.prev).next = s;
+                    else
+                        head = s;
+                    if (before != no_slot)
+                        plays.link(before).prev = s;
+                    else
+                        tail = s;
+                }
+
+                // Takes play s out of the queue, the slot stays in use.
+                void detach(slot_t s) noexcept {
+                    play_link const &l = plays.link(s);
+                    if (l.prev != no_slot)
+                        plays.link(l.prev).next = l.next;
+                    else
+                        head = l.next;
+                    if (l.next != no_slot)
+                        plays.link(l.next).prev = l.prev;
+                    else
+                        tail = l.prev;
+                }
+
+                // Unlinks a play from the queue and frees its slot. Chunks
+                // of the play and its neighbours have to be owned.
+                void unlink(slot_t s) noexcept {
+                    durations.erase(s);
+                    detach(s);
+                    plays.release(s);
+                }
+
+                // Makes private the chunks that move(s, before) writes to.
+                void own_move(slot_t s, slot_t before) {
+                    play_link l = std::as_const(plays).link(s);
+                    slot_t prev = before == no_slot
+                                  ? tail : std::as_const(plays).link(before).prev;
+                    for (slot_t n : {s, l.prev, l.next, before, prev}) {
+                        if (n != no_slot)
+                            plays.own(n);
+                    }
+                }
+
+                // Moves play s before the play in slot before; see own_move.
+                void move(slot_t s, slot_t before) noexcept {
+                    durations.erase(s);
+                    detach(s);
+                    attach(s, before);
+                    durations.insert_after(plays.link(s).prev, s,
+                                           plays.params(s));
+                }
+
+                // Removes a single play, and its track if it was the last
+                // (unless the caller takes it); see own_around.
+                void erase(slot_t s, bool drop_track = true) noexcept {
+                    play_link const &l = plays.link(s);
+                    std::uint32_t id = l.track;
+                    track_info &info = tracks.info(id);
+                    if (l.occ_prev != no_slot)
+                        plays.link(l.occ_prev).occ_next = l.occ_next;
+                    else
+                        info.head = l.occ_next;
+                    if (l.occ_next != no_slot)
+                        plays.link(l.occ_next).occ_prev = l.occ_prev;
+                    else
+                        info.tail = l.occ_prev;
+                    unlink(s);
+
+                    // track not present in playlist => remove it
+                    counts.decrement(id, --info.count);
+                    count_changed(id, -1);
+                    if (info.count == 0 && drop_track)
+                        tracks.erase(id);
+                }
+
+                // Removes all plays of a track, and the track itself; see
+                // own_track.
+                void erase_track(std::uint32_t id) noexcept {
+                    for (slot_t s = tracks.info(id).head; s != no_slot;) {
+                        slot_t next = plays.link(s).occ_next;
+                        unlink(s);
+                        s = next;
+                    }
+                    counts.erase(id);
+                    tracks.erase(id);
+                }
 
-                    // get iterator for this node
-                    p_queue_iter queue_it = std::prev(play_queue.end());
+                // Makes the queue go through slots in the given order;
+                // chunks have to be owned.
+                void relink(std::vector<slot_t> const &order) noexcept {
+                    if constexpr (!std::is_same_v<durations_type,
+                                                  no_durations>) {
+                        for (slot_t s : order)
+                            durations.erase(s);
+                    }
+                    slot_t prev = no_slot;
+                    for (slot_t s : order) {
+                        play_link &l = plays.link(s);
+                        l.prev = prev;
+                        if (prev != no_slot)
+                            plays.link(prev).next = s;
+                        durations.insert_after(prev, s, plays.params(s));
+                        prev = s;
+                    }
+                    plays.link(prev).next = no_slot;
+                    head = order.front();
+                    tail = prev;
+                }
 
+                /* Puts all plays of src at the end of the queue. The plays
+                 * themselves come from from, the slab of src or a copy of
+                 * it, with all chunks owned; it is left empty. Tracks of
+                 * src are looked up (added) here first, so that everything
+                 * that may throw is done before any link changes. Strong
+                 * guarantee for this data.
+                 */
+                void splice_back(playlistData const &src, storage_type &from) {
+                    struct moved_track {
+                        std::uint32_t id;
+                        track_info info;
+                    };
+                    std::vector<std::uint32_t> ids(src.tracks.id_bound());
+                    std::vector<moved_track> moved;
+                    std::vector<std::uint32_t> added;
+                    std::shared_ptr<owner_list const> all_owners;
+                    moved.reserve(src.tracks.size());
+                    added.reserve(src.tracks.size());
                     try {
-                        auto list_it = map_it->second.insert
-                                            (map_it->second.end(), queue_it);
-                        queue_it->self_ptr = list_it;
+                        for (auto const &[track, entry] : src.tracks) {
+                            auto [id, inserted] = tracks.insert(track);
+                            if (inserted)
+                                added.push_back(id);
+                            counts.reserve(id);
+                            ids[entry.id] = id;
+                            moved.push_back({id, entry.info});
+                            slot_t last = tracks.info(id).tail;
+                            if (last != no_slot)
+                                plays.own(last);
+                        }
+                        if (tail != no_slot)
+                            plays.own(tail);
+                        all_owners = joined(owners, src.owners);
+                        durations.reserve(plays.chunk_count()
+                                          * storage_type::chunk_size
+                                          + from.slot_bound());
+                        durations.reserve_touched(src.durations);
+                        plays.reserve_splice(from);
                     } catch (...) {
-                        // rollback 2, insert failed
-                        play_queue.pop_back();
-                        if (added)
-                            tracks.erase(map_it);
+                        // rollback, tracks that came with src leave
+                        for (std::uint32_t id : added)
+                            tracks.erase(id);
                         throw;
                     }
+
+                    // after here, only links change, so nothing can throw
+                    slot_t off = plays.splice(from, [&](play_link &l) {
+                        l.track = ids[l.track];
+                    });
+                    slot_t first = src.head + off;
+                    if (tail != no_slot) {
+                        plays.link(tail).next = first;
+                        plays.link(first).prev = tail;
+                    } else {
+                        head = first;
+                    }
+                    if constexpr (!std::is_same_v<durations_type,
+                                                  no_durations>) {
+                        for (slot_t s = first, prev = tail; s != no_slot;
+                             prev = s, s = plays.link(s).next)
+                            durations.insert_after(prev, s, plays.params(s));
+                        durations.take_touched(src.durations, off);
+                    }
+                    tail = src.tail + off;
+
+                    for (moved_track const &m : moved) {
+                        track_info &info = tracks.info(m.id);
+                        slot_t h = m.info.head + off;
+                        if (info.tail != no_slot) {
+                            plays.link(info.tail).occ_next = h;
+                            plays.link(h).occ_prev = info.tail;
+                        } else {
+                            info.head = h;
+                        }
+                        info.tail = m.info.tail + off;
+                        if constexpr (std::is_same_v<counts_type,
+                                                     no_counts>) {
+                            info.count += m.info.count;
+                        } else {
+                            // count_order moves a track a bucket at a time
+                            for (std::size_t i = 0; i < m.info.count; ++i)
+                                counts.increment(m.id, ++info.count);
+                        }
+                        count_changed(m.id,
+                                      static_cast<std::ptrdiff_t>(m.info.count));
+                    }
+                    owners = std::move(all_owners);
+                }
+
+                /* List of owners with those of more not in it yet added;
+                 * one of the two when the other adds nothing, so that
+                 * copies keep sharing it. Strong guarantee.
+                 */
+                static std::shared_ptr<owner_list const> joined(
+                        std::shared_ptr<owner_list const> const &owners,
+                        std::shared_ptr<owner_list const> const &more) {
+                    if (!more || owners == more)
+                        return owners;
+                    if (!owners)
+                        return more;
+                    auto fresh = [&](std::shared_ptr<void const> const &o) {
+                        return std::find(owners->begin(), owners->end(), o)
+                               == owners->end();
+                    };
+                    if (std::none_of(more->begin(), more->end(), fresh))
+                        return owners;
+                    auto res = std::make_shared<owner_list>(*owners);
+                    std::copy_if(more->begin(), more->end(),
+                                 std::back_inserter(*res), fresh);
+                    return res;
                 }
             };
 
-            /* Flag and shared_ptr needed to provide COW for playlist object.
-             * Shareable is set to true whenever we give to user modifying
-             * reference, and set to false after aby other sort of modifying
-             * operation. Flag sets COW optimisation off.
+            using data_ptr = typename sharing::template pointer<
+                playlistData, allocator_type>;
+
+            /* Flag and shared pointer needed to provide COW for playlist
+             * object. Shareable is set to true whenever we give to user
+             * modifying reference, and set to false after aby other sort of
+             * modifying operation. Flag sets COW optimisation off.
              */
-            std::shared_ptr<playlistData> data_;
+            data_ptr data_;
             bool shareable_ = true;
+            // Live params_guards and the flag the last of them restores;
+            // a plain params() while they live makes it false.
+            unsigned guards_ = 0;
+            bool restore_ = true;
+
+            template <typename... Args>
+            static data_ptr make_data(Args &&...args) {
+                return sharing::template make<playlistData>(
+                    allocator_type(), std::forward<Args>(args)...);
+            }
+
+            // Copy of data, reported to the instrumentation policy.
+            template <typename... Deep>
+            static data_ptr copy_data(playlistData const &d, Deep... deep) {
+                cow_timer<instrumentation> timer;
+                data_ptr res = make_data(d, deep...);
+                timer.done({cow_event_kind::data_copy, d.tracks.size(),
+                            sizeof...(Deep) > 0 ? d.plays.size() : 0});
+                return res;
+            }
+
+            // Reports a write to data shared or not.
+            static void count_write(bool shared) noexcept {
+                instrumentation::record({shared ? cow_event_kind::shared_write
+                                                : cow_event_kind::unique_write});
+            }
+
+            void set_shareable(bool shareable) noexcept {
+                if (shareable != shareable_) {
+                    instrumentation::record({shareable
+                                             ? cow_event_kind::shareable_on
+                                             : cow_event_kind::shareable_off});
+                }
+                // References to params handed out are dead now.
+                if (shareable)
+                    data_->durations.settle(data_->plays);
+                shareable_ = shareable;
+            }
 
             // Makes data_ point at a new copy, when data is shared by more
             // than a [count] pointer instances. Helper function.
             void ensure_count(long int count) {
-                if (data_.use_count() > count) {
-                    data_ = std::make_shared<playlistData>(*data_);
+                bool shared = data_.use_count() > count;
+                count_write(shared);
+                if (shared) {
+                    data_ = copy_data(*data_);
+                }
+            }
+
+            // Mutable params of a play for params() and edit(), see there.
+            P & unshare_params(slot_t slot) {
+                auto copy = data_;
+
+                try {
+                    bool shared = data_.use_count() > 2;
+                    count_write(shared);
+                    if (shared) {
+                        data_ = copy_data(*copy);
+                    }
+                    data_->plays.own(slot);
+                    data_->durations.touch(slot);
+                } catch (...) {
+                    data_ = copy;
+                    throw;
+                }
+
+                set_shareable(false);
+                return data_->plays.params(slot);
+            }
+
+            // Queue in the given order, for shuffle.
+            void relink(std::vector<slot_t> const &order) {
+                auto ptr = data_;
+                try {
+                    ensure_count(2);
+                    data_->plays.own_all();
+                } catch (...) {
+                    data_ = ptr;
+                    throw;
                 }
+
+                data_->relink(order);
+
+                set_shareable(true);
             }
 
         public:
             playlist()
-                : data_(std::make_shared<playlistData>()) {}
+                : data_(make_data()) {}
 
             playlist(playlist const &other)
                 : data_(!other.shareable_                          // if
-                    ? std::make_shared<playlistData>(*other.data_) // then
+                    ? copy_data(*other.data_, deep_copy)           // then
                     : other.data_), shareable_(true) {}            // else
 
             // Although technically we can leave other in damaged state, we
             // leave him in correct, empty state.
             playlist(playlist &&other)
                 : data_(std::move(other.data_)), shareable_(other.shareable_) {
-                    other.data_ = std::make_shared<playlistData>();
+                    other.data_ = make_data();
                     other.shareable_ = true;
                 }
             
             ~playlist() = default;
             playlist & operator=(playlist other) {
                 data_ = !other.shareable_                          // if
-                    ? std::make_shared<playlistData>(*other.data_) // then
+                    ? copy_data(*other.data_, deep_copy)           // then
                     : other.data_;                                 // else
-                shareable_ = true;
+                set_shareable(true);
                 return *this;
             }
 
@@ -143,64 +539,232 @@ namespace cxx {
                 try {
                     ensure_count(2);
                     data_->push_back(track, params);
-                    shareable_ = true;
+                    set_shareable(true);
                 } catch (...) {
                     data_= ptr;
                     throw;
                 }
             }
 
+            // Track-only interface for params that hold nothing, like
+            // std::monostate: they are not stored per play at all.
+            void push_back (T const &track) requires stateless_params<P> {
+                push_back(track, P{});
+            }
+
             void pop_front() {
-                if (data_->play_queue.empty()) {
+                if (data_->head == no_slot) {
                     throw std::out_of_range("pop_front, playlist empty");
                 }
-                ensure_count(1);
-
-                playNode &node = data_->play_queue.front();
-                node.track_nod_ptr->second.erase(node.self_ptr);
-
-                // track not present in playlist => remove ir
-                if (node.track_nod_ptr->second.empty()) {
-                    data_->tracks.erase(node.track_nod_ptr);
+                auto ptr = data_;
+                try {
+                    ensure_count(2);
+                    data_->own_around(data_->head);
+                } catch (...) {
+                    data_ = ptr;
+                    throw;
                 }
-                data_->play_queue.pop_front();
 
-                shareable_ = true;
+                data_->erase(data_->head);
+
+                set_shareable(true);
             }
 
             const std::pair<T const &, P const &> front() const {
-                if (data_->play_queue.empty()) {
+                if (data_->head == no_slot) {
                     throw std::out_of_range("front, playlist empty");
                 }
                 
-                playNode &node = data_->play_queue.front();
-                return {node.track_nod_ptr->first, node.params};
+                return play(play_begin());
             }
 
             void remove(T const &track) {
-                auto map_it = data_->tracks.find(track);
-                if (map_it == data_->tracks.end()) {
+                std::uint32_t id = data_->tracks.find(track);
+                if (id == no_slot) {
                     throw std::invalid_argument("remove, unknown track");
                 }
-                ensure_count(1);
+                auto ptr = data_;
+                try {
+                    ensure_count(2);
+                    // ids are the same in a copy, so no need to look up again
+                    data_->own_track(id);
+                } catch (...) {
+                    data_ = ptr;
+                    throw;
+                }
                 // after here, only destructors, so nothing should be thrown
-                map_it = data_->tracks.find(track);
-                
-                auto &occurrences = map_it->second;
-                for (auto &queue_it : occurrences) {
-                    data_->play_queue.erase(queue_it);
+                data_->erase_track(id);
+
+                set_shareable(true);
+            }
+
+            /* Moves all plays of other to the end of this playlist, other
+             * is left empty. Chunks of plays move over whole and are
+             * renumbered in place, no params are copied unless other
+             * shares them with its copies; tracks of other are added to
+             * the index one by one. O(n' + m' log m) for n' plays of m'
+             * tracks in other. Strong guarantee.
+             */
+            void splice_back(playlist &&other) {
+                if (&other == this || other.size() == 0)
+                    return;
+                data_ptr fresh = make_data();
+                // References into params of other stay valid and now point
+                // into our data, so it must not be shared while they may
+                // be in use, as with the move constructor.
+                bool shareable = other.shareable_;
+                if (size() == 0 && !data_->owners) {
+                    data_ = std::move(other.data_);
+                } else {
+                    shareable = shareable && shareable_;
+                    playlistData const &src = *other.data_;
+                    auto ptr = data_;
+                    try {
+                        ensure_count(2);
+                        // Chunks of other that its copies see are copied,
+                        // the rest change hands.
+                        std::optional<storage_type> copy;
+                        if (other.data_.use_count() > 1)
+                            copy.emplace(src.plays);
+                        storage_type &from = copy ? *copy
+                                                  : other.data_->plays;
+                        from.own_all();
+                        data_->splice_back(src, from);
+                    } catch (...) {
+                        data_ = ptr;
+                        throw;
+                    }
+                }
+                other.data_ = std::move(fresh);
+                other.set_shareable(true);
+                set_shareable(shareable);
+            }
+
+            /* Adds all plays of other at the end. Into an empty playlist
+             * this is a copy, sharing everything; otherwise as splice_back
+             * of a copy of other, so chunks are copied whole (a memcpy for
+             * trivially copyable params) and renumbered. Strong guarantee.
+             */
+            void append(playlist const &other) {
+                if (size() == 0 && !data_->owners) {
+                    *this = other;
+                    return;
+                }
+                playlist copy(other);
+                splice_back(std::move(copy));
+            }
+
+            /* Puts the plays in random order, in place: only links of the
+             * queue change, the plays and the index stay where they are.
+             * O(n), O(n log n) with duration_index. Rng is a uniform
+             * random bit generator, as for std::shuffle. Strong guarantee.
+             */
+            template <typename Rng>
+            void shuffle(Rng &&rng) {
+                if (size() < 2)
+                    return;
+                std::vector<slot_t> order;
+                order.reserve(size());
+                storage_type const &plays = data_->plays;
+                for (slot_t s = data_->head; s != no_slot;
+                     s = plays.link(s).next)
+                    order.push_back(s);
+                std::shuffle(order.begin(), order.end(), rng);
+                relink(order);
+            }
+
+            /* Same, but two plays of one track get at least gap other
+             * plays between them (see spaced_order); invalid_argument if
+             * that cannot be done. Plays of a track are taken from its
+             * list of plays in random order. O(n log m).
+             */
+            template <typename Rng>
+            void shuffle(Rng &&rng, size_t gap) {
+                if (gap == 0 || size() < 2) {
+                    shuffle(rng);
+                    return;
+                }
+                playlistData const &d = *data_;
+                // Tracks numbered densely, in key order.
+                std::vector<std::size_t> counts;
+                std::vector<std::size_t> first;
+                counts.reserve(d.tracks.size());
+                first.reserve(d.tracks.size());
+                std::vector<slot_t> slots;
+                slots.reserve(size());
+                for (auto const &[track, entry] : d.tracks) {
+                    first.push_back(slots.size());
+                    counts.push_back(entry.info.count);
+                    for (slot_t s = entry.info.head; s != no_slot;
+                         s = d.plays.link(s).occ_next)
+                        slots.push_back(s);
+                    std::shuffle(slots.begin() + first.back(), slots.end(),
+                                 rng);
                 }
-                data_->tracks.erase(map_it);
+                std::vector<std::uint32_t> tracks =
+                    spaced_order(std::move(counts), gap)(rng);
 
-                shareable_ = true;
+                std::vector<slot_t> order;
+                order.reserve(size());
+                for (std::uint32_t j : tracks)
+                    order.push_back(slots[first[j]++]);
+                relink(order);
             }
 
             void clear() {
-                data_ = std::make_shared<playlistData>();
+                data_ = make_data();
+            }
+
+            /* Ties lifetime of owner to the data of this playlist and of all
+             * its copies. Meant for T or P that refer to external memory,
+             * like string_view tracks pointing into a mapped file. Released
+             * by clear() or when the last copy dies. Copies the list of
+             * owners, meant for a few of them.
+             */
+            void keep_alive(std::shared_ptr<void const> owner) {
+                auto ptr = data_;
+                try {
+                    ensure_count(2);
+                    data_->owners = playlistData::joined(data_->owners,
+                        std::make_shared<owner_list const>(1, std::move(owner)));
+                } catch (...) {
+                    data_ = ptr;
+                    throw;
+                }
+
+                set_shareable(true);
             }
 
             size_t size() const noexcept {
-                return data_->play_queue.size();
+                return data_->plays.size();
+            }
+
+            /* Memory held by the data, see memory_stats. O(1): everything
+             * comes from sizes the containers keep anyway, so it can be
+             * polled as a metric. Heap memory of params is not counted,
+             * tracks count their string buffers only.
+             */
+            memory_stats memory_usage() const noexcept {
+                playlistData const &d = *data_;
+                std::size_t chunks = d.plays.chunk_count();
+                std::size_t occ_links = chunks * storage_type::chunk_size
+                                        * 2 * sizeof(slot_t);
+                std::size_t infos = d.tracks.size() * sizeof(track_info);
+
+                memory_stats res;
+                res.params = chunks * storage_type::params_bytes;
+                res.occurrences = occ_links + infos;
+                res.queue = d.plays.capacity_bytes() - res.params - occ_links
+                            + d.plays.table_bytes() + sizeof(playlistData)
+                            + (d.owners ? sizeof(owner_list)
+                                   + d.owners->capacity()
+                                     * sizeof((*d.owners)[0]) : 0)
+                            + d.durations.memory_bytes();
+                res.index = d.tracks.memory_bytes() - infos
+                            + d.counts.memory_bytes();
+                res.owners = data_.use_count();
+                res.shared = res.owners > 1;
+                return res;
             }
 
             // Iterators implementation
@@ -210,36 +774,30 @@ namespace cxx {
 
                 public:
                     using iterator_category = std::forward_iterator_tag;
-                    using value_type = playNode;
+                    using value_type = slot_t;
                     using difference_type = std::ptrdiff_t;
-                    using pointer = p_queue_iter;
-                    using reference = value_type&;
 
                     play_iterator & operator++() {
-                        ++ptr;
+                        slot = data->plays.link(slot).next;
                         return *this;
                     }
 
                     play_iterator operator++(int) {
                         play_iterator tmp(*this);
-                        ++ptr;
+                        ++*this;
                         return tmp;
                     }
 
                     bool operator==(const play_iterator & oth) const = default;
                     bool operator!=(const play_iterator & oth) const = default;
                 private:
-                    pointer ptr;
-
-                    play_iterator(pointer p = nullptr): ptr{p} {}
-
-                    reference operator*() const noexcept {
-                        return *ptr;
-                    }
+                    // Slot numbers are the same in every copy of the data,
+                    // so an iterator also identifies the play in a copy.
+                    playlistData const *data;
+                    slot_t slot;
 
-                    pointer operator->() const noexcept {
-                        return ptr;
-                    }
+                    play_iterator(playlistData const *d = nullptr,
+                                  slot_t s = no_slot): data{d}, slot{s} {}
             };
 
             class sorted_iterator {
@@ -248,9 +806,10 @@ namespace cxx {
 
                 public:
                     using iterator_category = std::forward_iterator_tag;
-                    using value_type = std::pair<T, std::list<p_queue_iter>>;
+                    using value_type = typename index_type::const_iterator
+                                                          ::value_type;
                     using difference_type = std::ptrdiff_t;
-                    using pointer = typename track_map::const_iterator;
+                    using pointer = typename index_type::const_iterator;
                     using reference = const value_type&;
 
                     sorted_iterator & operator++() {
@@ -269,7 +828,7 @@ namespace cxx {
                 private:
                     pointer ptr;
 
-                    sorted_iterator(pointer p = nullptr): ptr{p} {}
+                    sorted_iterator(pointer p = {}): ptr{p} {}
 
                     reference operator*() const noexcept {
                         return *ptr;
@@ -280,72 +839,583 @@ namespace cxx {
                     }
             };
 
+            /* Inserts a play before pos (at the end for play_end()) and
+             * returns an iterator to it. O(log m), as push_back. Strong
+             * guarantee.
+             */
+            play_iterator insert(play_iterator const &pos, T const &track,
+                                 P const &params) {
+                auto ptr = data_;
+                slot_t s;
+                try {
+                    ensure_count(2);
+                    s = data_->push_back(track, params, pos.slot);
+                    set_shareable(true);
+                } catch (...) {
+                    data_ = ptr;
+                    throw;
+                }
+                return play_iterator(data_.get(), s);
+            }
+
+            // Removes a single play and returns an iterator to the one
+            // after it. O(1), the track goes as well with its last play.
+            play_iterator erase(play_iterator const &it) {
+                if (it.slot == no_slot) {
+                    throw std::out_of_range("erase, end of playlist");
+                }
+                auto ptr = data_;
+                try {
+                    ensure_count(2);
+                    data_->own_around(it.slot);
+                } catch (...) {
+                    data_ = ptr;
+                    throw;
+                }
+
+                slot_t next = std::as_const(data_->plays).link(it.slot).next;
+                data_->erase(it.slot);
+
+                set_shareable(true);
+                return play_iterator(data_.get(), next);
+            }
+
+            /* Moves the play at it before dest (to the end for play_end()).
+             * O(1), or O(log n) with duration_index. Strong guarantee.
+             */
+            void move(play_iterator const &it, play_iterator const &dest) {
+                if (it.slot == no_slot) {
+                    throw std::out_of_range("move, end of playlist");
+                }
+                if (it.slot == dest.slot
+                    || std::as_const(data_->plays).link(it.slot).next
+                       == dest.slot)
+                    return;
+                auto ptr = data_;
+                try {
+                    ensure_count(2);
+                    data_->own_move(it.slot, dest.slot);
+                } catch (...) {
+                    data_ = ptr;
+                    throw;
+                }
+
+                data_->move(it.slot, dest.slot);
+
+                set_shareable(true);
+            }
+
+            /* A play taken out by extract: its track and params, owned.
+             * Move-only and possibly empty, like the node handles of
+             * std::map; params may be changed before it goes back in.
+             * Owners kept alive by the source (keep_alive) travel along,
+             * their list shared, so string_view tracks stay valid.
+             */
+            class node_type {
+                friend class playlist;
+
+                public:
+                    node_type() = default;
+                    node_type(node_type &&) = default;
+                    node_type & operator=(node_type &&) = default;
+
+                    bool empty() const noexcept {
+                        return !value_;
+                    }
+
+                    explicit operator bool() const noexcept {
+                        return !empty();
+                    }
+
+                    T const & track() const noexcept {
+                        return value_->first;
+                    }
+
+                    P & params() noexcept {
+                        return value_->second;
+                    }
+
+                private:
+                    std::optional<std::pair<T, P>> value_{};
+                    std::shared_ptr<owner_list const> owners_{};
+            };
+
+            /* Takes the play at it out, as erase, and returns it with its
+             * track. Nothing is copied if the play was the last of its
+             * track and the index can hand keys over (map_index,
+             * hashed_index; integral tracks are cheap to copy anyway).
+             * Strong guarantee.
+             */
+            node_type extract(play_iterator const &it) {
+                if (it.slot == no_slot) {
+                    throw std::out_of_range("extract, end of playlist");
+                }
+                std::uint32_t id = std::as_const(data_->plays).link(it.slot)
+                                   .track;
+                constexpr bool take = std::is_nothrow_move_constructible_v<P>
+                    && requires (index_type &i) { i.take(id); };
+                bool last = data_->tracks.info(id).count == 1;
+
+                node_type res;
+                auto ptr = data_;
+                try {
+                    ensure_count(2);
+                    data_->own_around(it.slot);
+                    res.owners_ = data_->owners;
+                    if (!take || !last) {
+                        res.value_.emplace(data_->tracks.key(id),
+                            std::move_if_noexcept(
+                                data_->plays.params(it.slot)));
+                    }
+                } catch (...) {
+                    data_ = ptr;
+                    throw;
+                }
+
+                if constexpr (take) {
+                    if (last) {
+                        P params(std::move(data_->plays.params(it.slot)));
+                        data_->erase(it.slot, false);
+                        res.value_.emplace(data_->tracks.take(id),
+                                           std::move(params));
+                    }
+                }
+                if (!take || !last)
+                    data_->erase(it.slot);
+
+                set_shareable(true);
+                return res;
+            }
+
+            /* Puts an extracted play back, into this or any playlist of
+             * the same type, before pos; node is left empty. Owners of the
+             * node not kept alive here yet are added, as by keep_alive.
+             * Takes no memory when the track is known here, a slot is free
+             * and there are no new owners. Strong guarantee: on failure
+             * node keeps the play.
+             */
+            play_iterator insert(play_iterator const &pos, node_type &&node) {
+                if (node.empty()) {
+                    throw std::invalid_argument("insert, empty node");
+                }
+                auto ptr = data_;
+                slot_t s;
+                try {
+                    ensure_count(2);
+                    // List first, so that owners go in without throwing
+                    // once the play is in.
+                    auto owners = playlistData::joined(data_->owners,
+                                                       node.owners_);
+                    s = data_->push_back(std::move(node.value_->first),
+                            std::move_if_noexcept(node.value_->second),
+                            pos.slot);
+                    data_->owners = std::move(owners);
+                    set_shareable(true);
+                } catch (...) {
+                    data_ = ptr;
+                    throw;
+                }
+                node.owners_.reset();
+                node.value_.reset();
+                return play_iterator(data_.get(), s);
+            }
+
             const std::pair<T const &, P const &> play(play_iterator const &it)
             const {
-                return {it->track_nod_ptr->first, it->params};
+                return {track(it), it.data->plays.params(it.slot)};
+            }
+
+            T const & track(play_iterator const &it) const {
+                playlistData const &d = *it.data;
+                return d.tracks.key(d.plays.link(it.slot).track);
             }
 
             const std::pair<T const &, size_t> pay(sorted_iterator const &it)
             const {
-                return {it->first, it->second.size()};
+                return {it->first, it->second.info.count};
+            }
+
+            /* The k most played tracks with their counts, most played
+             * first, ties in no particular order. O(k), with count_index:
+             * tracks are kept ordered by count as plays come and go (see
+             * count_order).
+             */
+            std::vector<std::pair<T const &, size_t>> top_k(size_t k) const
+            requires (!std::is_same_v<counts_type, no_counts>) {
+                std::vector<std::pair<T const &, size_t>> res;
+                if (k == 0)
+                    return res;
+                res.reserve(std::min(k, data_->tracks.size()));
+                data_->counts.descending([&](std::uint32_t id, size_t count) {
+                    res.emplace_back(data_->tracks.key(id), count);
+                    return res.size() < k;
+                });
+                return res;
+            }
+
+            // Tracks played at least c times, as top_k. O(1 + answer).
+            std::vector<std::pair<T const &, size_t>> played_at_least(size_t c)
+            const requires (!std::is_same_v<counts_type, no_counts>) {
+                std::vector<std::pair<T const &, size_t>> res;
+                data_->counts.descending([&](std::uint32_t id, size_t count) {
+                    if (count < c)
+                        return false;
+                    res.emplace_back(data_->tracks.key(id), count);
+                    return true;
+                });
+                return res;
             }
 
             /* Only function returning modifying refernce to the user. That's
-             * why it needs to set sharable_ to false. It can throw both
-             * when it is incorrect or if making a copy of internal state fails,
-             * but guarantees strong exception safety, by using backup - 'copy'.
+             * why it needs to set sharable_ to false. It can throw only if
+             * making a copy of internal state fails, but guarantees strong
+             * exception safety, by using backup - 'copy'. Slots are the same
+             * in the copy, so the iterator finds its play there directly.
+             * The copy shares chunks of plays, only the chunk holding the
+             * play is copied: O(m + n / K + K) instead of O(n + m).
              */
             P & params(play_iterator const &it) {
-                auto copy = data_;
-                P * res;
+                P &res = unshare_params(it.slot);
+                restore_ = false;
+                return res;
+            }
 
-                try {
-                    res = &(it->params);
-                    if (data_.use_count() > 2) {
-                        data_ = std::make_shared<playlistData>();
-                        auto & pq = copy->play_queue;
-
-                        // We can't jsut use playlistData copy constructor, as
-                        // we need to make sure we give to user reference to
-                        // correct, freshly created, playNode params.
-                        for (auto it2 = pq.begin(); it2 != pq.end(); ++it2) {
-                            data_->push_back(
-                                        it2->track_nod_ptr->first, 
-                                        it2->params);
-                            if (it2 == it.ptr) {
-                                res = &(data_->play_queue.back().params);
-                            }
-                        }
+            /* Scoped mutable access to params of a play: while the guard
+             * lives, copies of the playlist do not share data with it (as
+             * after params()); once it dies, sharing is back to what it was
+             * before, so later copies are O(1) again. Guards may nest; a
+             * plain params() called meanwhile keeps sharing off after the
+             * last guard dies, its reference may still be in use.
+             */
+            class params_guard {
+                friend class playlist;
+
+                public:
+                    params_guard(params_guard const &) = delete;
+                    params_guard & operator=(params_guard const &) = delete;
+
+                    ~params_guard() {
+                        if (--owner_.guards_ == 0)
+                            owner_.set_shareable(owner_.restore_);
                     }
-                } catch (...) {
-                    data_ = copy;
-                    throw;
-                }
 
-                shareable_ = false;
-                return *res;
+                    P & operator*() const noexcept {
+                        return params_;
+                    }
+
+                    P * operator->() const noexcept {
+                        return &params_;
+                    }
+
+                private:
+                    playlist &owner_;
+                    P &params_;
+
+                    params_guard(playlist &owner, P &params)
+                        : owner_(owner), params_(params) {
+                        ++owner_.guards_;
+                    }
+            };
+
+            // Same guarantees as params().
+            params_guard edit(play_iterator const &it) {
+                bool restore = guards_ > 0 ? restore_ : shareable_;
+                P &p = unshare_params(it.slot);
+                restore_ = restore;
+                return params_guard(*this, p);
+            }
+
+            /* Calls fn with mutable params of a play and returns its result;
+             * sharing stays enabled afterwards. If fn throws, the params
+             * keep whatever fn did to them.
+             */
+            template <typename F>
+            decltype(auto) modify(play_iterator const &it, F &&fn) {
+                params_guard guard = edit(it);
+                return std::forward<F>(fn)(*guard);
             }
 
             // Rest of functions giving user access to the structure.
             const P & params(play_iterator const &it) const {
-                return it->params;
+                return it.data->plays.params(it.slot);
             }
 
             play_iterator play_begin() const noexcept {
-                return play_iterator(data_->play_queue.begin());
+                return play_iterator(data_.get(), data_->head);
             }
 
             play_iterator play_end() const noexcept {
-                return play_iterator(data_->play_queue.end());
+                return play_iterator(data_.get(), no_slot);
             }
 
-            sorted_iterator sorted_begin() const noexcept {
+            /* The same play as it, in the current data of this playlist.
+             * Needed for an iterator kept across writes that may have
+             * copied shared data (slots are the same in the copy). O(1).
+             */
+            play_iterator same_play(play_iterator const &it) const noexcept {
+                return play_iterator(data_.get(), it.slot);
+            }
+
+            // May throw with an index that sorts lazily (hashed_index).
+            sorted_iterator sorted_begin() const
+            noexcept(noexcept(std::declval<index_type const &>().begin())) {
                 return sorted_iterator(data_->tracks.begin());
             }
 
-            sorted_iterator sorted_end() const noexcept {
+            sorted_iterator sorted_end() const
+            noexcept(noexcept(std::declval<index_type const &>().end())) {
                 return sorted_iterator(data_->tracks.end());
             }
+
+            // First track not less than track (greater, for upper_bound),
+            // as in std::map. O(log m).
+            sorted_iterator sorted_lower_bound(T const &track) const {
+                return sorted_iterator(data_->tracks.lower_bound(track));
+            }
+
+            sorted_iterator sorted_upper_bound(T const &track) const {
+                return sorted_iterator(data_->tracks.upper_bound(track));
+            }
+
+            std::pair<sorted_iterator, sorted_iterator>
+            sorted_equal_range(T const &track) const {
+                return {sorted_lower_bound(track), sorted_upper_bound(track)};
+            }
+
+            /* Plays of all tracks in [from, to), and the k-th track in key
+             * order (sorted_end() if there are not that many); O(log m),
+             * with an index that keeps sums (order_statistic_index).
+             */
+            size_t plays_between(T const &from, T const &to) const
+            requires requires (index_type const &i) { i.plays_below(to); } {
+                if (!(from < to))
+                    return 0;
+                return data_->tracks.plays_below(to)
+                       - data_->tracks.plays_below(from);
+            }
+
+            sorted_iterator sorted_nth(size_t k) const
+            requires requires (index_type const &i) { i.nth(k); } {
+                return sorted_iterator(data_->tracks.nth(k));
+            }
+
+            /* Play on air t after the head of the queue started, i.e. the
+             * one whose [start, start + duration) holds t, or play_end()
+             * when the queue is over by then; and where a play starts, and
+             * how long the queue is. O(log n), with duration_index<F>.
+             * Durations changed through params() are taken into account.
+             */
+            template <typename D = durations_type>
+            play_iterator seek_time(typename D::duration_type t) const {
+                playlistData const &d = *data_;
+                return play_iterator(&d, d.durations.seek(d.plays, t));
+            }
+
+            template <typename D = durations_type>
+            typename D::duration_type start_time(play_iterator const &it)
+            const {
+                return it.data->durations.start(it.data->plays, it.slot);
+            }
+
+            template <typename D = durations_type>
+            typename D::duration_type total_duration() const {
+                return data_->durations.total(data_->plays);
+            }
+
+            /* Tracks that start with prefix, for hierarchical keys like
+             * "label/artist/track". O(log m).
+             */
+            template <string_track U = T>
+            std::pair<sorted_iterator, sorted_iterator>
+            sorted_prefix_range(std::basic_string_view<typename U::value_type,
+                                    typename U::traits_type> prefix) const {
+                using view = decltype(prefix);
+                std::basic_string<typename U::value_type,
+                                  typename U::traits_type> bound(prefix);
+                sorted_iterator first = sorted_lower_bound(T(prefix));
+                if (!prefix_successor(bound))
+                    return {first, sorted_end()};
+                return {first, sorted_lower_bound(T(view(bound)))};
+            }
+
+            ///////////////// BINARY SERIALIZATION /////////////////
+
+            /* Writes playlist in the binary format described in
+             * playlist_format.h. Tracks get dictionary positions in sorted
+             * order, so that loading can rebuild the track index by
+             * appending.
+             */
+            void serialize(std::ostream &os,
+                           serialize_options const &opts = {}) const
+            requires serializable_track<T> && serializable_params<P> {
+                using codec = track_codec<T>;
+                index_type const &tracks = data_->tracks;
+                storage_type const &plays = data_->plays;
+
+                // Dictionary position of every track id.
+                std::vector<std::uint32_t> position(tracks.id_bound());
+                std::uint32_t next = 0;
+                std::uint64_t dict_size = 0;
+                for (auto const &[track, entry] : tracks) {
+                    position[entry.id] = next++;
+                    if constexpr (codec::is_inline)
+                        dict_size += sizeof(T);
+                    else
+                        dict_size += codec::size(track);
+                }
+                if constexpr (!codec::is_inline)
+                    dict_size += (tracks.size() + 1) * sizeof(std::uint64_t);
+
+                std::vector<char> packed;
+                if (opts.pack_params) {
+                    packed::column_writer<P> column;
+                    for (slot_t s = data_->head; s != no_slot;
+                         s = plays.link(s).next)
+                        column.push_back(plays.params(s));
+                    packed = column.finish();
+                }
+
+                auto h = format::make_header<T, P>(tracks.size(), size(),
+                                                   dict_size, opts.sequence,
+                                                   packed.size());
+                format::writer w(os);
+                w.put(h);
+
+                w.pad_to(h.dict_offset);
+                if constexpr (codec::is_inline) {
+                    for (auto const &[track, entry] : tracks)
+                        w.put(track);
+                } else {
+                    std::uint64_t offset = 0;
+                    w.put(offset);
+                    for (auto const &[track, entry] : tracks) {
+                        offset += codec::size(track);
+                        w.put(offset);
+                    }
+                    for (auto const &[track, entry] : tracks)
+                        w.write(codec::data(track), codec::size(track));
+                }
+
+                w.pad_to(h.plays_offset);
+                for (slot_t s = data_->head; s != no_slot; s = plays.link(s).next)
+                    w.put(position[plays.link(s).track]);
+
+                w.pad_to(h.params_offset);
+                if (opts.pack_params) {
+                    w.write(packed.data(), packed.size());
+                } else {
+                    for (slot_t s = data_->head; s != no_slot;
+                         s = plays.link(s).next)
+                        w.put(plays.params(s));
+                }
+
+                w.pad_to(h.counts_offset);
+                for (auto const &[track, entry] : tracks)
+                    w.put(static_cast<std::uint64_t>(entry.info.count));
+                w.flush();
+            }
+
+            /* Reads playlist written by serialize. Dictionary arrives sorted,
+             * so every track is appended at the end of the index, and plays
+             * address their track by position - loading takes linear time
+             * and does no lookups. Corrupted input is reported with
+             * std::runtime_error; counts in the header are not trusted,
+             * memory grows with the input actually read. Options stored in
+             * the header are returned through opts, when given.
+             */
+            static playlist deserialize(std::istream &is,
+                                        serialize_options *opts = nullptr)
+            requires serializable_track<T> && serializable_params<P> {
+                using codec = track_codec<T>;
+
+                format::reader r(is);
+                auto h = r.get<format::header>();
+                format::validate<T, P>(h);
+                if (opts) {
+                    opts->sequence = h.sequence;
+                    opts->pack_params = h.flags & format::packed_params;
+                }
+
+                playlist res;
+                playlistData &d = *res.data_;
+                std::vector<std::uint32_t> by_id;
+                // Grows as tracks are read, track_count may be corrupt.
+                by_id.reserve(std::min<std::uint64_t>(
+                    h.track_count, format::reader::chunk / sizeof(by_id[0])));
+
+                auto add_track = [&](T &&track) {
+                    if (!by_id.empty()
+                        && !(d.tracks.key(by_id.back()) < track)) {
+                        throw std::runtime_error(
+                            "deserialize, unsorted dictionary");
+                    }
+                    by_id.push_back(d.tracks.insert_last(std::move(track)));
+                };
+
+                r.skip_to(h.dict_offset);
+                if constexpr (codec::is_inline) {
+                    for (std::uint64_t i = 0; i < h.track_count; ++i) {
+                        add_track(format::from_bytes<T>(
+                            r.get<std::array<unsigned char, sizeof(T)>>()
+                                .data()));
+                    }
+                } else {
+                    auto offsets = r.get_array<std::uint64_t>(
+                        h.track_count + 1);
+                    std::uint64_t table = offsets.size() * sizeof(offsets[0]);
+                    if (offsets[0] != 0 || h.dict_size < table
+                        || offsets.back() != h.dict_size - table) {
+                        throw std::runtime_error(
+                            "deserialize, corrupt dictionary");
+                    }
+                    auto bytes = std::make_shared<std::vector<char>>(
+                        r.get_array<char>(offsets.back()));
+                    // Non-owning tracks (views) point into the dictionary.
+                    if constexpr (!codec::owning)
+                        res.keep_alive(bytes);
+                    for (std::uint64_t i = 0; i < h.track_count; ++i) {
+                        if (offsets[i + 1] < offsets[i]) {
+                            throw std::runtime_error(
+                                "deserialize, corrupt dictionary");
+                        }
+                        add_track(codec::decode(bytes->data() + offsets[i],
+                                                offsets[i + 1] - offsets[i]));
+                    }
+                }
+
+                r.skip_to(h.plays_offset);
+                auto ids = r.get_array<std::uint32_t>(h.play_count);
+
+                r.skip_to(h.params_offset);
+                for (std::uint32_t id : ids) {
+                    if (id >= by_id.size()) {
+                        throw std::runtime_error("deserialize, corrupt plays");
+                    }
+                }
+                if (h.flags & format::packed_params) {
+                    auto column = r.get_array<char>(format::params_bytes(h));
+                    packed::column_reader<P> params(column.data(),
+                                                    column.size(), ids.size());
+                    for (std::size_t i = 0; i < ids.size(); ++i)
+                        d.append(by_id[ids[i]], params[i]);
+                } else {
+                    for (std::uint32_t id : ids) {
+                        d.append(by_id[id], format::from_bytes<P>(
+                            r.get<std::array<unsigned char, sizeof(P)>>()
+                                .data()));
+                    }
+                }
+
+                // Counts are redundant, so they double as a consistency check.
+                r.skip_to(h.counts_offset);
+                for (std::uint32_t id : by_id) {
+                    auto count = r.get<std::uint64_t>();
+                    if (count == 0 || count != d.tracks.info(id).count) {
+                        throw std::runtime_error("deserialize, corrupt counts");
+                    }
+                }
+                return res;
+            }
     };
 
 } // namespace cxx
@@ -0,0 +1,351 @@
+#include "playlist.h"
+#include "playlist_log.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <unistd.h>
+
+// Pomiary wydajności plejlisty: `make bench` albo
+//   ./playlist_bench [--json] [--max-n N]
+// Każdy wiersz to jeden pomiar: benchmark, wariant, liczba odtworzeń n,
+// liczba różnych utworów i czas w nanosekundach na operację (co jest
+// operacją - przy każdym benchmarku). Wynik CSV albo JSON (tablica
+// obiektów o tych samych polach), do porównywania między wersjami.
+
+namespace {
+  using params_t = std::pair<unsigned, unsigned>;
+  using playlist_t = cxx::playlist<unsigned, params_t>;
+  // Z kolejnością po liczbie odtworzeń, dla top_k().
+  using counted_t = cxx::playlist<unsigned, params_t, cxx::count_index>;
+
+  // Te same dane co params_t, ale z własnym konstruktorem kopiującym, więc
+  // kopia plejlisty idzie ścieżką ogólną, element po elemencie.
+  struct generic_params_t {
+    unsigned start = 0, end = 0;
+
+    generic_params_t(unsigned s, unsigned e) : start(s), end(e) {}
+    generic_params_t(generic_params_t const &o) : start(o.start), end(o.end) {}
+  };
+
+  // Identyfikator katalogowy, którego nie widać jako typ całkowity, więc
+  // trafia do indeksu std::map - punkt odniesienia dla indeksu pozycyjnego.
+  struct boxed_id {
+    std::uint32_t id;
+
+    bool operator<(boxed_id const &o) const { return id < o.id; }
+  };
+
+  bool json = false;
+  bool first_row = true;
+
+  void row(char const *benchmark, char const *variant, std::size_t n,
+           std::size_t tracks, double ns) {
+    if (json) {
+      std::printf("%s\n  {\"benchmark\": \"%s\", \"variant\": \"%s\", "
+                  "\"n\": %zu, \"tracks\": %zu, \"ns_per_op\": %.2f}",
+                  first_row ? "[" : ",", benchmark, variant, n, tracks, ns);
+    } else {
+      if (first_row)
+        std::printf("benchmark,variant,n,tracks,ns_per_op\n");
+      std::printf("%s,%s,%zu,%zu,%.2f\n", benchmark, variant, n, tracks, ns);
+    }
+    first_row = false;
+    std::fflush(stdout);
+  }
+
+  // Duże rozmiary mierzymy rzadziej, żeby całość trwała minuty.
+  unsigned rounds_for(std::size_t n) {
+    return n >= 10000000 ? 1 : n >= 1000000 ? 3 : 5;
+  }
+
+  // Czas w nanosekundach jednego wywołania body, najlepszy z kilku prób;
+  // setup przed każdą próbą nie jest liczony.
+  template <typename Setup, typename Body>
+  double measure(unsigned rounds, Setup &&setup, Body &&body) {
+    double best = 1e300;
+    for (unsigned r = 0; r < rounds; ++r) {
+      auto state = setup();
+      auto start = std::chrono::steady_clock::now();
+      body(state);
+      std::chrono::duration<double, std::nano> d =
+        std::chrono::steady_clock::now() - start;
+      best = d.count() < best ? d.count() : best;
+    }
+    return best;
+  }
+
+  template <typename Body>
+  double measure(unsigned rounds, Body &&body) {
+    return measure(rounds, [] { return 0; }, [&](int) { body(); });
+  }
+
+  template <typename PL = playlist_t>
+  PL make(std::size_t n, std::size_t tracks) {
+    using P = std::remove_cvref_t<decltype(std::declval<PL const &>().front()
+                                           .second)>;
+    PL pl;
+    for (std::size_t i = 0; i < n; ++i)
+      pl.push_back(static_cast<unsigned>(i * 2654435761u % tracks),
+                   P(static_cast<unsigned>(i), static_cast<unsigned>(i + 180)));
+    return pl;
+  }
+
+  // Podstawowe operacje, dla n odtworzeń z tracks różnych utworów.
+  void core(std::size_t n, std::size_t tracks) {
+    unsigned rounds = rounds_for(n);
+    double per = static_cast<double>(n);
+    playlist_t base = make(n, tracks);
+    double distinct = 0;
+    for (auto it = base.sorted_begin(); it != base.sorted_end(); ++it)
+      ++distinct;
+
+    // push_back: na odtworzenie.
+    row("push_back", "default", n, tracks, measure(rounds, [&] {
+      (void) make(n, tracks);
+    }) / per);
+
+    row("push_back", "count_index", n, tracks, measure(rounds, [&] {
+      (void) make<counted_t>(n, tracks);
+    }) / per);
+
+    // pop_front aż do opróżnienia: na odtworzenie.
+    row("pop_front", "default", n, tracks, measure(rounds,
+      [&] { return make(n, tracks); },
+      [](playlist_t &pl) {
+        while (pl.size() > 0)
+          pl.pop_front();
+      }) / per);
+    row("pop_front", "count_index", n, tracks, measure(rounds,
+      [&] { return make<counted_t>(n, tracks); },
+      [](counted_t &pl) {
+        while (pl.size() > 0)
+          pl.pop_front();
+      }) / per);
+
+    // remove utworów z początku kolejki aż do opróżnienia: na wywołanie.
+    row("remove", "default", n, tracks, measure(rounds,
+      [&] { return make(n, tracks); },
+      [](playlist_t &pl) {
+        while (pl.size() > 0)
+          pl.remove(pl.front().first);
+      }) / distinct);
+
+    // Kopia i push_back na niej (odłączenie COW): na parę operacji.
+    row("copy_mutate", "push_back", n, tracks, measure(rounds, [&] {
+      playlist_t copy = base;
+      copy.push_back(0, {0, 0});
+    }));
+
+    // Kopia i niestałe params() odtworzenia ze środka: na parę operacji.
+    auto middle = base.play_begin();
+    for (std::size_t i = 0; i < n / 2; ++i)
+      ++middle;
+    row("copy_mutate", "params", n, tracks, measure(rounds, [&] {
+      playlist_t copy = base;
+      copy.params(middle).first = 1;
+    }));
+
+    // params() na niewspółdzielonej plejliście, po kolei: na odtworzenie.
+    row("params", "unshared", n, tracks, measure(rounds, [&] {
+      for (auto it = base.play_begin(); it != base.play_end(); ++it)
+        ++base.params(it).first;
+    }) / per);
+
+    // Przejście po utworach w kolejności: na utwór.
+    std::size_t sink = 0;
+    row("sorted_iteration", "default", n, tracks, measure(rounds, [&] {
+      for (auto it = base.sorted_begin(); it != base.sorted_end(); ++it)
+        ++sink;
+    }) / distinct);
+    row("pay", "default", n, tracks, measure(rounds, [&] {
+      for (auto it = base.sorted_begin(); it != base.sorted_end(); ++it)
+        sink += base.pay(it).second;
+    }) / distinct);
+
+    // 100 najczęściej odtwarzanych utworów: na zapytanie.
+    counted_t counted = make<counted_t>(n, tracks);
+    row("top_k", "100", n, tracks, measure(rounds, [&] {
+      sink += counted.top_k(100).size();
+    }));
+
+    // Tasowanie w miejscu, zwykłe i z odstępem 8 między odtworzeniami
+    // utworu: na odtworzenie.
+    std::mt19937 rng(1);
+    row("shuffle", "plain", n, tracks, measure(rounds, [&] {
+      base.shuffle(rng);
+    }) / per);
+    row("shuffle", "gap", n, tracks, measure(rounds, [&] {
+      base.shuffle(rng, 8);
+    }) / per);
+    if (sink == 0)
+      std::abort();
+  }
+
+  // Odłączenie kopii przez niestałe params(), dla różnych parametrów, i to,
+  // co robiło odłączenie przed przejściem na slab: budowa od nowa przez
+  // push_back każdego odtworzenia. Na odłączenie.
+  void clone(std::size_t n, std::size_t tracks) {
+    unsigned rounds = rounds_for(n);
+    auto trivial = make(n, tracks);
+    auto generic = make<cxx::playlist<unsigned, generic_params_t>>(n, tracks);
+    auto detach = [&](auto const &pl) {
+      return measure(rounds, [&] {
+        auto copy = pl;
+        (void) copy.params(copy.play_begin());
+      });
+    };
+    row("clone", "trivial", n, tracks, detach(trivial));
+    row("clone", "generic", n, tracks, detach(generic));
+    row("clone", "rebuild", n, tracks, measure(rounds, [&] {
+      playlist_t copy;
+      for (auto it = trivial.play_begin(); it != trivial.play_end(); ++it)
+        copy.push_back(trivial.play(it).first, trivial.play(it).second);
+    }));
+  }
+
+  // load_play_log dziennika n odtworzeń, świeżo zapisanego, więc z pamięci
+  // podręcznej systemu: na bajt pliku, przepustowość w GB/s to
+  // 1 / ns_per_op.
+  void loader(std::size_t n, std::size_t tracks) {
+    std::string path = "/tmp/playlist_bench_" + std::to_string(::getpid())
+                       + ".log";
+    std::string text;
+    for (std::size_t i = 0; i < n; ++i) {
+      text += "utwor " + std::to_string(i * 2654435761u % tracks) + " "
+              + std::to_string(i) + ":" + std::to_string(i + 180) + "\n";
+    }
+    std::FILE *f = std::fopen(path.c_str(), "wb");
+    if (!f || std::fwrite(text.data(), 1, text.size(), f) != text.size()
+        || std::fclose(f) != 0)
+      std::abort();
+
+    std::size_t sink = 0;
+    row("load_play_log", "per_byte", n, tracks, measure(rounds_for(n), [&] {
+      sink += cxx::load_play_log(path).size();
+    }) / static_cast<double>(text.size()));
+    std::remove(path.c_str());
+    if (sink == 0)
+      std::abort();
+  }
+
+  // push_back n odtworzeń, potem remove utworów z początku kolejki;
+  // na odtworzenie. Indeks pozycyjny kontra std::map.
+  template <typename T, typename Key>
+  double push_remove(std::size_t n, Key &&key) {
+    return measure(rounds_for(n), [&] {
+      cxx::playlist<T, params_t> pl;
+      for (std::size_t i = 0; i < n; ++i)
+        pl.push_back(T{key(i)}, {0, 0});
+      while (pl.size() > 0)
+        pl.remove(T{pl.front().first});
+    }) / static_cast<double>(n);
+  }
+
+  void index(std::size_t n) {
+    auto dense = [n](std::size_t i) {
+      return static_cast<std::uint32_t>(i * 7919 % (n / 4 + 1));
+    };
+    auto sparse = [](std::size_t i) {
+      return static_cast<std::uint32_t>(i * 2654435761u);
+    };
+    row("push_remove", "dense_integral", n, n / 4 + 1,
+        push_remove<std::uint32_t>(n, dense));
+    row("push_remove", "dense_map", n, n / 4 + 1,
+        push_remove<boxed_id>(n, dense));
+    row("push_remove", "sparse_integral", n, n,
+        push_remove<std::uint32_t>(n, sparse));
+    row("push_remove", "sparse_map", n, n, push_remove<boxed_id>(n, sparse));
+  }
+
+  // Wzorzec test_21_transitivity_of_cow: łańcuch kopii A = B = C,
+  // odczyty, po czym modyfikacja środkowej; na rundę.
+  template <typename Sharing>
+  double cow_chain(std::size_t plays, std::size_t rounds) {
+    using pl_t = cxx::playlist<unsigned, params_t, Sharing>;
+    pl_t p1;
+    for (std::size_t i = 0; i < plays; ++i)
+      p1.push_back(static_cast<unsigned>(i), {0, 0});
+    return measure(5, [&] {
+      for (std::size_t r = 0; r < rounds; ++r) {
+        pl_t p2 = p1;
+        pl_t p3 = p2;
+        if (p3.size() != p1.size())
+          std::abort();
+        p2.push_back(static_cast<unsigned>(r), {1, 1});
+      }
+    }) / static_cast<double>(rounds);
+  }
+
+  // Wzorzec test_22: wiele kopii jednej plejlisty i ich zniszczenie;
+  // na kopię.
+  template <typename Sharing>
+  double copy_many(std::size_t copies) {
+    using pl_t = cxx::playlist<unsigned, params_t, Sharing>;
+    pl_t base;
+    for (unsigned i = 0; i < 10; ++i)
+      base.push_back(i, {i, i});
+    std::vector<pl_t> vec;
+    vec.reserve(copies);
+    return measure(5, [&] {
+      for (std::size_t i = 0; i < copies; ++i)
+        vec.push_back(base);
+      for (std::size_t i = 0; i < copies; ++i)
+        vec[i] = base;
+      vec.clear();
+    }) / static_cast<double>(2 * copies);
+  }
+
+  void sharing() {
+    for (std::size_t plays : {1u, 16u}) {
+      row("cow_chain", "atomic", plays, plays,
+          cow_chain<cxx::atomic_sharing>(plays, 100000));
+      row("cow_chain", "local", plays, plays,
+          cow_chain<cxx::local_sharing>(plays, 100000));
+    }
+    row("copy_many", "atomic", 10, 10, copy_many<cxx::atomic_sharing>(100000));
+    row("copy_many", "local", 10, 10, copy_many<cxx::local_sharing>(100000));
+  }
+}
+
+int main(int argc, char **argv) {
+  std::size_t max_n = 10000000;
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "--json") == 0) {
+      json = true;
+    } else if (std::strcmp(argv[i], "--max-n") == 0 && i + 1 < argc) {
+      max_n = std::strtoull(argv[++i], nullptr, 10);
+    } else {
+      std::fprintf(stderr, "usage: %s [--json] [--max-n N]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  for (std::size_t n = 1000; n <= max_n; n *= 10) {
+    for (std::size_t tracks : {std::size_t{16}, std::size_t{4096}, n}) {
+      if (tracks <= n)
+        core(n, tracks);
+    }
+    loader(n, std::min<std::size_t>(n, 4096));
+  }
+  for (std::size_t n = 1000; n <= std::min<std::size_t>(max_n, 1000000);
+       n *= 100) {
+    for (std::size_t tracks : {std::size_t{16}, std::size_t{10000}})
+      clone(n, tracks);
+    index(n);
+  }
+  sharing();
+
+  if (json)
+    std::printf("\n]\n");
+}
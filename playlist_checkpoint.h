@@ -0,0 +1,406 @@
+#ifndef PLAYLIST_CHECKPOINT_H
+#define PLAYLIST_CHECKPOINT_H
+
+#include <array>
+#include <cerrno>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "playlist.h"
+#include "posix_file.h"
+
+namespace cxx {
+
+    struct checkpoint_options {
+        // Expected chunk size, chunks are between 1/4 and 4 times that.
+        // Has to be a power of two.
+        std::size_t average_chunk = 1 << 13;
+        // Pack file is rewritten once it is this many times larger than
+        // the newest checkpoint.
+        std::size_t compact_ratio = 3;
+    };
+
+    namespace checkpoint_format {
+        inline constexpr char magic[8] = {'C', 'X', 'X', 'C', 'K', 'P', 'T', 0};
+        inline constexpr std::uint32_t version = 1;
+
+        /* Checkpoint is a serialized playlist cut into content defined
+         * chunks. Chunks live in an append-only pack file "<path>.pack.<N>",
+         * the manifest "<path>" (replaced atomically) lists chunks of the
+         * newest image in order.
+         */
+        struct header {
+            char magic[8];
+            std::uint32_t version;
+            std::uint32_t byte_order;
+            std::uint64_t generation;       // N of the pack file
+            std::uint64_t image_size;
+            std::uint64_t chunk_count;
+        };
+
+        struct entry {
+            std::uint64_t offset;           // in the pack file
+            std::uint64_t size;
+            std::uint64_t hash[2];
+        };
+
+        /* Whether manifest (at least a header long) holds exactly the
+         * chunk_count entries of h. The count is checked against the size
+         * first, the product of a corrupt count could wrap around.
+         */
+        inline bool fits(std::string const &manifest,
+                         header const &h) noexcept {
+            std::uint64_t room = manifest.size() - sizeof(header);
+            return h.chunk_count <= room / sizeof(entry)
+                   && room == h.chunk_count * sizeof(entry);
+        }
+
+        inline std::string pack_path(std::string const &path,
+                                     std::uint64_t generation) {
+            return path + ".pack." + std::to_string(generation);
+        }
+
+        // Random table of the gear rolling hash (splitmix64 sequence).
+        inline constexpr auto gear = [] {
+            std::array<std::uint64_t, 256> table{};
+            std::uint64_t x = 0x9E3779B97F4A7C15u;
+            for (auto &g : table) {
+                x += 0x9E3779B97F4A7C15u;
+                std::uint64_t z = x;
+                z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9u;
+                z = (z ^ (z >> 27)) * 0x94D049BB133111EBu;
+                g = z ^ (z >> 31);
+            }
+            return table;
+        }();
+
+        /* Length of the chunk starting at data. Cut points depend only on
+         * nearby bytes, so an insertion or removal (e.g. pop_front shifting
+         * every column) changes just the chunks around it.
+         */
+        inline std::size_t next_chunk(char const *data, std::size_t n,
+                                      std::size_t average) noexcept {
+            std::size_t min = average / 4, max = average * 4;
+            if (n <= min)
+                return n;
+            std::uint64_t mask = average - 1, h = 0;
+            std::size_t end = n < max ? n : max;
+            for (std::size_t i = 0; i < end; ++i) {
+                h = (h << 1) + gear[static_cast<unsigned char>(data[i])];
+                if (i >= min && (h & mask) == 0)
+                    return i + 1;
+            }
+            return end;
+        }
+
+        // Two independent 64-bit hashes identify a chunk.
+        inline std::array<std::uint64_t, 2> chunk_hash(std::string_view s) {
+            std::uint64_t fnv = 0xCBF29CE484222325u;
+            for (char c : s)
+                fnv = (fnv ^ static_cast<unsigned char>(c)) * 0x100000001B3u;
+            return {std::hash<std::string_view>{}(s), fnv};
+        }
+
+        struct hash_key {
+            std::size_t operator()(std::array<std::uint64_t, 2> const &h)
+            const noexcept {
+                return h[0];
+            }
+        };
+    } // namespace checkpoint_format
+
+    /* Writes checkpoints of a live playlist on a background thread.
+     * submit() only copies the playlist, which is O(1) while it can be
+     * shared; serialization happens on the worker while the caller keeps
+     * mutating its own copy (which detaches through COW). Of every new
+     * image only chunks not present in the previous one are written.
+     */
+    template <typename T, typename P>
+        requires serializable_track<T> && serializable_params<P>
+    class playlist_checkpointer {
+        public:
+            using playlist_type = playlist<T, P>;
+
+            explicit playlist_checkpointer(std::string path,
+                                           checkpoint_options opts = {})
+                : path_(std::move(path)), opts_(opts) {
+                if (opts_.average_chunk < 64
+                    || (opts_.average_chunk & (opts_.average_chunk - 1))) {
+                    throw std::invalid_argument(
+                        "playlist_checkpointer, bad chunk size");
+                }
+                open_existing();
+                worker_ = std::thread([this] { run(); });
+            }
+
+            playlist_checkpointer(playlist_checkpointer const &) = delete;
+            playlist_checkpointer & operator=(playlist_checkpointer const &)
+                = delete;
+
+            // Writes what was submitted and stops the worker.
+            ~playlist_checkpointer() {
+                {
+                    std::lock_guard lock(mutex_);
+                    stop_ = true;
+                }
+                wake_.notify_one();
+                worker_.join();
+            }
+
+            /* Schedules a checkpoint of pl. A snapshot that the worker did
+             * not pick up yet is replaced, only the newest state matters.
+             * Errors of earlier checkpoints are rethrown here.
+             */
+            void submit(playlist_type const &pl, std::uint64_t sequence = 0) {
+                playlist_type snapshot(pl);
+                std::unique_lock lock(mutex_);
+                rethrow();
+                pending_.emplace(std::move(snapshot), sequence);
+                lock.unlock();
+                wake_.notify_one();
+            }
+
+            // Blocks until everything submitted is durable.
+            void wait() {
+                std::unique_lock lock(mutex_);
+                done_.wait(lock, [this] { return !pending_ && !busy_; });
+                rethrow();
+            }
+
+            // Bytes of the newest image and bytes written to store it.
+            std::pair<std::uint64_t, std::uint64_t> last_written() const {
+                std::lock_guard lock(mutex_);
+                return {image_size_, written_};
+            }
+
+            static playlist_type load(std::string const &path,
+                                      serialize_options *opts = nullptr) {
+                using namespace checkpoint_format;
+                std::string manifest = read_file(path);
+                if (manifest.size() < sizeof(header)) {
+                    throw std::runtime_error("checkpoint, corrupt manifest");
+                }
+                auto h = format::from_bytes<header>(manifest.data());
+                if (std::memcmp(h.magic, magic, sizeof(magic)) != 0
+                    || h.version != version || !fits(manifest, h)) {
+                    throw std::runtime_error("checkpoint, corrupt manifest");
+                }
+
+                unique_fd pack(pack_path(path, h.generation), O_RDONLY);
+                struct stat st;
+                if (::fstat(pack.get(), &st) != 0)
+                    throw_errno("fstat " + pack_path(path, h.generation));
+                std::uint64_t pack_size = st.st_size;
+                // Grows chunk by chunk, image_size may be corrupt.
+                std::string image;
+                for (std::uint64_t i = 0; i < h.chunk_count; ++i) {
+                    auto e = format::from_bytes<entry>(manifest.data() +
+                        sizeof(header) + i * sizeof(entry));
+                    if (e.offset > pack_size || e.size > pack_size - e.offset)
+                        throw std::runtime_error("checkpoint, truncated pack");
+                    std::size_t at = image.size();
+                    image.resize(at + e.size);
+                    if (::pread(pack.get(), image.data() + at, e.size,
+                                e.offset) != static_cast<ssize_t>(e.size)) {
+                        throw std::runtime_error("checkpoint, truncated pack");
+                    }
+                }
+                std::istringstream in(std::move(image));
+                return playlist_type::deserialize(in, opts);
+            }
+
+        private:
+            using key = std::array<std::uint64_t, 2>;
+            using entry = checkpoint_format::entry;
+
+            std::string path_;
+            checkpoint_options opts_;
+
+            // Shared with the worker, guarded by mutex_.
+            mutable std::mutex mutex_;
+            std::condition_variable wake_, done_;
+            std::optional<std::pair<playlist_type, std::uint64_t>> pending_;
+            bool busy_ = false, stop_ = false;
+            std::exception_ptr error_;
+            std::uint64_t image_size_ = 0, written_ = 0;
+
+            // Worker's state.
+            std::uint64_t generation_ = 0;
+            std::uint64_t pack_size_ = 0;
+            std::unordered_map<key, entry, checkpoint_format::hash_key> chunks_;
+            std::thread worker_;
+
+            void rethrow() {
+                if (error_)
+                    std::rethrow_exception(std::exchange(error_, nullptr));
+            }
+
+            static std::string read_file(std::string const &path) {
+                unique_fd fd(path, O_RDONLY);
+                std::string res;
+                char buf[1 << 12];
+                ssize_t n;
+                while ((n = ::read(fd.get(), buf, sizeof(buf))) != 0) {
+                    if (n < 0) {
+                        if (errno == EINTR)
+                            continue;
+                        throw_errno("read " + path);
+                    }
+                    res.append(buf, n);
+                }
+                return res;
+            }
+
+            // Picks up chunks of a checkpoint left by an earlier process.
+            void open_existing() {
+                using namespace checkpoint_format;
+                if (::access(path_.c_str(), F_OK) != 0)
+                    return;
+                std::string manifest = read_file(path_);
+                if (manifest.size() < sizeof(header))
+                    return;
+                auto h = format::from_bytes<header>(manifest.data());
+                if (std::memcmp(h.magic, magic, sizeof(magic)) != 0
+                    || !fits(manifest, h))
+                    return;
+
+                struct stat st;
+                if (::stat(pack_path(path_, h.generation).c_str(), &st) != 0)
+                    return;
+                generation_ = h.generation;
+                pack_size_ = st.st_size;
+                for (std::uint64_t i = 0; i < h.chunk_count; ++i) {
+                    auto e = format::from_bytes<entry>(manifest.data() +
+                        sizeof(header) + i * sizeof(entry));
+                    // Chunks outside the pack are written again.
+                    if (e.offset <= pack_size_
+                        && e.size <= pack_size_ - e.offset)
+                        chunks_.emplace(key{e.hash[0], e.hash[1]}, e);
+                }
+            }
+
+            void run() {
+                std::unique_lock lock(mutex_);
+                while (true) {
+                    wake_.wait(lock, [this] { return pending_ || stop_; });
+                    if (!pending_)
+                        break;
+                    auto [snapshot, sequence] = std::move(*pending_);
+                    pending_.reset();
+                    busy_ = true;
+                    lock.unlock();
+
+                    std::uint64_t image = 0, written = 0;
+                    std::exception_ptr error;
+                    try {
+                        std::tie(image, written) = write(snapshot, sequence);
+                    } catch (...) {
+                        error = std::current_exception();
+                    }
+                    // Drop the snapshot (and its share of the data) outside
+                    // of the lock.
+                    snapshot.clear();
+
+                    lock.lock();
+                    busy_ = false;
+                    if (error) {
+                        error_ = error;
+                    } else {
+                        image_size_ = image;
+                        written_ = written;
+                    }
+                    done_.notify_all();
+                }
+            }
+
+            std::pair<std::uint64_t, std::uint64_t> write(
+                    playlist_type const &snapshot, std::uint64_t sequence) {
+                using namespace checkpoint_format;
+                std::ostringstream os;
+                snapshot.serialize(os, {.sequence = sequence});
+                std::string_view image = os.view();
+
+                // Too much garbage in the pack - start a new one.
+                bool compact = pack_size_ > opts_.compact_ratio * image.size();
+                std::uint64_t generation = generation_ + (compact ? 1 : 0);
+                std::uint64_t pack_size = compact ? 0 : pack_size_;
+                unique_fd pack(pack_path(path_, generation),
+                               O_WRONLY | O_CREAT);
+
+                std::vector<entry> entries;
+                std::unordered_map<key, entry, hash_key> chunks;
+                std::uint64_t written = 0;
+                for (std::size_t at = 0; at < image.size();) {
+                    std::size_t n = next_chunk(image.data() + at,
+                        image.size() - at, opts_.average_chunk);
+                    std::string_view chunk = image.substr(at, n);
+                    key k = chunk_hash(chunk);
+                    at += n;
+
+                    // Chunk repeated in this image, or stored by the
+                    // previous one (unless its pack is being replaced).
+                    entry const *known = nullptr;
+                    if (auto it = chunks.find(k); it != chunks.end())
+                        known = &it->second;
+                    else if (auto it = chunks_.find(k);
+                             !compact && it != chunks_.end())
+                        known = &it->second;
+
+                    if (known) {
+                        entries.push_back(*known);
+                    } else {
+                        pwrite_all(pack.get(), chunk.data(), n, pack_size);
+                        entries.push_back({pack_size, n, {k[0], k[1]}});
+                        pack_size += n;
+                        written += n;
+                    }
+                    chunks.emplace(k, entries.back());
+                }
+                sync_fd(pack.get());
+
+                header h{};
+                std::memcpy(h.magic, magic, sizeof(magic));
+                h.version = version;
+                h.byte_order = format::byte_order;
+                h.generation = generation;
+                h.image_size = image.size();
+                h.chunk_count = entries.size();
+                std::string tmp = path_ + ".tmp";
+                {
+                    unique_fd out(tmp, O_WRONLY | O_CREAT | O_TRUNC);
+                    write_all(out.get(), &h, sizeof(h));
+                    write_all(out.get(), entries.data(),
+                              entries.size() * sizeof(entry));
+                    sync_fd(out.get());
+                }
+                replace_file(tmp, path_);
+
+                if (compact)
+                    ::unlink(pack_path(path_, generation_).c_str());
+                generation_ = generation;
+                pack_size_ = pack_size;
+                chunks_ = std::move(chunks);
+                return {image.size(), written};
+            }
+    };
+
+} // namespace cxx
+
+#endif //PLAYLIST_CHECKPOINT_H
@@ -0,0 +1,212 @@
+#ifndef PLAYLIST_COUNTS_H
+#define PLAYLIST_COUNTS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "playlist_storage.h"
+
+namespace cxx {
+
+    // Counts not ordered (no_count_index), top_k() is not there.
+    struct no_counts {
+        void reserve(std::uint32_t) {}
+        void increment(std::uint32_t, std::size_t) noexcept {}
+        void decrement(std::uint32_t, std::size_t) noexcept {}
+        void erase(std::uint32_t) noexcept {}
+        std::size_t memory_bytes() const noexcept { return 0; }
+    };
+
+    /* Tracks (by id) ordered by their number of plays: a list of buckets,
+     * one per count present, in increasing order of counts, each holding
+     * a list of its tracks. A play added or removed moves its track to
+     * the neighbouring bucket, O(1), so the most played tracks, or those
+     * played at least c times, are listed in time proportional to the
+     * answer.
+     *
+     * Like the rest of the playlist data it holds numbers instead of
+     * pointers, so the default copy is a correct copy. Only reserve may
+     * allocate: there is never more buckets than tracks, so once reserve
+     * made room for every id, nothing else can fail.
+     */
+    template <typename Alloc = std::allocator<std::uint32_t>>
+    class count_order {
+        private:
+            template <typename U>
+            using vec = std::vector<U, rebind_alloc_t<Alloc, U>>;
+
+            struct bucket {
+                std::size_t count;
+                std::uint32_t prev;     // bucket of a smaller count
+                std::uint32_t next;     // bucket of a greater count
+                std::uint32_t first;    // its first track
+            };
+
+            // Bucket of a track and its neighbours in there.
+            struct place {
+                std::uint32_t bucket = no_slot;
+                std::uint32_t prev = no_slot;
+                std::uint32_t next = no_slot;
+            };
+
+            vec<place> tracks_{};
+            vec<bucket> buckets_{};
+            vec<std::uint32_t> free_{};
+            std::uint32_t lowest_ = no_slot;
+            std::uint32_t highest_ = no_slot;
+
+        public:
+            count_order() = default;
+
+            // Keeps the room made by reserve.
+            count_order(count_order const &other)
+                : tracks_(other.tracks_), lowest_(other.lowest_),
+                  highest_(other.highest_) {
+                buckets_.reserve(other.buckets_.capacity());
+                buckets_.assign(other.buckets_.begin(), other.buckets_.end());
+                free_.reserve(other.free_.capacity());
+                free_.assign(other.free_.begin(), other.free_.end());
+            }
+
+            count_order(count_order &&) noexcept = default;
+            count_order & operator=(count_order const &) = delete;
+            ~count_order() = default;
+
+            // Room for track id, before its first play. Strong guarantee.
+            void reserve(std::uint32_t id) {
+                if (id < tracks_.size())
+                    return;
+                reserve_at_least(buckets_, id + std::size_t{1});
+                reserve_at_least(free_, buckets_.capacity());
+                reserve_at_least(tracks_, id + std::size_t{1});
+                tracks_.resize(id + std::size_t{1});
+            }
+
+            // Track id got a play, count is its new count.
+            void increment(std::uint32_t id, std::size_t count) noexcept {
+                place const &p = tracks_[id];
+                std::uint32_t b = p.bucket;
+                std::uint32_t after = b == no_slot ? lowest_
+                                                   : buckets_[b].next;
+                if (after != no_slot && buckets_[after].count == count) {
+                    unlink(id);
+                    link(id, after);
+                } else if (b != no_slot && alone(id)) {
+                    buckets_[b].count = count;
+                } else {
+                    std::uint32_t nb = new_bucket(count, b, after);
+                    if (b != no_slot)
+                        unlink(id);
+                    link(id, nb);
+                }
+            }
+
+            // Track id lost a play, count is its new count; at 0 the
+            // track leaves.
+            void decrement(std::uint32_t id, std::size_t count) noexcept {
+                std::uint32_t b = tracks_[id].bucket;
+                if (count == 0) {
+                    unlink(id);
+                    return;
+                }
+                std::uint32_t before = buckets_[b].prev;
+                if (before != no_slot && buckets_[before].count == count) {
+                    unlink(id);
+                    link(id, before);
+                } else if (alone(id)) {
+                    buckets_[b].count = count;
+                } else {
+                    std::uint32_t nb = new_bucket(count, before, b);
+                    unlink(id);
+                    link(id, nb);
+                }
+            }
+
+            // Track id leaves with all its plays.
+            void erase(std::uint32_t id) noexcept {
+                unlink(id);
+            }
+
+            /* Calls fn(id, count) for tracks from the most played down,
+             * while it returns true.
+             */
+            template <typename F>
+            void descending(F &&fn) const {
+                for (std::uint32_t b = highest_; b != no_slot;
+                     b = buckets_[b].prev) {
+                    for (std::uint32_t t = buckets_[b].first; t != no_slot;
+                         t = tracks_[t].next) {
+                        if (!fn(t, buckets_[b].count))
+                            return;
+                    }
+                }
+            }
+
+            std::size_t memory_bytes() const noexcept {
+                return tracks_.capacity() * sizeof(place)
+                       + buckets_.capacity() * sizeof(bucket)
+                       + free_.capacity() * sizeof(std::uint32_t);
+            }
+
+        private:
+            bool alone(std::uint32_t id) const noexcept {
+                place const &p = tracks_[id];
+                return p.prev == no_slot && p.next == no_slot;
+            }
+
+            // Empty bucket between prev and next. Room made by reserve.
+            std::uint32_t new_bucket(std::size_t count, std::uint32_t prev,
+                                     std::uint32_t next) noexcept {
+                std::uint32_t b;
+                if (free_.empty()) {
+                    b = static_cast<std::uint32_t>(buckets_.size());
+                    buckets_.push_back({});
+                } else {
+                    b = free_.back();
+                    free_.pop_back();
+                }
+                buckets_[b] = {count, prev, next, no_slot};
+                (prev != no_slot ? buckets_[prev].next : lowest_) = b;
+                (next != no_slot ? buckets_[next].prev : highest_) = b;
+                return b;
+            }
+
+            void link(std::uint32_t id, std::uint32_t b) noexcept {
+                place &p = tracks_[id];
+                p = {b, no_slot, buckets_[b].first};
+                if (p.next != no_slot)
+                    tracks_[p.next].prev = id;
+                buckets_[b].first = id;
+            }
+
+            // Takes the track out of its bucket, freeing it when empty.
+            void unlink(std::uint32_t id) noexcept {
+                place &p = tracks_[id];
+                std::uint32_t b = p.bucket;
+                if (b == no_slot)
+                    return;
+                if (p.prev != no_slot)
+                    tracks_[p.prev].next = p.next;
+                else
+                    buckets_[b].first = p.next;
+                if (p.next != no_slot)
+                    tracks_[p.next].prev = p.prev;
+                p = {};
+
+                bucket const &bk = buckets_[b];
+                if (bk.first != no_slot)
+                    return;
+                (bk.prev != no_slot ? buckets_[bk.prev].next : lowest_)
+                    = bk.next;
+                (bk.next != no_slot ? buckets_[bk.next].prev : highest_)
+                    = bk.prev;
+                // Room reserved by reserve.
+                free_.push_back(b);
+            }
+    };
+
+} // namespace cxx
+
+#endif //PLAYLIST_COUNTS_H
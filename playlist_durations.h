@@ -0,0 +1,332 @@
+#ifndef PLAYLIST_DURATIONS_H
+#define PLAYLIST_DURATIONS_H
+
+#include <atomic>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <vector>
+
+#include "playlist_storage.h"
+
+namespace cxx {
+
+    // Default: plays have no durations, every hook does nothing.
+    struct no_durations {
+        void reserve(std::size_t) {}
+        void insert_after(slot_t, slot_t, auto const &) noexcept {}
+        void erase(slot_t) noexcept {}
+        void touch(slot_t) {}
+        void settle(auto const &) noexcept {}
+        void reserve_touched(no_durations const &) {}
+        std::size_t memory_bytes() const noexcept { return 0; }
+    };
+
+    /* Durations of plays, summed over the play queue: a treap in queue
+     * order (random priorities keep it O(log n) deep, expected) whose
+     * nodes are the slots of plays and keep the total duration of their
+     * subtree. Duration of a play is F()(params), any arithmetic type.
+     *
+     * Non-const params() may change a duration behind our back, so the
+     * playlist reports every slot it hands params of (touch); durations
+     * of such slots are read again before every query, as long as the
+     * references may be written through, until the playlist settles
+     * them. Queries are const and copies of the data may be read from
+     * different threads, hence the mutex around that, as in hash_index.
+     *
+     * Unlike chunks of plays, the tree is not shared by copies: a detach
+     * copies it, O(n).
+     */
+    template <typename F, typename P, typename Alloc = std::allocator<P>>
+        requires std::is_arithmetic_v<std::invoke_result_t<F, P const &>>
+    class duration_tree {
+        public:
+            using duration_type = std::invoke_result_t<F, P const &>;
+
+        private:
+            template <typename U>
+            using vec = std::vector<U, rebind_alloc_t<Alloc, U>>;
+
+            struct node {
+                slot_t left;
+                slot_t right;
+                slot_t parent;
+                std::uint32_t priority;
+                duration_type own;
+                duration_type sum;      // of the subtree
+                bool touched;
+            };
+
+            mutable vec<node> nodes_{};
+            mutable vec<slot_t> touched_{};
+            slot_t root_ = no_slot;
+            std::uint32_t seed_ = 2463534242u;
+
+            mutable std::mutex mutex_{};
+            mutable std::atomic<bool> stale_{false};
+
+        public:
+            duration_tree() = default;
+
+            // Locks other, whose const queries may be refreshing it on
+            // another thread.
+            duration_tree(duration_tree const &other)
+                : root_(other.root_), seed_(other.seed_) {
+                std::lock_guard lock(other.mutex_);
+                stale_.store(other.stale_.load(std::memory_order_relaxed),
+                             std::memory_order_relaxed);
+                nodes_.reserve(other.nodes_.capacity());
+                nodes_.assign(other.nodes_.begin(), other.nodes_.end());
+                touched_ = other.touched_;
+            }
+
+            duration_tree & operator=(duration_tree const &) = delete;
+            ~duration_tree() = default;
+
+            // Room for slots below bound. Strong guarantee.
+            void reserve(std::size_t bound) {
+                reserve_at_least(nodes_, bound);
+                if (nodes_.size() < bound)
+                    nodes_.resize(bound);
+            }
+
+            /* Play s, with params p, enters the queue right after prev
+             * (at the front for no_slot). Room made by reserve.
+             */
+            void insert_after(slot_t prev, slot_t s, P const &p) noexcept {
+                duration_type d = F()(p);
+                nodes_[s] = {no_slot, no_slot, no_slot, next_priority(),
+                             d, d, false};
+                if (root_ == no_slot) {
+                    root_ = s;
+                    return;
+                }
+                slot_t at;
+                bool left;
+                if (prev == no_slot) {
+                    at = leftmost(root_);
+                    left = true;
+                } else if (nodes_[prev].right == no_slot) {
+                    at = prev;
+                    left = false;
+                } else {
+                    at = leftmost(nodes_[prev].right);
+                    left = true;
+                }
+                (left ? nodes_[at].left : nodes_[at].right) = s;
+                nodes_[s].parent = at;
+                for (slot_t n = at; n != no_slot; n = nodes_[n].parent)
+                    nodes_[n].sum += d;
+                while (nodes_[s].parent != no_slot
+                       && nodes_[nodes_[s].parent].priority
+                          < nodes_[s].priority)
+                    rotate_up(s);
+            }
+
+            // Play s leaves the queue; it sinks to a leaf and is cut off.
+            void erase(slot_t s) noexcept {
+                for (;;) {
+                    node const &nd = nodes_[s];
+                    if (nd.left == no_slot && nd.right == no_slot)
+                        break;
+                    bool left = nd.right == no_slot
+                        || (nd.left != no_slot && nodes_[nd.left].priority
+                                                  > nodes_[nd.right].priority);
+                    rotate_up(left ? nd.left : nd.right);
+                }
+                slot_t parent = nodes_[s].parent;
+                child_link(parent, s) = no_slot;
+                nodes_[s].touched = false;
+                for (slot_t n = parent; n != no_slot; n = nodes_[n].parent)
+                    pull(n);
+            }
+
+            // Params of s were handed out, its duration may change.
+            // Strong guarantee.
+            void touch(slot_t s) {
+                if (nodes_[s].touched)
+                    return;
+                touched_.push_back(s);
+                nodes_[s].touched = true;
+                stale_.store(true, std::memory_order_release);
+            }
+
+            /* References to params handed out are dead: durations of
+             * touched plays are read one last time and no longer after.
+             * The data is not shared then, so no lock.
+             */
+            template <typename Plays>
+            void settle(Plays const &plays) noexcept {
+                if (!stale_.load(std::memory_order_relaxed))
+                    return;
+                reread(plays);
+                for (slot_t s : touched_)
+                    nodes_[s].touched = false;
+                touched_.clear();
+                stale_.store(false, std::memory_order_release);
+            }
+
+            // Room to take over the touched plays of other. Strong
+            // guarantee.
+            void reserve_touched(duration_tree const &other) {
+                reserve_at_least(touched_,
+                                 touched_.size() + other.touched_.size());
+            }
+
+            /* Plays of other moved here with slots shifted by off (splice),
+             * their references stay valid, so those touched stay touched.
+             * Room made by reserve_touched.
+             */
+            void take_touched(duration_tree const &other, slot_t off)
+            noexcept {
+                for (slot_t s : other.touched_) {
+                    if (other.nodes_[s].touched && !nodes_[s + off].touched) {
+                        touched_.push_back(s + off);
+                        nodes_[s + off].touched = true;
+                        stale_.store(true, std::memory_order_release);
+                    }
+                }
+            }
+
+            // Sum of durations of the whole queue.
+            template <typename Plays>
+            duration_type total(Plays const &plays) const {
+                refresh(plays);
+                return sum_of(root_);
+            }
+
+            /* Play on air t after the start of the queue, the one whose
+             * [start, start + duration) holds t; no_slot if t is past the
+             * end.
+             */
+            template <typename Plays>
+            slot_t seek(Plays const &plays, duration_type t) const {
+                refresh(plays);
+                for (slot_t n = root_; n != no_slot;) {
+                    node const &nd = nodes_[n];
+                    duration_type left = sum_of(nd.left);
+                    if (t < left) {
+                        n = nd.left;
+                    } else if (t - left < nd.own) {
+                        return n;
+                    } else {
+                        t -= left + nd.own;
+                        n = nd.right;
+                    }
+                }
+                return no_slot;
+            }
+
+            // Time from the start of the queue to the start of play s.
+            template <typename Plays>
+            duration_type start(Plays const &plays, slot_t s) const {
+                refresh(plays);
+                duration_type res = sum_of(nodes_[s].left);
+                for (slot_t n = s; nodes_[n].parent != no_slot;
+                     n = nodes_[n].parent) {
+                    node const &p = nodes_[nodes_[n].parent];
+                    if (p.right == n)
+                        res += sum_of(p.left) + p.own;
+                }
+                return res;
+            }
+
+            // No lock: refresh changes neither capacity.
+            std::size_t memory_bytes() const noexcept {
+                return nodes_.capacity() * sizeof(node)
+                       + touched_.capacity() * sizeof(slot_t);
+            }
+
+        private:
+            duration_type sum_of(slot_t n) const noexcept {
+                return n == no_slot ? duration_type() : nodes_[n].sum;
+            }
+
+            // Reads durations of touched plays again; they stay touched.
+            template <typename Plays>
+            void refresh(Plays const &plays) const {
+                if (!stale_.load(std::memory_order_acquire))
+                    return;
+                std::lock_guard lock(mutex_);
+                reread(plays);
+            }
+
+            /* Also drops from touched_ slots that left the queue (erase
+             * clears the flag) and repeats (a slot touched again after it
+             * was reused): the flags are cleared while the list is walked
+             * and set again for what is kept.
+             */
+            template <typename Plays>
+            void reread(Plays const &plays) const noexcept {
+                std::size_t kept = 0;
+                for (slot_t s : touched_) {
+                    if (!nodes_[s].touched)
+                        continue;
+                    nodes_[s].touched = false;
+                    touched_[kept++] = s;
+                    nodes_[s].own = F()(plays.params(s));
+                    for (slot_t n = s; n != no_slot; n = nodes_[n].parent)
+                        pull(n);
+                }
+                touched_.resize(kept);
+                for (slot_t s : touched_)
+                    nodes_[s].touched = true;
+                if (touched_.empty())
+                    stale_.store(false, std::memory_order_release);
+            }
+
+            void pull(slot_t n) const noexcept {
+                node &nd = nodes_[n];
+                nd.sum = sum_of(nd.left) + nd.own + sum_of(nd.right);
+            }
+
+            slot_t leftmost(slot_t n) const noexcept {
+                while (nodes_[n].left != no_slot)
+                    n = nodes_[n].left;
+                return n;
+            }
+
+            slot_t &child_link(slot_t parent, slot_t n) noexcept {
+                if (parent == no_slot)
+                    return root_;
+                return nodes_[parent].left == n ? nodes_[parent].left
+                                                : nodes_[parent].right;
+            }
+
+            // Same as in treap_index.
+            void rotate_up(slot_t n) noexcept {
+                slot_t p = nodes_[n].parent;
+                slot_t g = nodes_[p].parent;
+                child_link(g, p) = n;
+                if (nodes_[p].left == n) {
+                    nodes_[p].left = nodes_[n].right;
+                    if (nodes_[n].right != no_slot)
+                        nodes_[nodes_[n].right].parent = p;
+                    nodes_[n].right = p;
+                } else {
+                    nodes_[p].right = nodes_[n].left;
+                    if (nodes_[n].left != no_slot)
+                        nodes_[nodes_[n].left].parent = p;
+                    nodes_[n].left = p;
+                }
+                nodes_[p].parent = n;
+                nodes_[n].parent = g;
+                pull(p);
+                pull(n);
+            }
+
+            std::uint32_t next_priority() noexcept {
+                seed_ ^= seed_ << 13;
+                seed_ ^= seed_ >> 17;
+                seed_ ^= seed_ << 5;
+                return seed_;
+            }
+    };
+
+} // namespace cxx
+
+#endif //PLAYLIST_DURATIONS_H
@@ -0,0 +1,375 @@
+#ifndef PLAYLIST_FORMAT_H
+#define PLAYLIST_FORMAT_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <new>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+namespace cxx {
+
+    // Options accepted by playlist::serialize.
+    struct serialize_options {
+        // Caller defined number stored in the header, e.g. the last journal
+        // record that a checkpoint already covers.
+        std::uint64_t sequence = 0;
+        // Store params as a compressed column (see packed_params.h) - much
+        // smaller for timing data, read back value by value in O(1).
+        bool pack_params = false;
+    };
+
+    /* Describes how tracks are stored in the dictionary section. Trivially
+     * copyable tracks are stored inline as raw objects, strings as bytes
+     * addressed by an offset table (read back in place as view_type).
+     * Other types can be made serializable by specializing this template
+     * the same way the string codec does.
+     */
+    template <typename T>
+    struct track_codec;
+
+    template <typename T>
+    struct is_string_view : std::false_type {};
+
+    template <typename C, typename Tr>
+    struct is_string_view<std::basic_string_view<C, Tr>> : std::true_type {};
+
+    template <typename T>
+        requires (std::is_trivially_copyable_v<T> && !is_string_view<T>::value)
+    struct track_codec<T> {
+        using view_type = T const &;
+
+        static constexpr bool is_inline = true;
+        static constexpr bool owning = true;
+    };
+
+    template <typename C, typename Tr, typename A>
+    struct track_codec<std::basic_string<C, Tr, A>> {
+        using track_type = std::basic_string<C, Tr, A>;
+        using view_type = std::basic_string_view<C, Tr>;
+
+        static constexpr bool is_inline = false;
+        // Decoded tracks own their characters.
+        static constexpr bool owning = true;
+
+        static std::size_t size(track_type const &t) noexcept {
+            return t.size() * sizeof(C);
+        }
+
+        static char const *data(track_type const &t) noexcept {
+            return reinterpret_cast<char const *>(t.data());
+        }
+
+        static track_type decode(char const *bytes, std::size_t n) {
+            track_type res(n / sizeof(C), C{});
+            std::memcpy(res.data(), bytes, n);
+            return res;
+        }
+
+        static view_type view(char const *bytes, std::size_t n) noexcept {
+            return {reinterpret_cast<C const *>(bytes), n / sizeof(C)};
+        }
+    };
+
+    template <typename C, typename Tr>
+    struct track_codec<std::basic_string_view<C, Tr>> {
+        using track_type = std::basic_string_view<C, Tr>;
+        using view_type = track_type;
+
+        static constexpr bool is_inline = false;
+        // Decoded tracks point into the buffer they were decoded from.
+        static constexpr bool owning = false;
+
+        static std::size_t size(track_type const &t) noexcept {
+            return t.size() * sizeof(C);
+        }
+
+        static char const *data(track_type const &t) noexcept {
+            return reinterpret_cast<char const *>(t.data());
+        }
+
+        static track_type decode(char const *bytes, std::size_t n) noexcept {
+            return {reinterpret_cast<C const *>(bytes), n / sizeof(C)};
+        }
+
+        static view_type view(char const *bytes, std::size_t n) noexcept {
+            return decode(bytes, n);
+        }
+    };
+
+    template <typename T>
+    concept serializable_track = requires { track_codec<T>::is_inline; };
+
+    /* Params are written as raw bytes. Copy assignment is allowed to be
+     * user provided (std::pair of numbers has one), only copying by
+     * construction and destruction have to be trivial.
+     */
+    template <typename P>
+    concept serializable_params = std::is_trivially_copy_constructible_v<P>
+                                  && std::is_trivially_destructible_v<P>;
+
+    namespace format {
+        inline constexpr char magic[8] = {'C', 'X', 'X', 'P', 'L', 'S', 'T', 0};
+        // Version 2 added packed params, files without them are still
+        // written as version 1.
+        inline constexpr std::uint32_t version = 2;
+        inline constexpr std::uint32_t byte_order = 0x01020304;
+        inline constexpr std::uint64_t alignment = 64;
+
+        // Header flags.
+        inline constexpr std::uint32_t inline_tracks = 1u << 0; // raw T array
+        inline constexpr std::uint32_t packed_params = 1u << 1; // since v2
+
+        /* Binary layout of a serialized playlist, all numbers in native
+         * byte order (checked through byte_order). Each section starts at
+         * a multiple of `alignment`, so that a mapped file can be read
+         * in place:
+         *   dictionary - inline tracks: T[track_count]; otherwise
+         *                uint64 offsets[track_count + 1] followed by bytes,
+         *                offsets counted from the end of the table,
+         *   plays      - uint32 dictionary position of each play,
+         *   params     - raw P of each play, or with packed_params a
+         *                packed column filling the section,
+         *   counts     - uint64 number of plays of each track.
+         * Tracks are stored in playlist (sorted) order, plays in queue order.
+         */
+        struct header {
+            char magic[8];
+            std::uint32_t version;
+            std::uint32_t byte_order;
+            std::uint32_t flags;
+            std::uint32_t track_size;
+            std::uint32_t params_size;
+            std::uint32_t reserved;
+            std::uint64_t sequence;
+            std::uint64_t track_count;
+            std::uint64_t play_count;
+            std::uint64_t dict_offset;
+            std::uint64_t dict_size;
+            std::uint64_t plays_offset;
+            std::uint64_t params_offset;
+            std::uint64_t counts_offset;
+            std::uint64_t file_size;
+        };
+
+        // Copy of an object stored as raw bytes (possibly unaligned).
+        template <typename X>
+        X from_bytes(void const *src) noexcept {
+            alignas(X) unsigned char buf[sizeof(X)];
+            std::memcpy(buf, src, sizeof(X));
+            return *std::launder(reinterpret_cast<X const *>(buf));
+        }
+
+        constexpr std::uint64_t align_up(std::uint64_t x) noexcept {
+            return (x + alignment - 1) / alignment * alignment;
+        }
+
+        // Size of the params section as the header describes it.
+        inline std::uint64_t params_bytes(header const &h) noexcept {
+            if (h.flags & packed_params)
+                return h.counts_offset - h.params_offset;
+            return h.play_count * h.params_size;
+        }
+
+        /* Fills in section offsets, once counts, dictionary size and params
+         * size are known.
+         */
+        inline void layout(header &h, std::uint64_t param_bytes) noexcept {
+            h.dict_offset = align_up(sizeof(header));
+            h.plays_offset = align_up(h.dict_offset + h.dict_size);
+            h.params_offset = align_up(h.plays_offset +
+                                       h.play_count * sizeof(std::uint32_t));
+            h.counts_offset = align_up(h.params_offset + param_bytes);
+            h.file_size = h.counts_offset +
+                          h.track_count * sizeof(std::uint64_t);
+        }
+
+        template <typename T, typename P>
+        header make_header(std::uint64_t tracks, std::uint64_t plays,
+                           std::uint64_t dict_size, std::uint64_t sequence,
+                           std::uint64_t packed_bytes = 0) {
+            bool packed = packed_bytes != 0;
+            header h{};
+            std::memcpy(h.magic, magic, sizeof(magic));
+            h.version = packed ? 2 : 1;
+            h.byte_order = byte_order;
+            h.flags = (track_codec<T>::is_inline ? inline_tracks : 0)
+                    | (packed ? packed_params : 0);
+            h.track_size = track_codec<T>::is_inline ? sizeof(T) : 0;
+            h.params_size = sizeof(P);
+            h.sequence = sequence;
+            h.track_count = tracks;
+            h.play_count = plays;
+            h.dict_size = dict_size;
+            layout(h, packed ? packed_bytes : plays * sizeof(P));
+            return h;
+        }
+
+        /* Checks that the header describes a playlist of T and P that this
+         * build can read. Sizes of the sections are verified against
+         * `available` bytes when it is known (mapped files).
+         */
+        template <typename T, typename P>
+        void validate(header const &h, std::uint64_t available = 0) {
+            if (std::memcmp(h.magic, magic, sizeof(magic)) != 0) {
+                throw std::runtime_error("deserialize, bad magic");
+            }
+            if (h.version == 0 || h.version > version) {
+                throw std::runtime_error("deserialize, unsupported version");
+            }
+            if (h.byte_order != byte_order) {
+                throw std::runtime_error("deserialize, foreign byte order");
+            }
+            std::uint32_t known = h.version >= 2 ? inline_tracks | packed_params
+                                                 : inline_tracks;
+            if (h.flags & ~known) {
+                throw std::runtime_error("deserialize, unsupported version");
+            }
+            bool inl = track_codec<T>::is_inline;
+            if (((h.flags & inline_tracks) != 0) != inl
+                || h.track_size != (inl ? sizeof(T) : 0)
+                || h.params_size != sizeof(P)) {
+                throw std::runtime_error("deserialize, type mismatch");
+            }
+            if (h.track_count > UINT32_MAX || h.play_count > UINT32_MAX
+                || (inl && h.dict_size != h.track_count * sizeof(T))
+                || (!inl && h.dict_size < (h.track_count + 1) *
+                                          sizeof(std::uint64_t))
+                || h.counts_offset < h.params_offset) {
+                throw std::runtime_error("deserialize, corrupt header");
+            }
+            header expected = h;
+            layout(expected, params_bytes(h));
+            if (std::memcmp(&expected, &h, sizeof(header)) != 0
+                || (available != 0 && available < h.file_size)) {
+                throw std::runtime_error("deserialize, corrupt header");
+            }
+        }
+
+        // Buffered sequential writer that keeps track of the file offset.
+        class writer {
+            public:
+                explicit writer(std::ostream &os) : os_(os) {
+                    buf_.reserve(capacity);
+                }
+
+                ~writer() = default;
+                writer(writer const &) = delete;
+                writer & operator=(writer const &) = delete;
+
+                void write(void const *src, std::size_t n) {
+                    char const *p = static_cast<char const *>(src);
+                    pos_ += n;
+                    if (buf_.size() + n > capacity) {
+                        flush();
+                        if (n >= capacity) {
+                            os_.write(p, n);
+                            check();
+                            return;
+                        }
+                    }
+                    buf_.insert(buf_.end(), p, p + n);
+                }
+
+                template <typename X>
+                void put(X const &x) {
+                    write(&x, sizeof(X));
+                }
+
+                // Pads with zeros up to the given file offset.
+                void pad_to(std::uint64_t offset) {
+                    static constexpr char zeros[alignment] = {};
+                    while (pos_ < offset) {
+                        write(zeros, std::min<std::uint64_t>(alignment,
+                                                             offset - pos_));
+                    }
+                }
+
+                void flush() {
+                    os_.write(buf_.data(), buf_.size());
+                    buf_.clear();
+                    check();
+                }
+
+            private:
+                static constexpr std::size_t capacity = 1 << 16;
+
+                std::ostream &os_;
+                std::vector<char> buf_;
+                std::uint64_t pos_ = 0;
+
+                void check() {
+                    if (!os_) {
+                        throw std::runtime_error("serialize, write failed");
+                    }
+                }
+        };
+
+        // Sequential reader counterpart of writer.
+        class reader {
+            public:
+                explicit reader(std::istream &is) : is_(is) {}
+
+                void read(void *dst, std::size_t n) {
+                    is_.read(static_cast<char *>(dst), n);
+                    if (static_cast<std::size_t>(is_.gcount()) != n) {
+                        throw std::runtime_error("deserialize, truncated input");
+                    }
+                    pos_ += n;
+                }
+
+                template <typename X>
+                X get() {
+                    X x;
+                    read(&x, sizeof(X));
+                    return x;
+                }
+
+                /* Reads n objects X, a piece of at most `chunk` bytes at a
+                 * time: sizes come from the header, so memory grows only
+                 * with data that is actually there, and a short input fails
+                 * with runtime_error instead of allocating for n up front.
+                 */
+                template <typename X>
+                std::vector<X> get_array(std::uint64_t n) {
+                    std::vector<X> res;
+                    std::uint64_t step = std::max<std::size_t>(
+                        chunk / sizeof(X), 1);
+                    while (res.size() < n) {
+                        std::size_t at = res.size();
+                        res.resize(at + std::min(n - at, step));
+                        read(res.data() + at, (res.size() - at) * sizeof(X));
+                    }
+                    return res;
+                }
+
+                void skip_to(std::uint64_t offset) {
+                    if (offset < pos_) {
+                        throw std::runtime_error("deserialize, corrupt header");
+                    }
+                    is_.ignore(offset - pos_);
+                    if (static_cast<std::uint64_t>(is_.gcount())
+                        != offset - pos_) {
+                        throw std::runtime_error("deserialize, truncated input");
+                    }
+                    pos_ = offset;
+                }
+
+                static constexpr std::size_t chunk = std::size_t{1} << 20;
+
+            private:
+                std::istream &is_;
+                std::uint64_t pos_ = 0;
+        };
+    } // namespace format
+
+} // namespace cxx
+
+#endif //PLAYLIST_FORMAT_H
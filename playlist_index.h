@@ -0,0 +1,1581 @@
+#ifndef PLAYLIST_INDEX_H
+#define PLAYLIST_INDEX_H
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "playlist_storage.h"
+
+namespace cxx {
+
+    // Per-track bookkeeping: number of plays and ends of the list of its
+    // plays (chained through play_link::occ_prev / occ_next).
+    struct track_info {
+        std::size_t count = 0;
+        slot_t head = no_slot;
+        slot_t tail = no_slot;
+    };
+
+    // What the index keeps next to every track.
+    struct track_entry {
+        std::uint32_t id;
+        track_info info;
+    };
+
+    /* Heap memory owned by a track, for memory_bytes() of the indexes:
+     * the buffer of a string too long for its inline storage, nothing for
+     * other types.
+     */
+    template <typename T>
+    std::size_t heap_bytes(T const &track) noexcept {
+        if constexpr (requires { track.c_str(); track.capacity(); }) {
+            auto *p = static_cast<void const *>(track.data());
+            auto *self = static_cast<void const *>(&track);
+            auto *end = static_cast<void const *>(&track + 1);
+            std::less<void const *> less;
+            if (!less(p, self) && less(p, end))
+                return 0;
+            return (track.capacity() + 1) * sizeof(*track.data());
+        } else {
+            return 0;
+        }
+    }
+
+    // Tracks that are strings of some kind: std::string, string_view...
+    template <typename T>
+    concept string_track = requires {
+        typename T::value_type;
+        typename T::traits_type;
+    } && std::constructible_from<T, std::basic_string_view<
+             typename T::value_type, typename T::traits_type>>;
+
+    /* Turns prefix into the smallest string greater than every string
+     * that starts with it; false if there is none (empty prefix, or one
+     * made of greatest characters only). char_traits<char> compares chars
+     * as unsigned, so does this.
+     */
+    template <typename C, typename Traits, typename A>
+    bool prefix_successor(std::basic_string<C, Traits, A> &prefix) {
+        using U = std::conditional_t<std::is_same_v<C, char>,
+                                     unsigned char, C>;
+        while (!prefix.empty()) {
+            U c = static_cast<U>(prefix.back());
+            if (c != std::numeric_limits<U>::max()) {
+                prefix.back() = static_cast<C>(c + 1);
+                return true;
+            }
+            prefix.pop_back();
+        }
+        return false;
+    }
+
+    /* Track index: sorted set of tracks, each with a small integer id that
+     * plays refer to. Ids of removed tracks are reused. Interface used by
+     * playlist:
+     *   find(t)        - id of t or no_slot,
+     *   insert(t)      - {id, inserted}, strong guarantee,
+     *   insert_last(t) - insert of a track greater than all present,
+     *   erase(id), key(id), info(id), size(),
+     *   take(id)       - erase(id) handing the track over, optional
+     *                    (so is insert of an rvalue that it pairs with),
+     *   begin()/end()  - sorted traversal, it->first is the track and
+     *                    it->second its track_entry,
+     *   lower_bound(t), upper_bound(t)
+     *                  - first track not less / greater than t,
+     *                    O(log m),
+     *   memory_bytes() - heap bytes held, in O(1); an estimate, as the
+     *                    overhead of the allocator is not known.
+     * This one is a std::map. Copying rebuilds the id table from the
+     * copied map, ids stay the same. Indexes take their memory from a
+     * default constructed Alloc.
+     */
+    template <typename T, typename Alloc = std::allocator<T>>
+    class tree_index {
+        public:
+            using entry = track_entry;
+            using map_type = std::map<T, entry, std::less<T>,
+                rebind_alloc_t<Alloc, std::pair<T const, entry>>>;
+            using const_iterator = typename map_type::const_iterator;
+
+            tree_index() = default;
+
+            tree_index(tree_index const &other) : map_(other.map_) {
+                by_id_.resize(other.by_id_.size(), map_.end());
+                free_.reserve(by_id_.size());
+                free_.assign(other.free_.begin(), other.free_.end());
+                // Copied strings may have other capacities.
+                for (auto it = map_.begin(); it != map_.end(); ++it) {
+                    by_id_[it->second.id] = it;
+                    key_bytes_ += heap_bytes(it->first);
+                }
+            }
+
+            tree_index(tree_index &&) noexcept = default;
+            tree_index & operator=(tree_index const &) = delete;
+            ~tree_index() = default;
+
+            std::uint32_t find(T const &track) const {
+                auto it = map_.find(track);
+                return it == map_.end() ? no_slot : it->second.id;
+            }
+
+            std::pair<std::uint32_t, bool> insert(T const &track) {
+                auto it = map_.lower_bound(track);
+                if (it != map_.end() && !(track < it->first))
+                    return {it->second.id, false};
+                return {add(it, track), true};
+            }
+
+            // Moves from track only when it is inserted.
+            std::pair<std::uint32_t, bool> insert(T &&track) {
+                auto it = map_.lower_bound(track);
+                if (it != map_.end() && !(track < it->first))
+                    return {it->second.id, false};
+                return {add(it, std::move(track)), true};
+            }
+
+            std::uint32_t insert_last(T &&track) {
+                return add(map_.end(), std::move(track));
+            }
+
+            void erase(std::uint32_t id) noexcept {
+                key_bytes_ -= heap_bytes(by_id_[id]->first);
+                map_.erase(by_id_[id]);
+                by_id_[id] = map_.end();
+                // Vector has room for every id ever handed out.
+                free_.push_back(id);
+            }
+
+            // The key is moved out of the extracted node.
+            T take(std::uint32_t id) noexcept
+            requires std::is_nothrow_move_constructible_v<T> {
+                key_bytes_ -= heap_bytes(by_id_[id]->first);
+                auto node = map_.extract(by_id_[id]);
+                by_id_[id] = map_.end();
+                free_.push_back(id);
+                return std::move(node.key());
+            }
+
+            T const &key(std::uint32_t id) const noexcept {
+                return by_id_[id]->first;
+            }
+
+            track_info &info(std::uint32_t id) noexcept {
+                return by_id_[id]->second.info;
+            }
+
+            track_info const &info(std::uint32_t id) const noexcept {
+                return by_id_[id]->second.info;
+            }
+
+            // One more than the greatest id in use.
+            std::size_t id_bound() const noexcept {
+                return by_id_.size();
+            }
+
+            std::size_t size() const noexcept {
+                return map_.size();
+            }
+
+            // Node of a red-black tree: three links and a colour.
+            std::size_t memory_bytes() const noexcept {
+                return map_.size() * (sizeof(typename map_type::value_type)
+                                      + 4 * sizeof(void *))
+                       + by_id_.capacity() * sizeof(by_id_[0])
+                       + free_.capacity() * sizeof(std::uint32_t)
+                       + key_bytes_;
+            }
+
+            const_iterator begin() const noexcept {
+                return map_.begin();
+            }
+
+            const_iterator end() const noexcept {
+                return map_.end();
+            }
+
+            const_iterator lower_bound(T const &track) const {
+                return map_.lower_bound(track);
+            }
+
+            const_iterator upper_bound(T const &track) const {
+                return map_.upper_bound(track);
+            }
+
+        private:
+            map_type map_{};
+            std::vector<typename map_type::iterator,
+                rebind_alloc_t<Alloc, typename map_type::iterator>> by_id_{};
+            std::vector<std::uint32_t, rebind_alloc_t<Alloc, std::uint32_t>>
+                free_{};
+            std::size_t key_bytes_ = 0;     // heap_bytes of all tracks
+
+            // Inserts a track known to be absent before hint. Strong.
+            template <typename U>
+            std::uint32_t add(typename map_type::const_iterator hint,
+                              U &&track) {
+                bool reuse = !free_.empty();
+                std::uint32_t id = reuse ? free_.back()
+                                 : static_cast<std::uint32_t>(by_id_.size());
+                if (!reuse) {
+                    if (id == no_slot)
+                        throw std::length_error("playlist, too many tracks");
+                    by_id_.push_back(map_.end());
+                    // free_ must be able to take every id back, so that
+                    // erase cannot fail.
+                    try {
+                        reserve_at_least(free_, by_id_.size());
+                    } catch (...) {
+                        by_id_.pop_back();
+                        throw;
+                    }
+                }
+                try {
+                    by_id_[id] = map_.emplace_hint(hint, std::forward<U>(track),
+                                                   entry{id, {}});
+                } catch (...) {
+                    if (!reuse)
+                        by_id_.pop_back();
+                    throw;
+                }
+                if (reuse)
+                    free_.pop_back();
+                key_bytes_ += heap_bytes(by_id_[id]->first);
+                return id;
+            }
+    };
+
+    /* Index of integral tracks, like catalog ids. While keys are dense -
+     * their span at most dense_factor times their number, plus some slack
+     * - the id of a track is found in an array indexed by the key itself;
+     * an occupancy bitmap with a summary level skips its gaps 64 and 4096
+     * cells at a time. Keys made sparse again by erase go back to the
+     * trie.
+     * Sparse keys go to a 64-ary radix trie in the spirit of Judy arrays:
+     * every branch consumes 6 bits of the key and keeps a bitmap of its
+     * children next to a packed array of them (child position is the
+     * popcount of the bits below), leaves are sorted arrays of up to 64
+     * keys that burst into a branch when they overflow. Both structures
+     * hold keys in order, so sorted traversal walks them instead of
+     * comparing keys. Interface as tree_index; tracks themselves live in
+     * a deque, by id.
+     */
+    template <typename T, typename Alloc = std::allocator<T>>
+        requires std::is_integral_v<T> && (!std::is_same_v<T, bool>)
+    class integral_index {
+        private:
+            template <typename U>
+            using vec = std::vector<U, rebind_alloc_t<Alloc, U>>;
+
+        public:
+            struct value_type {
+                T first;
+                track_entry second;
+            };
+
+            class const_iterator {
+                friend class integral_index;
+
+                public:
+                    using iterator_category = std::forward_iterator_tag;
+                    using value_type = integral_index::value_type;
+                    using difference_type = std::ptrdiff_t;
+                    using pointer = value_type const *;
+                    using reference = value_type const &;
+
+                    const_iterator() = default;
+
+                    reference operator*() const noexcept {
+                        return index_->entries_[id_];
+                    }
+
+                    pointer operator->() const noexcept {
+                        return &**this;
+                    }
+
+                    const_iterator & operator++() noexcept {
+                        id_ = index_->next(order(index_->entries_[id_].first),
+                                           false);
+                        return *this;
+                    }
+
+                    const_iterator operator++(int) noexcept {
+                        const_iterator tmp(*this);
+                        ++*this;
+                        return tmp;
+                    }
+
+                    bool operator==(const_iterator const &) const = default;
+
+                private:
+                    integral_index const *index_ = nullptr;
+                    std::uint32_t id_ = no_slot;
+
+                    const_iterator(integral_index const *index,
+                                   std::uint32_t id) noexcept
+                        : index_(index), id_(id) {}
+            };
+
+            static constexpr std::size_t dense_factor = 4;
+            static constexpr std::size_t dense_slack = 256;
+
+            integral_index() = default;
+
+            integral_index(integral_index const &other)
+                : entries_(other.entries_), size_(other.size_),
+                  sparse_(other.sparse_), min_(other.min_), max_(other.max_),
+                  base_(other.base_),
+                  dense_(other.dense_), nodes_(other.nodes_) {
+                free_.reserve(entries_.size());
+                free_.assign(other.free_.begin(), other.free_.end());
+                free_nodes_.reserve(nodes_.size());
+                free_nodes_.assign(other.free_nodes_.begin(),
+                                   other.free_nodes_.end());
+            }
+
+            integral_index(integral_index &&) noexcept = default;
+            integral_index & operator=(integral_index const &) = delete;
+            ~integral_index() = default;
+
+            std::uint32_t find(T track) const noexcept {
+                std::uint64_t u = order(track);
+                if (!sparse_) {
+                    return u - base_ < dense_.size() && u >= base_
+                           ? dense_.ids[u - base_] : no_slot;
+                }
+                std::uint32_t n = 0;
+                for (unsigned level = 0; !nodes_[n].leaf; ++level) {
+                    node const &nd = nodes_[n];
+                    unsigned d = digit(u, level);
+                    if (!(nd.bits >> d & 1))
+                        return no_slot;
+                    n = nd.child[std::popcount(nd.bits & below(d))];
+                }
+                node const &leaf = nodes_[n];
+                auto it = std::lower_bound(leaf.keys.begin(), leaf.keys.end(), u);
+                return it != leaf.keys.end() && *it == u
+                       ? leaf.child[it - leaf.keys.begin()] : no_slot;
+            }
+
+            std::pair<std::uint32_t, bool> insert(T track) {
+                std::uint32_t id = find(track);
+                if (id != no_slot)
+                    return {id, false};
+                return {add(track), true};
+            }
+
+            std::uint32_t insert_last(T track) {
+                return add(track);
+            }
+
+            void erase(std::uint32_t id) noexcept {
+                std::uint64_t u = order(entries_[id].first);
+                --size_;
+                // Room for every id was reserved by add.
+                free_.push_back(id);
+                if (!sparse_)
+                    dense_.clear(u - base_);
+                else
+                    erase_sparse(u);
+
+                if (size_ == 0) {
+                    if (sparse_) {
+                        nodes_.clear();
+                        free_nodes_.clear();
+                        sparse_ = false;
+                        base_ = 0;
+                    }
+                    return;
+                }
+                if (u == min_)
+                    min_ = order(entries_[next(u, false)].first);
+                if (u == max_) {
+                    max_ = order(entries_[sparse_ ? last() : last_dense()]
+                                 .first);
+                }
+                // Dense again (with a margin against flapping), or sparse
+                // again - switch, unless memory for that is not there.
+                if (sparse_ && max_ - min_ < dense_factor / 2 * size_ +
+                                             dense_slack / 2) {
+                    try {
+                        to_dense(min_, max_);
+                    } catch (...) {}
+                } else if (!sparse_ && max_ - min_ >= dense_factor * size_ +
+                                                      dense_slack) {
+                    try {
+                        to_sparse();
+                    } catch (...) {}
+                }
+            }
+
+            T const &key(std::uint32_t id) const noexcept {
+                return entries_[id].first;
+            }
+
+            track_info &info(std::uint32_t id) noexcept {
+                return entries_[id].second.info;
+            }
+
+            track_info const &info(std::uint32_t id) const noexcept {
+                return entries_[id].second.info;
+            }
+
+            std::size_t id_bound() const noexcept {
+                return entries_.size();
+            }
+
+            std::size_t size() const noexcept {
+                return size_;
+            }
+
+            // Whether keys are held by the radix trie.
+            bool sparse() const noexcept {
+                return sparse_;
+            }
+
+            /* Arrays of the trie are counted by their content: every key
+             * sits in one leaf (with its id), every node but the root in
+             * one branch.
+             */
+            std::size_t memory_bytes() const noexcept {
+                std::size_t res = entries_.size() * sizeof(value_type)
+                                  + free_.capacity() * sizeof(std::uint32_t)
+                                  + dense_.memory_bytes()
+                                  + nodes_.capacity() * sizeof(node)
+                                  + free_nodes_.capacity()
+                                    * sizeof(std::uint32_t);
+                if (sparse_) {
+                    res += size_ * (sizeof(std::uint64_t)
+                                    + sizeof(std::uint32_t))
+                           + (nodes_.size() - free_nodes_.size() - 1)
+                             * sizeof(std::uint32_t);
+                }
+                return res;
+            }
+
+            const_iterator begin() const noexcept {
+                return {this, size_ == 0 ? no_slot : next(0, true)};
+            }
+
+            const_iterator end() const noexcept {
+                return {this, no_slot};
+            }
+
+            const_iterator lower_bound(T track) const noexcept {
+                return {this, size_ == 0 ? no_slot : next(order(track), true)};
+            }
+
+            const_iterator upper_bound(T track) const noexcept {
+                return {this, size_ == 0 ? no_slot
+                                         : next(order(track), false)};
+            }
+
+        private:
+            using ukey_t = std::make_unsigned_t<T>;
+
+            static constexpr unsigned key_bits = sizeof(T) * 8;
+            static constexpr unsigned levels = (key_bits + 5) / 6;
+            static constexpr std::uint64_t max_key = ukey_t(~ukey_t{0});
+
+            // Keys a leaf holds before it bursts into a branch.
+            static constexpr std::size_t leaf_size = 64;
+
+            /* Branch: bitmap of present digits and packed child nodes.
+             * Leaf: sorted keys of its subtree and their ids in child.
+             */
+            struct node {
+                bool leaf = true;
+                std::uint64_t bits = 0;
+                vec<std::uint64_t> keys{};
+                vec<std::uint32_t> child{};
+            };
+
+            /* Dense mode array: ids[i] is the id of key base_ + i (or
+             * no_slot), bit i of bits tells whether it is there and bit w
+             * of summary whether bits[w] is not 0.
+             */
+            struct dense_cells {
+                vec<std::uint32_t> ids{};
+                vec<std::uint64_t> bits{};
+                vec<std::uint64_t> summary{};
+
+                dense_cells() = default;
+
+                explicit dense_cells(std::uint64_t n)
+                    : ids(n, no_slot), bits((n + 63) / 64, 0),
+                      summary((bits.size() + 63) / 64, 0) {}
+
+                std::uint64_t size() const noexcept {
+                    return ids.size();
+                }
+
+                void set(std::uint64_t i, std::uint32_t id) noexcept {
+                    ids[i] = id;
+                    std::uint64_t w = i / 64;
+                    bits[w] |= std::uint64_t{1} << (i % 64);
+                    summary[w / 64] |= std::uint64_t{1} << (w % 64);
+                }
+
+                void clear(std::uint64_t i) noexcept {
+                    ids[i] = no_slot;
+                    std::uint64_t w = i / 64;
+                    bits[w] &= ~(std::uint64_t{1} << (i % 64));
+                    if (bits[w] == 0)
+                        summary[w / 64] &= ~(std::uint64_t{1} << (w % 64));
+                }
+
+                // First cell holding a key from i on, size() if none.
+                std::uint64_t first_from(std::uint64_t i) const noexcept {
+                    if (i >= size())
+                        return size();
+                    std::uint64_t w = i / 64;
+                    std::uint64_t m = bits[w]
+                                      & (~std::uint64_t{0} << (i % 64));
+                    if (m)
+                        return w * 64 + std::countr_zero(m);
+                    // The next word that is not 0, found in the summary.
+                    ++w;
+                    for (std::uint64_t s = w / 64; s < summary.size(); ++s) {
+                        std::uint64_t sm = summary[s];
+                        if (s == w / 64)
+                            sm &= ~std::uint64_t{0} << (w % 64);
+                        if (sm) {
+                            std::uint64_t at = s * 64 + std::countr_zero(sm);
+                            return at * 64 + std::countr_zero(bits[at]);
+                        }
+                    }
+                    return size();
+                }
+
+                // Last cell holding a key, size() if none.
+                std::uint64_t last() const noexcept {
+                    for (std::uint64_t s = summary.size(); s-- > 0;) {
+                        if (summary[s]) {
+                            std::uint64_t w = s * 64 + 63
+                                              - std::countl_zero(summary[s]);
+                            return w * 64 + 63 - std::countl_zero(bits[w]);
+                        }
+                    }
+                    return size();
+                }
+
+                std::size_t memory_bytes() const noexcept {
+                    return ids.capacity() * sizeof(std::uint32_t)
+                           + (bits.capacity() + summary.capacity())
+                             * sizeof(std::uint64_t);
+                }
+
+                void swap(dense_cells &other) noexcept {
+                    ids.swap(other.ids);
+                    bits.swap(other.bits);
+                    summary.swap(other.summary);
+                }
+            };
+
+            std::deque<value_type, rebind_alloc_t<Alloc, value_type>>
+                entries_{};
+            vec<std::uint32_t> free_{};
+            std::size_t size_ = 0;
+            bool sparse_ = false;
+            // Smallest and greatest key present, as order() numbers.
+            std::uint64_t min_ = 0;
+            std::uint64_t max_ = 0;
+
+            // Dense mode: cell k - base_ is key k.
+            std::uint64_t base_ = 0;
+            dense_cells dense_{};
+
+            // Sparse mode: trie, nodes_[0] is the root.
+            vec<node> nodes_{};
+            vec<std::uint32_t> free_nodes_{};
+
+            // Key as an unsigned number of the same order.
+            static std::uint64_t order(T track) noexcept {
+                auto u = static_cast<ukey_t>(track);
+                if constexpr (std::is_signed_v<T>)
+                    u ^= static_cast<ukey_t>(ukey_t{1} << (key_bits - 1));
+                return u;
+            }
+
+            static unsigned digit(std::uint64_t u, unsigned level) noexcept {
+                return (u >> (6 * (levels - 1 - level))) & 63;
+            }
+
+            static std::uint64_t below(unsigned d) noexcept {
+                return (std::uint64_t{1} << d) - 1;
+            }
+
+            static std::uint64_t above(unsigned d) noexcept {
+                return d == 63 ? 0 : ~std::uint64_t{0} << (d + 1);
+            }
+
+            // Takes an id and places the (absent) track. Strong guarantee.
+            std::uint32_t add(T track) {
+                bool reuse = !free_.empty();
+                std::uint32_t id = reuse ? free_.back()
+                                 : static_cast<std::uint32_t>(entries_.size());
+                if (!reuse) {
+                    if (id == no_slot)
+                        throw std::length_error("playlist, too many tracks");
+                    entries_.push_back({track, {id, {}}});
+                    // free_ must be able to take every id back, so that
+                    // erase cannot fail.
+                    try {
+                        reserve_at_least(free_, entries_.size());
+                    } catch (...) {
+                        entries_.pop_back();
+                        throw;
+                    }
+                }
+                try {
+                    place(order(track), id);
+                } catch (...) {
+                    if (!reuse)
+                        entries_.pop_back();
+                    throw;
+                }
+                if (reuse) {
+                    free_.pop_back();
+                    entries_[id] = {track, {id, {}}};
+                }
+                std::uint64_t u = order(track);
+                min_ = size_ == 0 ? u : std::min(min_, u);
+                max_ = size_ == 0 ? u : std::max(max_, u);
+                ++size_;
+                return id;
+            }
+
+            void place(std::uint64_t u, std::uint32_t id) {
+                if (sparse_) {
+                    place_sparse(u, id);
+                    return;
+                }
+                if (u >= base_ && u - base_ < dense_.size()) {
+                    dense_.set(u - base_, id);
+                    return;
+                }
+
+                // Range of keys present together with u.
+                std::uint64_t lo = size_ > 0 ? std::min(min_, u) : u;
+                std::uint64_t hi = size_ > 0 ? std::max(max_, u) : u;
+                std::uint64_t span = hi - lo;
+                if (span >= dense_factor * (size_ + 1) + dense_slack) {
+                    to_sparse(u, id);
+                    return;
+                }
+
+                // Room for growth on the side that grew.
+                std::uint64_t extra = std::max<std::uint64_t>(span / 2, 16);
+                if (u < base_ || dense_.size() == 0)
+                    lo -= std::min(extra, lo);
+                if (u >= base_)
+                    hi += std::min(extra, max_key - hi);
+                dense_cells grown(hi - lo + 1);
+                for (std::uint64_t i = dense_.first_from(0); i < dense_.size();
+                     i = dense_.first_from(i + 1))
+                    grown.set(base_ + i - lo, dense_.ids[i]);
+                grown.set(u - lo, id);
+                dense_.swap(grown);
+                base_ = lo;
+            }
+
+            /* Moves all keys, and the new one unless id is no_slot, into a
+             * trie built aside.
+             */
+            void to_sparse(std::uint64_t u = 0, std::uint32_t id = no_slot) {
+                integral_index built;
+                built.sparse_ = true;
+                built.nodes_.emplace_back();
+                built.free_nodes_.reserve(1);
+                for (std::uint64_t i = dense_.first_from(0); i < dense_.size();
+                     i = dense_.first_from(i + 1))
+                    built.place_sparse(base_ + i, dense_.ids[i]);
+                if (id != no_slot)
+                    built.place_sparse(u, id);
+                nodes_.swap(built.nodes_);
+                free_nodes_.swap(built.free_nodes_);
+                sparse_ = true;
+                base_ = 0;
+                dense_cells().swap(dense_);
+            }
+
+            // Keys [lo, hi] into a direct-mapped array.
+            void to_dense(std::uint64_t lo, std::uint64_t hi) {
+                dense_cells built(hi - lo + 1);
+                for (std::uint32_t id = next(0, true); id != no_slot;) {
+                    std::uint64_t u = order(entries_[id].first);
+                    built.set(u - lo, id);
+                    id = next(u, false);
+                }
+                dense_.swap(built);
+                base_ = lo;
+                sparse_ = false;
+                vec<node>().swap(nodes_);
+                free_nodes_.clear();
+            }
+
+            // Takes a node for n, from the free list if possible. Room in
+            // nodes_ has to be reserved.
+            std::uint32_t new_node(node &&n) noexcept {
+                if (free_nodes_.empty()) {
+                    nodes_.push_back(std::move(n));
+                    return static_cast<std::uint32_t>(nodes_.size() - 1);
+                }
+                std::uint32_t res = free_nodes_.back();
+                free_nodes_.pop_back();
+                nodes_[res] = std::move(n);
+                return res;
+            }
+
+            void reserve_nodes(std::size_t more) {
+                reserve_at_least(nodes_, nodes_.size() + more);
+                reserve_at_least(free_nodes_, nodes_.capacity());
+            }
+
+            /* Adds an absent key to the trie. Whatever may throw (new nodes,
+             * room in vectors) is prepared before anything is linked in; a
+             * leaf that is full first bursts into a branch, which does not
+             * change the content, so the guarantee stays strong.
+             */
+            void place_sparse(std::uint64_t u, std::uint32_t id) {
+                for (;;) {
+                    std::uint32_t n = 0;
+                    unsigned level = 0;
+                    while (!nodes_[n].leaf) {
+                        node const &nd = nodes_[n];
+                        unsigned d = digit(u, level);
+                        if (!(nd.bits >> d & 1)) {
+                            // New leaf under the branch.
+                            node leaf;
+                            leaf.keys.push_back(u);
+                            leaf.child.push_back(id);
+                            reserve_nodes(1);
+                            reserve_at_least(nodes_[n].child,
+                                             nodes_[n].child.size() + 1);
+                            std::uint32_t l = new_node(std::move(leaf));
+                            node &br = nodes_[n];
+                            br.child.insert(br.child.begin() +
+                                std::popcount(br.bits & below(d)), l);
+                            br.bits |= std::uint64_t{1} << d;
+                            return;
+                        }
+                        n = nd.child[std::popcount(nd.bits & below(d))];
+                        ++level;
+                    }
+
+                    node &leaf = nodes_[n];
+                    // On the last level keys differ in their last digit
+                    // only, so a leaf there never exceeds leaf_size.
+                    if (leaf.keys.size() < leaf_size || level == levels - 1) {
+                        reserve_at_least(leaf.keys, leaf.keys.size() + 1);
+                        reserve_at_least(leaf.child, leaf.keys.size() + 1);
+                        auto at = std::lower_bound(leaf.keys.begin(),
+                                                   leaf.keys.end(), u)
+                                  - leaf.keys.begin();
+                        leaf.keys.insert(leaf.keys.begin() + at, u);
+                        leaf.child.insert(leaf.child.begin() + at, id);
+                        return;
+                    }
+                    burst(n, level);
+                }
+            }
+
+            // Splits leaf n on level into a branch with leaves by digit.
+            void burst(std::uint32_t n, unsigned level) {
+                node const &leaf = nodes_[n];
+                vec<node> parts;
+                node branch{false, 0, {}, {}};
+                for (std::size_t i = 0; i < leaf.keys.size(); ++i) {
+                    unsigned d = digit(leaf.keys[i], level);
+                    if (!(branch.bits >> d & 1)) {
+                        branch.bits |= std::uint64_t{1} << d;
+                        parts.emplace_back();
+                    }
+                    parts.back().keys.push_back(leaf.keys[i]);
+                    parts.back().child.push_back(leaf.child[i]);
+                }
+                branch.child.reserve(parts.size());
+                reserve_nodes(parts.size());
+                for (node &part : parts)
+                    branch.child.push_back(new_node(std::move(part)));
+                nodes_[n] = std::move(branch);
+            }
+
+            void erase_sparse(std::uint64_t u) noexcept {
+                std::uint32_t path[levels + 1];
+                unsigned level = 0;
+                std::uint32_t n = 0;
+                for (; !nodes_[n].leaf; ++level) {
+                    path[level] = n;
+                    node const &nd = nodes_[n];
+                    unsigned d = digit(u, level);
+                    n = nd.child[std::popcount(nd.bits & below(d))];
+                }
+                node &leaf = nodes_[n];
+                auto at = std::lower_bound(leaf.keys.begin(), leaf.keys.end(), u)
+                          - leaf.keys.begin();
+                leaf.keys.erase(leaf.keys.begin() + at);
+                leaf.child.erase(leaf.child.begin() + at);
+                if (!leaf.keys.empty() || level == 0)
+                    return;
+
+                // Empty nodes are unlinked from their parents, bottom up.
+                free_node(n);
+                while (level-- > 0) {
+                    node &nd = nodes_[path[level]];
+                    unsigned d = digit(u, level);
+                    nd.child.erase(nd.child.begin() +
+                                   std::popcount(nd.bits & below(d)));
+                    nd.bits &= ~(std::uint64_t{1} << d);
+                    if (nd.bits != 0)
+                        return;
+                    if (level == 0) {
+                        // Root is never freed, it becomes an empty leaf.
+                        nd = node{};
+                        return;
+                    }
+                    free_node(path[level]);
+                }
+            }
+
+            void free_node(std::uint32_t n) noexcept {
+                nodes_[n] = node{};
+                // Room reserved by reserve_nodes.
+                free_nodes_.push_back(n);
+            }
+
+            /* Id of the smallest key greater than u (or equal, when
+             * inclusive), no_slot if there is none.
+             */
+            std::uint32_t next(std::uint64_t u, bool inclusive) const noexcept {
+                if (!sparse_) {
+                    if (u >= base_ && u - base_ >= dense_.size())
+                        return no_slot;
+                    std::uint64_t i = dense_.first_from(
+                        u < base_ ? 0 : u - base_ + (inclusive ? 0 : 1));
+                    return i < dense_.size() ? dense_.ids[i] : no_slot;
+                }
+                return next_sparse(0, 0, u, inclusive);
+            }
+
+            std::uint32_t next_sparse(std::uint32_t n, unsigned level,
+                                      std::uint64_t u, bool inclusive)
+            const noexcept {
+                node const &nd = nodes_[n];
+                if (nd.leaf) {
+                    auto it = inclusive
+                        ? std::lower_bound(nd.keys.begin(), nd.keys.end(), u)
+                        : std::upper_bound(nd.keys.begin(), nd.keys.end(), u);
+                    return it == nd.keys.end()
+                           ? no_slot : nd.child[it - nd.keys.begin()];
+                }
+                unsigned d = digit(u, level);
+                if (nd.bits >> d & 1) {
+                    std::uint32_t res = next_sparse(
+                        nd.child[std::popcount(nd.bits & below(d))],
+                        level + 1, u, inclusive);
+                    if (res != no_slot)
+                        return res;
+                }
+                std::uint64_t m = nd.bits & above(d);
+                if (!m)
+                    return no_slot;
+                // Smallest key of the next subtree.
+                n = nd.child[std::popcount(nd.bits & below(std::countr_zero(m)))];
+                while (!nodes_[n].leaf)
+                    n = nodes_[n].child.front();
+                return nodes_[n].child.front();
+            }
+
+            // Id of the greatest key of the trie.
+            std::uint32_t last() const noexcept {
+                std::uint32_t n = 0;
+                while (!nodes_[n].leaf)
+                    n = nodes_[n].child.back();
+                return nodes_[n].child.back();
+            }
+
+            std::uint32_t last_dense() const noexcept {
+                std::uint64_t i = dense_.last();
+                return i < dense_.size() ? dense_.ids[i] : no_slot;
+            }
+    };
+
+    /* Hashed index, for tracks that are looked up far more often than
+     * listed: find and insert take expected O(1). Sorted traversal walks
+     * an array of entries sorted on first use after tracks were added or
+     * removed, O(m log m) - so sorted iterators are invalidated by any
+     * change of the set of tracks. Const readers of shared data may sit
+     * on different threads, hence the mutex around sorting.
+     */
+    template <typename T, typename Alloc = std::allocator<T>>
+        requires requires (T const &t) { std::hash<T>{}(t); }
+    class hash_index {
+        public:
+            using entry = track_entry;
+            using map_type = std::unordered_map<T, entry, std::hash<T>,
+                std::equal_to<T>,
+                rebind_alloc_t<Alloc, std::pair<T const, entry>>>;
+            using value_type = typename map_type::value_type;
+
+            class const_iterator {
+                friend class hash_index;
+
+                public:
+                    using iterator_category = std::forward_iterator_tag;
+                    using value_type = hash_index::value_type;
+                    using difference_type = std::ptrdiff_t;
+                    using pointer = value_type const *;
+                    using reference = value_type const &;
+
+                    const_iterator() = default;
+
+                    reference operator*() const noexcept {
+                        return **at_;
+                    }
+
+                    pointer operator->() const noexcept {
+                        return *at_;
+                    }
+
+                    const_iterator & operator++() noexcept {
+                        ++at_;
+                        return *this;
+                    }
+
+                    const_iterator operator++(int) noexcept {
+                        const_iterator tmp(*this);
+                        ++at_;
+                        return tmp;
+                    }
+
+                    bool operator==(const_iterator const &) const = default;
+
+                private:
+                    value_type const *const *at_ = nullptr;
+
+                    const_iterator(value_type const *const *at) noexcept
+                        : at_(at) {}
+            };
+
+            hash_index() = default;
+
+            // Elements of an unordered_map do not move, so the id table
+            // keeps pointers to them; the copy rebuilds it.
+            hash_index(hash_index const &other) : map_(other.map_) {
+                by_id_.resize(other.by_id_.size(), nullptr);
+                free_.reserve(by_id_.size());
+                free_.assign(other.free_.begin(), other.free_.end());
+                for (auto &kv : map_) {
+                    by_id_[kv.second.id] = &kv;
+                    key_bytes_ += heap_bytes(kv.first);
+                }
+            }
+
+            hash_index & operator=(hash_index const &) = delete;
+            ~hash_index() = default;
+
+            std::uint32_t find(T const &track) const {
+                auto it = map_.find(track);
+                return it == map_.end() ? no_slot : it->second.id;
+            }
+
+            std::pair<std::uint32_t, bool> insert(T const &track) {
+                auto it = map_.find(track);
+                if (it != map_.end())
+                    return {it->second.id, false};
+                return {add(track), true};
+            }
+
+            std::pair<std::uint32_t, bool> insert(T &&track) {
+                auto it = map_.find(track);
+                if (it != map_.end())
+                    return {it->second.id, false};
+                return {add(std::move(track)), true};
+            }
+
+            std::uint32_t insert_last(T &&track) {
+                return add(std::move(track));
+            }
+
+            void erase(std::uint32_t id) noexcept {
+                key_bytes_ -= heap_bytes(by_id_[id]->first);
+                map_.erase(map_.find(by_id_[id]->first));
+                by_id_[id] = nullptr;
+                free_.push_back(id);
+                stale_.store(true, std::memory_order_relaxed);
+            }
+
+            T take(std::uint32_t id) noexcept
+            requires std::is_nothrow_move_constructible_v<T> {
+                key_bytes_ -= heap_bytes(by_id_[id]->first);
+                auto node = map_.extract(map_.find(by_id_[id]->first));
+                by_id_[id] = nullptr;
+                free_.push_back(id);
+                stale_.store(true, std::memory_order_relaxed);
+                return std::move(node.key());
+            }
+
+            T const &key(std::uint32_t id) const noexcept {
+                return by_id_[id]->first;
+            }
+
+            track_info &info(std::uint32_t id) noexcept {
+                return by_id_[id]->second.info;
+            }
+
+            track_info const &info(std::uint32_t id) const noexcept {
+                return by_id_[id]->second.info;
+            }
+
+            std::size_t id_bound() const noexcept {
+                return by_id_.size();
+            }
+
+            std::size_t size() const noexcept {
+                return map_.size();
+            }
+
+            /* Node: link, element and a cached hash; buckets are single
+             * pointers. The sorted array is counted whether it is
+             * up to date or not; its size is kept by sorted(), so that
+             * this does not lock.
+             */
+            std::size_t memory_bytes() const noexcept {
+                return map_.size() * (sizeof(value_type) + 2 * sizeof(void *))
+                       + map_.bucket_count() * sizeof(void *)
+                       + by_id_.capacity() * sizeof(value_type *)
+                       + free_.capacity() * sizeof(std::uint32_t)
+                       + sorted_bytes_.load(std::memory_order_relaxed)
+                       + key_bytes_;
+            }
+
+            const_iterator begin() const {
+                return sorted().data();
+            }
+
+            const_iterator end() const {
+                return sorted().data() + map_.size();
+            }
+
+            // Binary search of the sorted array, sorted first if stale.
+            const_iterator lower_bound(T const &track) const {
+                sorted_type const &s = sorted();
+                return s.data() + (std::lower_bound(s.begin(), s.end(), track,
+                    [](value_type const *a, T const &t) {
+                        return a->first < t;
+                    }) - s.begin());
+            }
+
+            const_iterator upper_bound(T const &track) const {
+                sorted_type const &s = sorted();
+                return s.data() + (std::upper_bound(s.begin(), s.end(), track,
+                    [](T const &t, value_type const *a) {
+                        return t < a->first;
+                    }) - s.begin());
+            }
+
+        private:
+            using sorted_type = std::vector<value_type const *,
+                rebind_alloc_t<Alloc, value_type const *>>;
+
+            map_type map_{};
+            std::vector<value_type *, rebind_alloc_t<Alloc, value_type *>>
+                by_id_{};
+            std::vector<std::uint32_t, rebind_alloc_t<Alloc, std::uint32_t>>
+                free_{};
+
+            std::size_t key_bytes_ = 0;     // heap_bytes of all tracks
+
+            mutable std::mutex mutex_{};
+            mutable std::atomic<bool> stale_{true};
+            mutable sorted_type sorted_{};
+            // Capacity of sorted_ in bytes, for memory_bytes().
+            mutable std::atomic<std::size_t> sorted_bytes_{0};
+
+            sorted_type const &sorted() const {
+                if (stale_.load(std::memory_order_acquire)) {
+                    std::lock_guard lock(mutex_);
+                    if (stale_.load(std::memory_order_relaxed)) {
+                        sorted_type res;
+                        res.reserve(map_.size());
+                        for (auto const &kv : map_)
+                            res.push_back(&kv);
+                        std::sort(res.begin(), res.end(),
+                                  [](value_type const *a, value_type const *b) {
+                                      return a->first < b->first;
+                                  });
+                        sorted_.swap(res);
+                        sorted_bytes_.store(sorted_.capacity()
+                                            * sizeof(value_type const *),
+                                            std::memory_order_relaxed);
+                        stale_.store(false, std::memory_order_release);
+                    }
+                }
+                return sorted_;
+            }
+
+            // Same as tree_index::add, without the hint.
+            template <typename U>
+            std::uint32_t add(U &&track) {
+                bool reuse = !free_.empty();
+                std::uint32_t id = reuse ? free_.back()
+                                 : static_cast<std::uint32_t>(by_id_.size());
+                if (!reuse) {
+                    if (id == no_slot)
+                        throw std::length_error("playlist, too many tracks");
+                    by_id_.push_back(nullptr);
+                    try {
+                        reserve_at_least(free_, by_id_.size());
+                    } catch (...) {
+                        by_id_.pop_back();
+                        throw;
+                    }
+                }
+                try {
+                    by_id_[id] = &*map_.try_emplace(std::forward<U>(track),
+                                                    entry{id, {}}).first;
+                } catch (...) {
+                    if (!reuse)
+                        by_id_.pop_back();
+                    throw;
+                }
+                if (reuse)
+                    free_.pop_back();
+                key_bytes_ += heap_bytes(by_id_[id]->first);
+                stale_.store(true, std::memory_order_relaxed);
+                return id;
+            }
+    };
+
+    /* Order-statistic index: a treap (binary search tree kept balanced by
+     * random priorities, O(log m) expected depth) whose every node also
+     * holds the number of tracks and the number of plays in its subtree.
+     * Besides the interface of tree_index it answers, in O(log m):
+     *   plays_below(t) - plays of all tracks less than t,
+     *   rank(t)        - number of tracks less than t,
+     *   nth(k)         - iterator to the k-th track in order,
+     * and follows counts of plays through add_plays(id, delta), which the
+     * playlist calls after every change of a count, O(log m) too.
+     *
+     * Nodes are numbers, the node of a track is its id, so a copy is a
+     * plain copy of the arrays. Tracks live in a deque, by id, like in
+     * integral_index.
+     */
+    template <typename T, typename Alloc = std::allocator<T>>
+    class treap_index {
+        private:
+            template <typename U>
+            using vec = std::vector<U, rebind_alloc_t<Alloc, U>>;
+
+        public:
+            struct value_type {
+                T first;
+                track_entry second;
+            };
+
+            class const_iterator {
+                friend class treap_index;
+
+                public:
+                    using iterator_category = std::forward_iterator_tag;
+                    using value_type = treap_index::value_type;
+                    using difference_type = std::ptrdiff_t;
+                    using pointer = value_type const *;
+                    using reference = value_type const &;
+
+                    const_iterator() = default;
+
+                    reference operator*() const noexcept {
+                        return index_->entries_[id_];
+                    }
+
+                    pointer operator->() const noexcept {
+                        return &**this;
+                    }
+
+                    const_iterator & operator++() noexcept {
+                        id_ = index_->successor(id_);
+                        return *this;
+                    }
+
+                    const_iterator operator++(int) noexcept {
+                        const_iterator tmp(*this);
+                        ++*this;
+                        return tmp;
+                    }
+
+                    bool operator==(const_iterator const &) const = default;
+
+                private:
+                    treap_index const *index_ = nullptr;
+                    std::uint32_t id_ = no_slot;
+
+                    const_iterator(treap_index const *index,
+                                   std::uint32_t id) noexcept
+                        : index_(index), id_(id) {}
+            };
+
+            treap_index() = default;
+
+            treap_index(treap_index const &other)
+                : entries_(other.entries_), nodes_(other.nodes_),
+                  root_(other.root_), size_(other.size_),
+                  seed_(other.seed_) {
+                free_.reserve(other.free_.capacity());
+                free_.assign(other.free_.begin(), other.free_.end());
+                for (auto it = begin(); it != end(); ++it)
+                    key_bytes_ += heap_bytes(it->first);
+            }
+
+            treap_index(treap_index &&) noexcept = default;
+            treap_index & operator=(treap_index const &) = delete;
+            ~treap_index() = default;
+
+            std::uint32_t find(T const &track) const {
+                std::uint32_t n = root_;
+                while (n != no_slot) {
+                    T const &k = entries_[n].first;
+                    if (track < k)
+                        n = nodes_[n].left;
+                    else if (k < track)
+                        n = nodes_[n].right;
+                    else
+                        return n;
+                }
+                return no_slot;
+            }
+
+            std::pair<std::uint32_t, bool> insert(T const &track) {
+                std::uint32_t parent = no_slot;
+                bool left = false;
+                for (std::uint32_t n = root_; n != no_slot;) {
+                    T const &k = entries_[n].first;
+                    if (!(track < k) && !(k < track))
+                        return {n, false};
+                    parent = n;
+                    left = track < k;
+                    n = left ? nodes_[n].left : nodes_[n].right;
+                }
+                return {add(track, parent, left), true};
+            }
+
+            std::uint32_t insert_last(T &&track) {
+                std::uint32_t parent = root_;
+                while (parent != no_slot && nodes_[parent].right != no_slot)
+                    parent = nodes_[parent].right;
+                return add(std::move(track), parent, false);
+            }
+
+            // The node sinks to a leaf and is cut off.
+            void erase(std::uint32_t id) noexcept {
+                for (;;) {
+                    node const &nd = nodes_[id];
+                    if (nd.left == no_slot && nd.right == no_slot)
+                        break;
+                    bool left = nd.right == no_slot
+                        || (nd.left != no_slot && nodes_[nd.left].priority
+                                                  > nodes_[nd.right].priority);
+                    rotate_up(left ? nd.left : nd.right);
+                }
+                std::uint32_t parent = nodes_[id].parent;
+                child_link(parent, id) = no_slot;
+                for (std::uint32_t n = parent; n != no_slot;
+                     n = nodes_[n].parent)
+                    pull(n);
+
+                key_bytes_ -= heap_bytes(entries_[id].first);
+                if constexpr (std::is_nothrow_default_constructible_v<T>
+                              && std::is_nothrow_move_assignable_v<T>)
+                    entries_[id].first = T();
+                --size_;
+                // Room for every id was reserved by add.
+                free_.push_back(id);
+            }
+
+            T const &key(std::uint32_t id) const noexcept {
+                return entries_[id].first;
+            }
+
+            track_info &info(std::uint32_t id) noexcept {
+                return entries_[id].second.info;
+            }
+
+            track_info const &info(std::uint32_t id) const noexcept {
+                return entries_[id].second.info;
+            }
+
+            std::size_t id_bound() const noexcept {
+                return entries_.size();
+            }
+
+            std::size_t size() const noexcept {
+                return size_;
+            }
+
+            std::size_t memory_bytes() const noexcept {
+                return entries_.size() * sizeof(value_type)
+                       + nodes_.capacity() * sizeof(node)
+                       + free_.capacity() * sizeof(std::uint32_t)
+                       + key_bytes_;
+            }
+
+            const_iterator begin() const noexcept {
+                std::uint32_t n = root_;
+                while (n != no_slot && nodes_[n].left != no_slot)
+                    n = nodes_[n].left;
+                return {this, n};
+            }
+
+            const_iterator end() const noexcept {
+                return {this, no_slot};
+            }
+
+            const_iterator lower_bound(T const &track) const {
+                std::uint32_t res = no_slot;
+                for (std::uint32_t n = root_; n != no_slot;) {
+                    if (entries_[n].first < track) {
+                        n = nodes_[n].right;
+                    } else {
+                        res = n;
+                        n = nodes_[n].left;
+                    }
+                }
+                return {this, res};
+            }
+
+            const_iterator upper_bound(T const &track) const {
+                std::uint32_t res = no_slot;
+                for (std::uint32_t n = root_; n != no_slot;) {
+                    if (track < entries_[n].first) {
+                        res = n;
+                        n = nodes_[n].left;
+                    } else {
+                        n = nodes_[n].right;
+                    }
+                }
+                return {this, res};
+            }
+
+            // Count of plays of track id changed by delta.
+            void add_plays(std::uint32_t id, std::ptrdiff_t delta) noexcept {
+                for (std::uint32_t n = id; n != no_slot; n = nodes_[n].parent)
+                    nodes_[n].plays += static_cast<std::size_t>(delta);
+            }
+
+            std::size_t plays_below(T const &track) const {
+                std::size_t res = 0;
+                for (std::uint32_t n = root_; n != no_slot;) {
+                    if (entries_[n].first < track) {
+                        res += plays_of(nodes_[n].left) + count_of(n);
+                        n = nodes_[n].right;
+                    } else {
+                        n = nodes_[n].left;
+                    }
+                }
+                return res;
+            }
+
+            std::size_t rank(T const &track) const {
+                std::size_t res = 0;
+                for (std::uint32_t n = root_; n != no_slot;) {
+                    if (entries_[n].first < track) {
+                        res += size_of(nodes_[n].left) + 1;
+                        n = nodes_[n].right;
+                    } else {
+                        n = nodes_[n].left;
+                    }
+                }
+                return res;
+            }
+
+            // end() when k >= size().
+            const_iterator nth(std::size_t k) const noexcept {
+                std::uint32_t n = k < size_ ? root_ : no_slot;
+                while (n != no_slot) {
+                    std::size_t left = size_of(nodes_[n].left);
+                    if (k < left) {
+                        n = nodes_[n].left;
+                    } else if (k == left) {
+                        break;
+                    } else {
+                        k -= left + 1;
+                        n = nodes_[n].right;
+                    }
+                }
+                return {this, n};
+            }
+
+        private:
+            struct node {
+                std::uint32_t left = no_slot;
+                std::uint32_t right = no_slot;
+                std::uint32_t parent = no_slot;
+                std::uint32_t priority = 0;
+                std::size_t tracks = 1;     // in the subtree
+                std::size_t plays = 0;      // in the subtree
+            };
+
+            std::deque<value_type, rebind_alloc_t<Alloc, value_type>>
+                entries_{};
+            vec<node> nodes_{};
+            vec<std::uint32_t> free_{};
+            std::uint32_t root_ = no_slot;
+            std::size_t size_ = 0;
+            std::uint32_t seed_ = 2463534242u;
+            std::size_t key_bytes_ = 0;     // heap_bytes of all tracks
+
+            std::size_t size_of(std::uint32_t n) const noexcept {
+                return n == no_slot ? 0 : nodes_[n].tracks;
+            }
+
+            std::size_t plays_of(std::uint32_t n) const noexcept {
+                return n == no_slot ? 0 : nodes_[n].plays;
+            }
+
+            std::size_t count_of(std::uint32_t n) const noexcept {
+                return entries_[n].second.info.count;
+            }
+
+            // Recomputes sums of n from its children.
+            void pull(std::uint32_t n) noexcept {
+                node &nd = nodes_[n];
+                nd.tracks = 1 + size_of(nd.left) + size_of(nd.right);
+                nd.plays = count_of(n) + plays_of(nd.left)
+                           + plays_of(nd.right);
+            }
+
+            // Link from parent to its child n (root_ for the root).
+            std::uint32_t &child_link(std::uint32_t parent,
+                                      std::uint32_t n) noexcept {
+                if (parent == no_slot)
+                    return root_;
+                return nodes_[parent].left == n ? nodes_[parent].left
+                                                : nodes_[parent].right;
+            }
+
+            // n takes the place of its parent, which becomes its child.
+            void rotate_up(std::uint32_t n) noexcept {
+                std::uint32_t p = nodes_[n].parent;
+                std::uint32_t g = nodes_[p].parent;
+                child_link(g, p) = n;
+                if (nodes_[p].left == n) {
+                    nodes_[p].left = nodes_[n].right;
+                    if (nodes_[n].right != no_slot)
+                        nodes_[nodes_[n].right].parent = p;
+                    nodes_[n].right = p;
+                } else {
+                    nodes_[p].right = nodes_[n].left;
+                    if (nodes_[n].left != no_slot)
+                        nodes_[nodes_[n].left].parent = p;
+                    nodes_[n].left = p;
+                }
+                nodes_[p].parent = n;
+                nodes_[n].parent = g;
+                pull(p);
+                pull(n);
+            }
+
+            std::uint32_t next_priority() noexcept {
+                seed_ ^= seed_ << 13;
+                seed_ ^= seed_ >> 17;
+                seed_ ^= seed_ << 5;
+                return seed_;
+            }
+
+            std::uint32_t successor(std::uint32_t n) const noexcept {
+                if (nodes_[n].right != no_slot) {
+                    n = nodes_[n].right;
+                    while (nodes_[n].left != no_slot)
+                        n = nodes_[n].left;
+                    return n;
+                }
+                std::uint32_t p = nodes_[n].parent;
+                while (p != no_slot && nodes_[p].right == n) {
+                    n = p;
+                    p = nodes_[n].parent;
+                }
+                return p;
+            }
+
+            /* Takes an id for an absent track and hangs it under parent,
+             * then rotates it up to its place by priority. Everything that
+             * may throw comes first, so the guarantee is strong.
+             */
+            template <typename U>
+            std::uint32_t add(U &&track, std::uint32_t parent, bool left) {
+                bool reuse = !free_.empty();
+                std::uint32_t id = reuse ? free_.back()
+                                 : static_cast<std::uint32_t>(entries_.size());
+                if (reuse) {
+                    entries_[id] = {std::forward<U>(track), {id, {}}};
+                } else {
+                    if (id == no_slot)
+                        throw std::length_error("playlist, too many tracks");
+                    entries_.push_back({std::forward<U>(track), {id, {}}});
+                    // free_ must be able to take every id back, so that
+                    // erase cannot fail.
+                    try {
+                        reserve_at_least(nodes_, entries_.size());
+                        reserve_at_least(free_, entries_.size());
+                    } catch (...) {
+                        entries_.pop_back();
+                        throw;
+                    }
+                    nodes_.emplace_back();
+                }
+                if (reuse)
+                    free_.pop_back();
+
+                nodes_[id] = {no_slot, no_slot, parent, next_priority(), 1, 0};
+                (parent == no_slot ? root_ : left ? nodes_[parent].left
+                                                  : nodes_[parent].right) = id;
+                for (std::uint32_t n = parent; n != no_slot;
+                     n = nodes_[n].parent)
+                    ++nodes_[n].tracks;
+                while (nodes_[id].parent != no_slot
+                       && nodes_[nodes_[id].parent].priority
+                          < nodes_[id].priority)
+                    rotate_up(id);
+                ++size_;
+                key_bytes_ += heap_bytes(entries_[id].first);
+                return id;
+            }
+    };
+
+    /* Index picked by playlist by default: integral tracks get
+     * integral_index, other types a std::map.
+     */
+    template <typename T, typename Alloc = std::allocator<T>>
+    struct default_index {
+        using type = tree_index<T, Alloc>;
+    };
+
+    template <typename T, typename Alloc>
+        requires std::is_integral_v<T> && (!std::is_same_v<T, bool>)
+    struct default_index<T, Alloc> {
+        using type = integral_index<T, Alloc>;
+    };
+
+    template <typename T, typename Alloc = std::allocator<T>>
+    using default_index_t = typename default_index<T, Alloc>::type;
+
+} // namespace cxx
+
+#endif //PLAYLIST_INDEX_H
@@ -0,0 +1,523 @@
+#ifndef PLAYLIST_JOURNAL_H
+#define PLAYLIST_JOURNAL_H
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <optional>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "mapped_file.h"
+#include "playlist.h"
+#include "posix_file.h"
+
+namespace cxx {
+
+    struct journal_options {
+        // Buffered records are committed, before the next record, once
+        // they take this many bytes.
+        std::size_t commit_bytes = 1 << 16;
+        // Every n-th commit is followed by fdatasync (0 - only sync() and
+        // checkpoint() synchronize).
+        unsigned sync_every = 1;
+    };
+
+    namespace journal_format {
+        inline constexpr char magic[8] = {'C', 'X', 'X', 'J', 'R', 'N', 'L', 0};
+        inline constexpr std::uint32_t version = 1;
+
+        // Sequence numbers of records continue from base (sequence of the
+        // last record truncated by a checkpoint).
+        struct header {
+            char magic[8];
+            std::uint32_t version;
+            std::uint32_t byte_order;
+            std::uint64_t base;
+        };
+
+        inline header make_header(std::uint64_t base) noexcept {
+            header h{};
+            std::memcpy(h.magic, magic, sizeof(magic));
+            h.version = version;
+            h.byte_order = format::byte_order;
+            h.base = base;
+            return h;
+        }
+
+        /* Every record is: uint32 body size, uint32 crc32 of the body, then
+         * the body - uint8 op, uint64 sequence number and op's payload.
+         * A record that does not fit in the file or fails the checksum
+         * marks the end of the journal (torn write of a crashed process).
+         */
+        enum class op : std::uint8_t {
+            push_back = 1,      // track, P
+            pop_front = 2,      // -
+            remove = 3,         // track
+            clear = 4,          // -
+            params = 5,         // uint64 position, P
+        };
+
+        inline constexpr std::size_t record_prefix = 2 * sizeof(std::uint32_t);
+        inline constexpr std::size_t body_prefix = 1 + sizeof(std::uint64_t);
+
+        inline constexpr auto crc_table = [] {
+            std::array<std::uint32_t, 256> table{};
+            for (std::uint32_t i = 0; i < 256; ++i) {
+                std::uint32_t c = i;
+                for (int k = 0; k < 8; ++k)
+                    c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                table[i] = c;
+            }
+            return table;
+        }();
+
+        inline std::uint32_t crc32(char const *p, std::size_t n) noexcept {
+            std::uint32_t c = 0xFFFFFFFFu;
+            for (std::size_t i = 0; i < n; ++i)
+                c = crc_table[(c ^ static_cast<unsigned char>(p[i])) & 0xFF]
+                    ^ (c >> 8);
+            return c ^ 0xFFFFFFFFu;
+        }
+
+        /* Calls fn(op, sequence, payload, payload_size) for every intact
+         * record and returns the offset just past the last of them. Base
+         * sequence number from the header is stored in base. A file
+         * shorter than the header (crash while it was created) is an
+         * empty journal, 0 is returned.
+         */
+        template <typename F>
+        std::size_t scan(char const *data, std::size_t size,
+                         std::uint64_t &base, F &&fn) {
+            base = 0;
+            if (size < sizeof(header))
+                return 0;
+            auto h = format::from_bytes<header>(data);
+            if (std::memcmp(h.magic, magic, sizeof(magic)) != 0
+                || h.version != version
+                || h.byte_order != format::byte_order) {
+                throw std::runtime_error("journal, bad header");
+            }
+            base = h.base;
+
+            std::size_t pos = sizeof(header);
+            while (size - pos >= record_prefix) {
+                auto body_size = format::from_bytes<std::uint32_t>(data + pos);
+                auto crc = format::from_bytes<std::uint32_t>(
+                    data + pos + sizeof(std::uint32_t));
+                char const *body = data + pos + record_prefix;
+                if (body_size < body_prefix
+                    || size - pos - record_prefix < body_size
+                    || crc32(body, body_size) != crc) {
+                    break;
+                }
+                fn(static_cast<op>(body[0]),
+                   format::from_bytes<std::uint64_t>(body + 1),
+                   body + body_prefix, body_size - body_prefix);
+                pos += record_prefix + body_size;
+            }
+            return pos;
+        }
+    } // namespace journal_format
+
+    /* Append-only write-ahead journal of playlist mutations. Every mutation
+     * goes through the journal, which encodes a record, applies the
+     * operation to the playlist and keeps the record only if it succeeded.
+     * Records are buffered and written by commit() in a single write
+     * (group commit), fdatasync is batched according to journal_options.
+     * checkpoint() stores the whole playlist, tagged with the sequence
+     * number of the last record it covers, and empties the journal;
+     * recover() rebuilds the playlist from both files.
+     */
+    template <typename T, typename P>
+        requires serializable_track<T> && serializable_params<P>
+    class playlist_journal {
+        private:
+            using codec = track_codec<T>;
+            using op = journal_format::op;
+
+        public:
+            using playlist_type = playlist<T, P>;
+
+            /* Opens (creating if needed) the journal, dropping a torn tail.
+             * A torn header is dropped too and written again.
+             */
+            explicit playlist_journal(std::string path,
+                                      journal_options opts = {})
+                : path_(std::move(path)), opts_(opts),
+                  fd_(path_, O_RDWR | O_CREAT | O_APPEND) {
+                struct stat st;
+                if (::fstat(fd_.get(), &st) != 0) {
+                    throw_errno("fstat " + path_);
+                }
+
+                if (static_cast<std::size_t>(st.st_size)
+                    < sizeof(journal_format::header)) {
+                    if (st.st_size != 0 && ::ftruncate(fd_.get(), 0) != 0) {
+                        throw_errno("ftruncate " + path_);
+                    }
+                    auto h = journal_format::make_header(0);
+                    write_all(fd_.get(), &h, sizeof(h));
+                    sync_fd(fd_.get());
+                    sync_parent_dir(path_);
+                    size_ = sizeof(h);
+                    return;
+                }
+
+                mapped_file file(path_);
+                std::uint64_t base;
+                size_ = journal_format::scan(file.data(), file.size(), base,
+                    [this](op, std::uint64_t seq, char const *, std::size_t) {
+                        next_ = seq + 1;
+                    });
+                next_ = std::max(next_, base + 1);
+                if (size_ != file.size()
+                    && ::ftruncate(fd_.get(), size_) != 0) {
+                    throw_errno("ftruncate " + path_);
+                }
+            }
+
+            playlist_journal(playlist_journal const &) = delete;
+            playlist_journal & operator=(playlist_journal const &) = delete;
+
+            // Commits what is buffered, errors can't be reported from here.
+            ~playlist_journal() {
+                try {
+                    sync();
+                } catch (...) {
+                }
+            }
+
+            void push_back(playlist_type &pl, T const &track, P const &params) {
+                record(op::push_back, [&] {
+                    put_track(track);
+                    put(params);
+                }, [&] {
+                    pl.push_back(track, params);
+                });
+            }
+
+            void pop_front(playlist_type &pl) {
+                record(op::pop_front, [] {}, [&] {
+                    pl.pop_front();
+                    live_.popped(pl);
+                });
+            }
+
+            void remove(playlist_type &pl, T const &track) {
+                record(op::remove, [&] {
+                    put_track(track);
+                }, [&] {
+                    pl.remove(track);
+                    live_.it.reset();
+                });
+            }
+
+            void clear(playlist_type &pl) {
+                record(op::clear, [] {}, [&] {
+                    pl.clear();
+                    live_.it.reset();
+                });
+            }
+
+            /* Sets params of the play at given position of the queue. The
+             * play is found from the one edited last, edits at the same or
+             * later positions walk only the distance between them.
+             */
+            void params(playlist_type &pl, std::size_t position,
+                        P const &value) {
+                record(op::params, [&] {
+                    put(static_cast<std::uint64_t>(position));
+                    put(value);
+                }, [&] {
+                    set_params(pl, position, value, live_);
+                });
+            }
+
+            // Writes buffered records to the file with a single write.
+            void commit() {
+                if (buffer_.empty())
+                    return;
+                try {
+                    write_all(fd_.get(), buffer_.data(), buffer_.size());
+                } catch (...) {
+                    // Don't leave a partial record in front of later ones.
+                    if (::ftruncate(fd_.get(), size_) != 0) {
+                        // Torn tail is dropped when the journal is reopened.
+                    }
+                    throw;
+                }
+                size_ += buffer_.size();
+                buffer_.clear();
+                ++unsynced_;
+                if (opts_.sync_every != 0 && unsynced_ >= opts_.sync_every)
+                    sync_now();
+            }
+
+            // Commits and makes everything written so far durable.
+            void sync() {
+                commit();
+                if (unsynced_ > 0)
+                    sync_now();
+            }
+
+            // Sequence number of the last recorded mutation (0 - none yet).
+            std::uint64_t last_sequence() const noexcept {
+                return next_ - 1;
+            }
+
+            /* Durably stores pl (which has to be the journaled playlist) in
+             * the checkpoint file and replaces the journal with an empty one,
+             * whose numbering continues. A crash in between leaves old
+             * records behind, recover() skips them by the sequence number
+             * saved in the checkpoint.
+             */
+            void checkpoint(playlist_type const &pl, std::string const &path) {
+                sync();
+                std::string tmp = path + ".tmp";
+                {
+                    unique_fd out(tmp, O_WRONLY | O_CREAT | O_TRUNC);
+                    fd_streambuf buf(out.get());
+                    std::ostream os(&buf);
+                    pl.serialize(os, {.sequence = last_sequence()});
+                    os.flush();
+                    if (!os) {
+                        throw std::runtime_error("checkpoint, write failed");
+                    }
+                    sync_fd(out.get());
+                }
+                replace_file(tmp, path);
+
+                std::string fresh = path_ + ".tmp";
+                unique_fd fd(fresh, O_RDWR | O_CREAT | O_TRUNC | O_APPEND);
+                auto h = journal_format::make_header(last_sequence());
+                write_all(fd.get(), &h, sizeof(h));
+                sync_fd(fd.get());
+                replace_file(fresh, path_);
+                fd_ = std::move(fd);
+                size_ = sizeof(h);
+                unsynced_ = 0;
+            }
+
+            /* Rebuilds playlist from the checkpoint (if it exists) and the
+             * records of the journal it does not cover. Checkpoint loads in
+             * linear time, records are replayed through playlist's
+             * operations. Tracks that view their bytes (string_view) point
+             * into the mapped journal, which is kept alive by the result.
+             */
+            static playlist_type recover(std::string const &checkpoint,
+                                         std::string const &journal) {
+                playlist_type pl;
+                serialize_options covered;
+                if (::access(checkpoint.c_str(), F_OK) == 0) {
+                    std::ifstream in(checkpoint, std::ios::binary);
+                    pl = playlist_type::deserialize(in, &covered);
+                }
+                if (::access(journal.c_str(), F_OK) != 0)
+                    return pl;
+
+                auto file = std::make_shared<mapped_file const>(journal);
+                file->advise_sequential();
+                std::uint64_t base;
+                cursor at;
+                journal_format::scan(file->data(), file->size(), base,
+                    [&](op code, std::uint64_t seq, char const *p,
+                        std::size_t n) {
+                        if (seq > covered.sequence)
+                            apply(pl, code, p, n, at);
+                    });
+                // Attached at the end, as replayed clear() drops owners.
+                if constexpr (!codec::owning)
+                    pl.keep_alive(file);
+                return pl;
+            }
+
+        private:
+            /* Play of the last params edit and its position, so that a run
+             * of edits (or of replayed records) at nearby positions does not
+             * walk the queue from the head for each of them. Kept up to date
+             * by every operation, which knows what it does to the positions.
+             */
+            struct cursor {
+                std::optional<typename playlist_type::play_iterator> it{};
+                std::size_t pos = 0;
+                playlist_type const *pl = nullptr;
+
+                // pl lost its first play.
+                void popped(playlist_type const &from) noexcept {
+                    if (&from != pl)
+                        return;
+                    if (pos == 0)
+                        it.reset();
+                    else
+                        --pos;
+                }
+            };
+
+            std::string path_;
+            journal_options opts_;
+            unique_fd fd_;
+            std::vector<char> buffer_;
+            cursor live_;                   // last params() edit
+            std::size_t size_ = 0;          // bytes committed to the file
+            std::uint64_t next_ = 1;        // sequence of the next record
+            unsigned unsynced_ = 0;         // commits since last fdatasync
+
+            template <typename X>
+            void put(X const &x) {
+                auto p = reinterpret_cast<char const *>(&x);
+                buffer_.insert(buffer_.end(), p, p + sizeof(X));
+            }
+
+            void put_track(T const &track) {
+                if constexpr (codec::is_inline) {
+                    put(track);
+                } else {
+                    auto n = static_cast<std::uint32_t>(codec::size(track));
+                    put(n);
+                    buffer_.insert(buffer_.end(), codec::data(track),
+                                   codec::data(track) + n);
+                }
+            }
+
+            /* Write-ahead: record goes to the buffer first, the operation is
+             * applied next and the record is withdrawn if it throws. A full
+             * buffer is committed before anything else, so that a failed
+             * write is reported by the operation that did not happen (the
+             * buffered records stay for the next commit), never by one that
+             * did - the guarantee is strong.
+             */
+            template <typename Encode, typename Apply>
+            void record(op code, Encode encode, Apply apply) {
+                if (buffer_.size() >= opts_.commit_bytes)
+                    commit();
+                std::size_t mark = buffer_.size();
+                try {
+                    buffer_.resize(mark + journal_format::record_prefix);
+                    put(static_cast<std::uint8_t>(code));
+                    put(next_);
+                    encode();
+
+                    char *rec = buffer_.data() + mark;
+                    char const *body = rec + journal_format::record_prefix;
+                    auto body_size = static_cast<std::uint32_t>(
+                        buffer_.size() - mark - journal_format::record_prefix);
+                    auto crc = journal_format::crc32(body, body_size);
+                    std::memcpy(rec, &body_size, sizeof(body_size));
+                    std::memcpy(rec + sizeof(body_size), &crc, sizeof(crc));
+
+                    apply();
+                } catch (...) {
+                    buffer_.resize(mark);
+                    throw;
+                }
+                ++next_;
+            }
+
+            void sync_now() {
+                sync_fd(fd_.get());
+                unsynced_ = 0;
+            }
+
+            /* Sets params through modify(), so that pl stays shareable
+             * and its copies keep sharing data.
+             */
+            static void set_params(playlist_type &pl, std::size_t position,
+                                   P const &value, cursor &at) {
+                if (position >= pl.size()) {
+                    throw std::out_of_range("params, position out of range");
+                }
+                auto it = pl.play_begin();
+                std::size_t i = 0;
+                if (at.it && at.pl == &pl && at.pos <= position) {
+                    it = pl.same_play(*at.it);
+                    i = at.pos;
+                }
+                for (; i < position; ++i)
+                    ++it;
+                pl.modify(it, [&value](P &p) {
+                    p = value;
+                });
+                at.it = it;
+                at.pos = position;
+                at.pl = &pl;
+            }
+
+            static T get_track(char const *&p, char const *end) {
+                if constexpr (codec::is_inline) {
+                    if (static_cast<std::size_t>(end - p) < sizeof(T))
+                        throw std::runtime_error("recover, corrupt record");
+                    p += sizeof(T);
+                    return format::from_bytes<T>(p - sizeof(T));
+                } else {
+                    if (static_cast<std::size_t>(end - p) <
+                        sizeof(std::uint32_t))
+                        throw std::runtime_error("recover, corrupt record");
+                    auto n = format::from_bytes<std::uint32_t>(p);
+                    p += sizeof(std::uint32_t);
+                    if (static_cast<std::size_t>(end - p) < n)
+                        throw std::runtime_error("recover, corrupt record");
+                    p += n;
+                    return codec::decode(p - n, n);
+                }
+            }
+
+            template <typename X>
+            static X get(char const *&p, char const *end) {
+                if (static_cast<std::size_t>(end - p) < sizeof(X))
+                    throw std::runtime_error("recover, corrupt record");
+                p += sizeof(X);
+                return format::from_bytes<X>(p - sizeof(X));
+            }
+
+            static void apply(playlist_type &pl, op code, char const *p,
+                              std::size_t n, cursor &at) {
+                char const *end = p + n;
+                try {
+                    switch (code) {
+                        case op::push_back: {
+                            // Plays in front of the cursor stay as they are.
+                            T track = get_track(p, end);
+                            pl.push_back(track, get<P>(p, end));
+                            break;
+                        }
+                        case op::pop_front:
+                            pl.pop_front();
+                            at.popped(pl);
+                            break;
+                        case op::remove:
+                            at.it.reset();
+                            pl.remove(get_track(p, end));
+                            break;
+                        case op::clear:
+                            at.it.reset();
+                            pl.clear();
+                            break;
+                        case op::params: {
+                            auto pos = get<std::uint64_t>(p, end);
+                            set_params(pl, pos, get<P>(p, end), at);
+                            break;
+                        }
+                        default:
+                            throw std::runtime_error("recover, unknown record");
+                    }
+                } catch (std::logic_error const &) {
+                    // out_of_range / invalid_argument from the playlist.
+                    throw std::runtime_error(
+                        "recover, journal does not match checkpoint");
+                }
+            }
+    };
+
+} // namespace cxx
+
+#endif //PLAYLIST_JOURNAL_H
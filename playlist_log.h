@@ -0,0 +1,93 @@
+#ifndef PLAYLIST_LOG_H
+#define PLAYLIST_LOG_H
+
+#include <charconv>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "mapped_file.h"
+#include "playlist.h"
+
+namespace cxx {
+
+    // Parses "start:end" params of a play log line, as in params_t of
+    // playlist_example.cpp.
+    struct play_window_parser {
+        bool operator()(std::string_view field,
+                        std::pair<unsigned, unsigned> &out) const noexcept {
+            char const *end = field.data() + field.size();
+            auto [colon, ec] = std::from_chars(field.data(), end, out.first);
+            if (ec != std::errc{} || colon == end || *colon != ':')
+                return false;
+            auto [last, ec2] = std::from_chars(colon + 1, end, out.second);
+            return ec2 == std::errc{} && last == end;
+        }
+    };
+
+    /* Splits a play log - one "track params" per line, track being
+     * everything before the last space - and calls fn(track, params) for
+     * every play, with track viewing the buffer. Empty lines and lines
+     * starting with '#' are skipped, malformed ones are reported with
+     * std::invalid_argument. Scanning for newlines and delimiters goes
+     * through memchr/memrchr, which glibc implements with SIMD.
+     */
+    template <typename P, typename Parse, typename F>
+    void parse_play_log(std::string_view buffer, Parse &parse, F &&fn) {
+        char const *p = buffer.data();
+        char const *end = p + buffer.size();
+        std::size_t line_no = 0;
+
+        while (p < end) {
+            ++line_no;
+            auto nl = static_cast<char const *>(std::memchr(p, '\n', end - p));
+            char const *eol = nl ? nl : end;
+            std::string_view line(p, eol - p);
+            p = nl ? nl + 1 : end;
+
+            if (!line.empty() && line.back() == '\r')
+                line.remove_suffix(1);
+            if (line.empty() || line.front() == '#')
+                continue;
+
+            auto space = static_cast<char const *>(
+                ::memrchr(line.data(), ' ', line.size()));
+            P params{};
+            if (!space || space == line.data()
+                || !parse(std::string_view(space + 1,
+                              line.data() + line.size() - space - 1), params)) {
+                throw std::invalid_argument("parse_play_log, malformed line "
+                                            + std::to_string(line_no));
+            }
+            fn(std::string_view(line.data(), space - line.data()),
+               std::as_const(params));
+        }
+    }
+
+    /* Loads a play log without copying track names: the file is mapped and
+     * tracks of the returned playlist are views into the mapping, which
+     * stays alive as long as the playlist data (or any copy of it) does.
+     */
+    template <typename P = std::pair<unsigned, unsigned>,
+              typename Parse = play_window_parser>
+    playlist<std::string_view, P> load_play_log(std::string const &path,
+                                                Parse parse = {}) {
+        auto file = std::make_shared<mapped_file const>(path);
+        file->advise_sequential();
+
+        playlist<std::string_view, P> res;
+        res.keep_alive(file);
+        parse_play_log<P>(std::string_view(file->data(), file->size()), parse,
+            [&res](std::string_view track, P const &params) {
+                res.push_back(track, params);
+            });
+        return res;
+    }
+
+} // namespace cxx
+
+#endif //PLAYLIST_LOG_H
@@ -0,0 +1,301 @@
+#ifndef PLAYLIST_POLICIES_H
+#define PLAYLIST_POLICIES_H
+
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+#include "playlist_counts.h"
+#include "playlist_durations.h"
+#include "playlist_index.h"
+#include "playlist_stats.h"
+#include "playlist_storage.h"
+
+namespace cxx {
+
+    /* Compile-time configuration of playlist<T, P, Policies...>. Every
+     * policy belongs to one of the categories below and says so in its
+     * category member; policies can be given in any order, at most one
+     * per category, and a category left out takes its default. With no
+     * policies at all the playlist is what it always was; a distinct
+     * type, it behaves like
+     *
+     *   playlist<T, P, slab_storage<>, auto_index,
+     *            atomic_sharing, allocator_policy<std::allocator<P>>,
+     *            no_instrumentation, no_duration_index, no_count_index>
+     *
+     * Instrumentation policies (cow_instrumentation) are in
+     * playlist_stats.h.
+     */
+    struct storage_category {};
+    struct index_category {};
+    struct sharing_category {};
+    struct allocator_category {};
+    struct duration_category {};
+    struct count_category {};
+
+    /* Queue storage: plays in chunks of K slots (play_slab). Bigger chunks
+     * mean fewer allocations and faster copies, node_storage allocates
+     * every play on its own, like the std::list the playlist started with.
+     */
+    template <std::size_t K = 64>
+    struct slab_storage {
+        using category = storage_category;
+
+        template <typename P, typename Alloc, bool Atomic, typename Instr>
+        using type = play_slab<P, K, Alloc, Atomic, Instr>;
+    };
+
+    using node_storage = slab_storage<1>;
+
+    /* Track index, any template with the interface of tree_index
+     * (playlist_index.h).
+     */
+    template <template <typename, typename> class Index>
+    struct index_policy {
+        using category = index_category;
+
+        template <typename T, typename Alloc>
+        using type = Index<T, Alloc>;
+    };
+
+    using map_index = index_policy<tree_index>;
+    using radix_index = index_policy<integral_index>;
+    using hashed_index = index_policy<hash_index>;
+    // plays_between() and sorted_nth() in O(log m), at O(log m) per play
+    using order_statistic_index = index_policy<treap_index>;
+    // integral_index for integral tracks, map_index otherwise
+    using auto_index = index_policy<default_index_t>;
+
+    /* How copies share data: pointer<D, Alloc> is a copyable owning
+     * pointer with get(), use_count() and the usual operators, make<D>
+     * creates one; atomic tells the storage whether counts of its shared
+     * chunks have to be atomic as well. Counts of std::shared_ptr are
+     * atomic, so copies of a playlist may be read and modified from
+     * different threads (as the checkpointer does), as long as every
+     * single copy stays on one thread.
+     */
+    struct atomic_sharing {
+        using category = sharing_category;
+
+        static constexpr bool atomic = true;
+
+        template <typename D, typename Alloc>
+        using pointer = std::shared_ptr<D>;
+
+        template <typename D, typename Alloc, typename... Args>
+        static pointer<D, Alloc> make(Alloc const &alloc, Args &&...args) {
+            return std::allocate_shared<D>(alloc, std::forward<Args>(args)...);
+        }
+    };
+
+    /* Pointer of local_sharing: the count is a plain integer kept in one
+     * block with the data, so copies, assignments and use_count() cost no
+     * atomic instructions and no separate control block.
+     */
+    template <typename D, typename Alloc>
+    class local_ptr {
+        private:
+            struct block {
+                D value;
+                long refs = 1;
+
+                template <typename... Args>
+                explicit block(std::in_place_t, Args &&...args)
+                    : value(std::forward<Args>(args)...) {}
+            };
+
+            using block_alloc = rebind_alloc_t<Alloc, block>;
+            using block_traits = std::allocator_traits<block_alloc>;
+
+            block *block_ = nullptr;
+
+        public:
+            local_ptr() = default;
+
+            local_ptr(local_ptr const &other) noexcept : block_(other.block_) {
+                if (block_)
+                    ++block_->refs;
+            }
+
+            local_ptr(local_ptr &&other) noexcept
+                : block_(std::exchange(other.block_, nullptr)) {}
+
+            local_ptr & operator=(local_ptr other) noexcept {
+                std::swap(block_, other.block_);
+                return *this;
+            }
+
+            ~local_ptr() {
+                if (block_ && --block_->refs == 0) {
+                    block_alloc a;
+                    block_traits::destroy(a, block_);
+                    block_traits::deallocate(a, block_, 1);
+                }
+            }
+
+            template <typename... Args>
+            static local_ptr make(Alloc const &alloc, Args &&...args) {
+                block_alloc a(alloc);
+                block *b = block_traits::allocate(a, 1);
+                try {
+                    block_traits::construct(a, b, std::in_place,
+                                            std::forward<Args>(args)...);
+                } catch (...) {
+                    block_traits::deallocate(a, b, 1);
+                    throw;
+                }
+                local_ptr res;
+                res.block_ = b;
+                return res;
+            }
+
+            D *get() const noexcept {
+                return block_ ? &block_->value : nullptr;
+            }
+
+            D &operator*() const noexcept {
+                return block_->value;
+            }
+
+            D *operator->() const noexcept {
+                return &block_->value;
+            }
+
+            long use_count() const noexcept {
+                return block_ ? block_->refs : 0;
+            }
+    };
+
+    /* Non-atomic sharing, for single-threaded processes: a playlist and
+     * all its copies (including snapshots) must stay on one thread.
+     */
+    struct local_sharing {
+        using category = sharing_category;
+
+        static constexpr bool atomic = false;
+
+        template <typename D, typename Alloc>
+        using pointer = local_ptr<D, Alloc>;
+
+        template <typename D, typename Alloc, typename... Args>
+        static pointer<D, Alloc> make(Alloc const &alloc, Args &&...args) {
+            return pointer<D, Alloc>::make(alloc, std::forward<Args>(args)...);
+        }
+    };
+
+    /* Allocator for everything the playlist allocates: data, chunks and
+     * index nodes. It is rebound as needed and default constructed where
+     * needed, so stateful allocators have to be default constructible
+     * (std::pmr::polymorphic_allocator is: it takes the default resource).
+     */
+    template <typename Alloc>
+    struct allocator_policy {
+        using category = allocator_category;
+        using type = Alloc;
+    };
+
+    /* Durations of plays summed over the queue, for seek_time(): F()(p)
+     * is the duration of a play with params p (duration_tree).
+     */
+    template <typename F>
+    struct duration_index {
+        using category = duration_category;
+
+        template <typename P, typename Alloc>
+        using type = duration_tree<F, P, Alloc>;
+    };
+
+    struct no_duration_index {
+        using category = duration_category;
+
+        template <typename P, typename Alloc>
+        using type = no_durations;
+    };
+
+    /* Tracks ordered by their number of plays, for top_k() and
+     * played_at_least(): O(1) more per play added or removed
+     * (count_order).
+     */
+    struct count_index {
+        using category = count_category;
+
+        template <typename Alloc>
+        using type = count_order<Alloc>;
+    };
+
+    struct no_count_index {
+        using category = count_category;
+
+        template <typename Alloc>
+        using type = no_counts;
+    };
+
+    template <typename Policy>
+    concept playlist_policy = requires { typename Policy::category; }
+        && (std::is_same_v<typename Policy::category, storage_category>
+            || std::is_same_v<typename Policy::category, index_category>
+            || std::is_same_v<typename Policy::category, sharing_category>
+            || std::is_same_v<typename Policy::category, allocator_category>
+            || std::is_same_v<typename Policy::category, duration_category>
+            || std::is_same_v<typename Policy::category, count_category>
+            || std::is_same_v<typename Policy::category,
+                              instrumentation_category>);
+
+    // First of Policies of the category, Default if there is none.
+    template <typename Category, typename Default, typename... Policies>
+    struct select_policy {
+        using type = Default;
+    };
+
+    template <typename Category, typename Default, typename First,
+              typename... Rest>
+    struct select_policy<Category, Default, First, Rest...>
+        : std::conditional_t<
+              std::is_same_v<typename First::category, Category>,
+              std::type_identity<First>,
+              select_policy<Category, Default, Rest...>> {};
+
+    template <typename Category, typename... Policies>
+    inline constexpr std::size_t policy_count =
+        (std::size_t{0} + ... +
+         std::is_same_v<typename Policies::category, Category>);
+
+    // Policies resolved for a playlist of T and P.
+    template <typename T, typename P, playlist_policy... Policies>
+    struct playlist_policies {
+        static_assert(policy_count<storage_category, Policies...> <= 1
+                      && policy_count<index_category, Policies...> <= 1
+                      && policy_count<sharing_category, Policies...> <= 1
+                      && policy_count<allocator_category, Policies...> <= 1
+                      && policy_count<duration_category, Policies...> <= 1
+                      && policy_count<count_category, Policies...> <= 1
+                      && policy_count<instrumentation_category,
+                                      Policies...> <= 1,
+                      "playlist takes at most one policy of each kind");
+
+        using allocator = rebind_alloc_t<
+            typename select_policy<allocator_category,
+                                   allocator_policy<std::allocator<P>>,
+                                   Policies...>::type::type, P>;
+        using sharing = typename select_policy<sharing_category,
+                                               atomic_sharing,
+                                               Policies...>::type;
+        using instrumentation = typename select_policy<
+            instrumentation_category, no_instrumentation, Policies...>::type;
+        using storage = typename select_policy<storage_category,
+            slab_storage<>, Policies...>::type::template type<
+                P, allocator, sharing::atomic, instrumentation>;
+        using index = typename select_policy<index_category, auto_index,
+            Policies...>::type::template type<T, rebind_alloc_t<allocator, T>>;
+        using durations = typename select_policy<duration_category,
+            no_duration_index, Policies...>::type::template type<P,
+                                                                 allocator>;
+        using counts = typename select_policy<count_category,
+            no_count_index, Policies...>::type::template type<allocator>;
+    };
+
+} // namespace cxx
+
+#endif //PLAYLIST_POLICIES_H
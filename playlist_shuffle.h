@@ -0,0 +1,205 @@
+#ifndef PLAYLIST_SHUFFLE_H
+#define PLAYLIST_SHUFFLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <queue>
+#include <random>
+#include <stdexcept>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace cxx {
+
+    /* Random order of plays in which two plays of one track have at least
+     * gap other plays between them: given counts[j] plays of track j, it
+     * lists the track of every position. With n plays in all and the
+     * greatest count c held by t tracks, such an order exists iff
+     * (c - 1) * (gap + 1) + t <= n; otherwise invalid_argument.
+     *
+     * Tracks are drawn with probability proportional to their plays left
+     * (a Fenwick tree over the tracks that are not waiting out their gap)
+     * while the bound above has slack. Once it has none, the rest is laid
+     * greedily, the track with most plays left first, ties at random;
+     * should that run into a dead end, the whole order is laid greedily,
+     * which cannot fail when the bound holds. O(n log m) for m tracks.
+     */
+    class spaced_order {
+        public:
+            spaced_order(std::vector<std::size_t> counts, std::size_t gap)
+                : counts_(std::move(counts)), step_(gap + 1) {
+                std::size_t top = 0;
+                std::size_t at_top = 0;
+                for (std::size_t c : counts_) {
+                    n_ += c;
+                    if (c > top) {
+                        top = c;
+                        at_top = 1;
+                    } else if (c == top && c > 0) {
+                        ++at_top;
+                    }
+                }
+                if (top > 1 && (gap >= n_
+                                || (top - 1) * step_ + at_top > n_)) {
+                    throw std::invalid_argument(
+                        "shuffle, gap too large for the plays");
+                }
+            }
+
+            template <typename Rng>
+            std::vector<std::uint32_t> operator()(Rng &rng) const {
+                state s(*this);
+                if (!draw(s, rng)) {
+                    s = state(*this);
+                    if (!greedy(s, rng)) {
+                        throw std::invalid_argument(
+                            "shuffle, gap too large for the plays");
+                    }
+                }
+                return std::move(s.order);
+            }
+
+        private:
+            std::vector<std::size_t> counts_;
+            std::size_t step_;
+            std::size_t n_ = 0;
+
+            // Plays left of every track and when it may be played again.
+            struct state {
+                std::vector<std::size_t> left;
+                std::vector<std::uint32_t> order{};
+                /* Tracks waiting out their gap, by the time they are free,
+                 * from waiting[freed] on. Times only grow, so this is a
+                 * queue; a vector with room for n takes one allocation.
+                 */
+                std::vector<std::pair<std::size_t, std::uint32_t>> waiting{};
+                std::size_t freed = 0;
+
+                explicit state(spaced_order const &o) : left(o.counts_) {
+                    order.reserve(o.n_);
+                    waiting.reserve(o.n_);
+                }
+
+                bool free_at(std::size_t pos) const noexcept {
+                    return freed < waiting.size()
+                           && waiting[freed].first <= pos;
+                }
+            };
+
+            // Sums of plays left over prefixes of free tracks.
+            class fenwick {
+                public:
+                    explicit fenwick(std::size_t m) : tree_(m + 1) {}
+
+                    void add(std::uint32_t j, std::ptrdiff_t d) noexcept {
+                        for (std::size_t i = j + std::size_t{1};
+                             i < tree_.size(); i += i & (~i + 1))
+                            tree_[i] += static_cast<std::size_t>(d);
+                        total_ += static_cast<std::size_t>(d);
+                    }
+
+                    std::size_t total() const noexcept {
+                        return total_;
+                    }
+
+                    // Track holding the x-th play, x < total().
+                    std::uint32_t find(std::size_t x) const noexcept {
+                        std::size_t at = 0;
+                        std::size_t bit = 1;
+                        while (bit * 2 < tree_.size())
+                            bit *= 2;
+                        for (; bit > 0; bit /= 2) {
+                            if (at + bit < tree_.size()
+                                && tree_[at + bit] <= x) {
+                                at += bit;
+                                x -= tree_[at];
+                            }
+                        }
+                        return static_cast<std::uint32_t>(at);
+                    }
+
+                private:
+                    std::vector<std::size_t> tree_;
+                    std::size_t total_ = 0;
+            };
+
+            // The weighted draw; false when it gives up.
+            template <typename Rng>
+            bool draw(state &s, Rng &rng) const {
+                std::size_t m = s.left.size();
+                fenwick free(m);
+                std::size_t top = 0;
+                for (std::uint32_t j = 0; j < m; ++j) {
+                    free.add(j, static_cast<std::ptrdiff_t>(s.left[j]));
+                    top = s.left[j] > top ? s.left[j] : top;
+                }
+                // Tracks by plays left, for the bound.
+                std::vector<std::size_t> with(top + 1);
+                for (std::size_t c : s.left)
+                    ++with[c];
+
+                for (std::size_t pos = 0; pos < n_; ++pos) {
+                    for (; s.free_at(pos); ++s.freed) {
+                        std::uint32_t j = s.waiting[s.freed].second;
+                        free.add(j, static_cast<std::ptrdiff_t>(s.left[j]));
+                    }
+                    if (top > 1 && (top - 1) * step_ + with[top] >= n_ - pos)
+                        return greedy(s, rng);
+                    if (free.total() == 0)
+                        return false;
+                    std::uniform_int_distribution<std::size_t> pick(
+                        0, free.total() - 1);
+                    std::uint32_t j = free.find(pick(rng));
+
+                    free.add(j, -static_cast<std::ptrdiff_t>(s.left[j]));
+                    --with[s.left[j]];
+                    ++with[--s.left[j]];
+                    while (top > 0 && with[top] == 0)
+                        --top;
+                    s.order.push_back(j);
+                    if (s.left[j] > 0)
+                        s.waiting.emplace_back(pos + step_, j);
+                }
+                return true;
+            }
+
+            /* Lays the rest of the order from state s, the track with most
+             * plays left first; false on a dead end.
+             */
+            template <typename Rng>
+            bool greedy(state &s, Rng &rng) const {
+                // Plays left, a random tie breaker, the track.
+                using entry = std::tuple<std::size_t, std::uint32_t,
+                                         std::uint32_t>;
+                std::priority_queue<entry> ready;
+                std::vector<bool> busy(s.left.size());
+                for (std::size_t i = s.freed; i < s.waiting.size(); ++i)
+                    busy[s.waiting[i].second] = true;
+                for (std::uint32_t j = 0; j < s.left.size(); ++j) {
+                    if (s.left[j] > 0 && !busy[j])
+                        ready.emplace(s.left[j],
+                                      static_cast<std::uint32_t>(rng()), j);
+                }
+
+                for (std::size_t pos = s.order.size(); pos < n_; ++pos) {
+                    for (; s.free_at(pos); ++s.freed) {
+                        std::uint32_t j = s.waiting[s.freed].second;
+                        ready.emplace(s.left[j],
+                                      static_cast<std::uint32_t>(rng()), j);
+                    }
+                    if (ready.empty())
+                        return false;
+                    std::uint32_t j = std::get<2>(ready.top());
+                    ready.pop();
+                    s.order.push_back(j);
+                    if (--s.left[j] > 0)
+                        s.waiting.emplace_back(pos + step_, j);
+                }
+                return true;
+            }
+    };
+
+} // namespace cxx
+
+#endif //PLAYLIST_SHUFFLE_H
@@ -0,0 +1,197 @@
+#ifndef PLAYLIST_STATS_H
+#define PLAYLIST_STATS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+namespace cxx {
+
+    /* Copy-on-write events of a playlist, as reported to instrumentation
+     * policies:
+     *   data_copy     - playlist data copied (detach); tracks and plays
+     *                   copied with it, plays is 0 when chunks are shared,
+     *   chunk_copy    - shared chunk of plays copied before a write,
+     *   shared_write  - modifying operation on data shared with a copy,
+     *   unique_write  - modifying operation on data not shared,
+     *   shareable_off - mutable params handed out, copies stop sharing,
+     *   shareable_on  - copies may share again.
+     * time is set for copies only.
+     */
+    enum class cow_event_kind {
+        data_copy,
+        chunk_copy,
+        shared_write,
+        unique_write,
+        shareable_off,
+        shareable_on,
+    };
+
+    struct cow_event {
+        cow_event_kind kind;
+        std::size_t tracks = 0;
+        std::size_t plays = 0;
+        std::chrono::nanoseconds time{};
+    };
+
+    // Totals of events, see cow_instrumentation.
+    struct cow_stats {
+        std::uint64_t data_copies = 0;
+        std::uint64_t deep_copies = 0;      // data copies sharing no chunk
+        std::uint64_t chunk_copies = 0;
+        std::uint64_t tracks_cloned = 0;
+        std::uint64_t plays_cloned = 0;
+        std::uint64_t clone_ns = 0;         // time of all of the copies
+        std::uint64_t shared_writes = 0;
+        std::uint64_t unique_writes = 0;
+        std::uint64_t shareable_flips = 0;
+    };
+
+    /* Memory held by the data of a playlist, in bytes, by what it is
+     * for: the play queue (links, chunk table, durations if summed, the
+     * data block itself), the track index, bookkeeping of occurrences of
+     * tracks (per-track info and links between plays of a track) and
+     * params. Chunks shared with copies count in full for each of them.
+     * owners is the number of playlists sharing the data.
+     */
+    struct memory_stats {
+        std::size_t queue = 0;
+        std::size_t index = 0;
+        std::size_t occurrences = 0;
+        std::size_t params = 0;
+        bool shared = false;
+        long owners = 0;
+
+        std::size_t total() const noexcept {
+            return queue + index + occurrences + params;
+        }
+    };
+
+    struct instrumentation_category {};
+
+    // Default policy: every hook is empty and compiles to nothing.
+    struct no_instrumentation {
+        using category = instrumentation_category;
+
+        static constexpr bool enabled = false;
+
+        static void record(cow_event const &) noexcept {}
+    };
+
+    /* Counts events of all playlists that use it, from any thread; Tag
+     * tells apart independent sets of counters. A hook, when set, is
+     * called with every event, on the thread of the playlist.
+     */
+    template <typename Tag = void>
+    struct cow_instrumentation {
+        using category = instrumentation_category;
+        using hook_type = void (*)(cow_event const &);
+
+        static constexpr bool enabled = true;
+
+        static void record(cow_event const &e) noexcept {
+            auto add = [](std::atomic<std::uint64_t> &c, std::uint64_t n) {
+                c.fetch_add(n, std::memory_order_relaxed);
+            };
+            switch (e.kind) {
+                case cow_event_kind::data_copy:
+                    add(counters_.data_copies, 1);
+                    add(counters_.deep_copies, e.plays > 0);
+                    break;
+                case cow_event_kind::chunk_copy:
+                    add(counters_.chunk_copies, 1);
+                    break;
+                case cow_event_kind::shared_write:
+                    add(counters_.shared_writes, 1);
+                    break;
+                case cow_event_kind::unique_write:
+                    add(counters_.unique_writes, 1);
+                    break;
+                case cow_event_kind::shareable_off:
+                case cow_event_kind::shareable_on:
+                    add(counters_.shareable_flips, 1);
+                    break;
+            }
+            add(counters_.tracks_cloned, e.tracks);
+            add(counters_.plays_cloned, e.plays);
+            add(counters_.clone_ns, static_cast<std::uint64_t>(e.time.count()));
+            if (hook_type hook = hook_.load(std::memory_order_acquire))
+                hook(e);
+        }
+
+        static cow_stats stats() noexcept {
+            auto get = [](std::atomic<std::uint64_t> const &c) {
+                return c.load(std::memory_order_relaxed);
+            };
+            return {get(counters_.data_copies), get(counters_.deep_copies),
+                    get(counters_.chunk_copies), get(counters_.tracks_cloned),
+                    get(counters_.plays_cloned), get(counters_.clone_ns),
+                    get(counters_.shared_writes),
+                    get(counters_.unique_writes),
+                    get(counters_.shareable_flips)};
+        }
+
+        static void reset() noexcept {
+            for (auto *c : {&counters_.data_copies, &counters_.deep_copies,
+                            &counters_.chunk_copies, &counters_.tracks_cloned,
+                            &counters_.plays_cloned, &counters_.clone_ns,
+                            &counters_.shared_writes,
+                            &counters_.unique_writes,
+                            &counters_.shareable_flips})
+                c->store(0, std::memory_order_relaxed);
+        }
+
+        // Null removes the hook.
+        static void set_hook(hook_type hook) noexcept {
+            hook_.store(hook, std::memory_order_release);
+        }
+
+        private:
+            struct counters {
+                std::atomic<std::uint64_t> data_copies{0};
+                std::atomic<std::uint64_t> deep_copies{0};
+                std::atomic<std::uint64_t> chunk_copies{0};
+                std::atomic<std::uint64_t> tracks_cloned{0};
+                std::atomic<std::uint64_t> plays_cloned{0};
+                std::atomic<std::uint64_t> clone_ns{0};
+                std::atomic<std::uint64_t> shared_writes{0};
+                std::atomic<std::uint64_t> unique_writes{0};
+                std::atomic<std::uint64_t> shareable_flips{0};
+            };
+
+            static inline counters counters_{};
+            static inline std::atomic<hook_type> hook_{nullptr};
+    };
+
+    /* Measures a copy for policy I; with instrumentation disabled it holds
+     * nothing and does nothing.
+     */
+    template <typename I>
+    class cow_timer {
+        private:
+            using clock = std::chrono::steady_clock;
+            struct none {};
+
+            [[no_unique_address]]
+            std::conditional_t<I::enabled, clock::time_point, none> start_{};
+
+        public:
+            cow_timer() noexcept {
+                if constexpr (I::enabled)
+                    start_ = clock::now();
+            }
+
+            void done(cow_event e) const noexcept {
+                if constexpr (I::enabled) {
+                    e.time = std::chrono::duration_cast<
+                        std::chrono::nanoseconds>(clock::now() - start_);
+                    I::record(e);
+                }
+            }
+    };
+
+} // namespace cxx
+
+#endif //PLAYLIST_STATS_H
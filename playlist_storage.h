@@ -0,0 +1,456 @@
+#ifndef PLAYLIST_STORAGE_H
+#define PLAYLIST_STORAGE_H
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "playlist_stats.h"
+
+namespace cxx {
+
+    // Plays and tracks are addressed by 32-bit numbers instead of pointers,
+    // so that a copy of the structure needs no pointer fixups.
+    using slot_t = std::uint32_t;
+    inline constexpr slot_t no_slot = UINT32_MAX;
+
+    // Allocator A rebound to U; containers of a playlist all come from the
+    // allocator of its policy (playlist_policies.h).
+    template <typename A, typename U>
+    using rebind_alloc_t =
+        typename std::allocator_traits<A>::template rebind_alloc<U>;
+
+    // Makes room for n elements, growing geometrically like push_back
+    // does - plain reserve(size() + 1) in a loop would be quadratic.
+    template <typename V>
+    void reserve_at_least(V &v, std::size_t n) {
+        if (v.capacity() < n)
+            v.reserve(std::max(n, 2 * v.capacity()));
+    }
+
+    /* Links of a single play: neighbours in the play queue, neighbours
+     * among plays of the same track and the track itself.
+     */
+    struct play_link {
+        slot_t prev;
+        slot_t next;
+        slot_t occ_prev;
+        slot_t occ_next;
+        std::uint32_t track;
+    };
+
+    /* Params that carry no information: every object is the same, so one
+     * per chunk is enough (std::monostate, empty tag structs).
+     */
+    template <typename P>
+    concept stateless_params = std::is_empty_v<P>
+                               && std::is_trivially_copyable_v<P>
+                               && std::is_default_constructible_v<P>;
+
+    // Storage of params of K slots, constructed only in occupied slots.
+    template <typename P, std::size_t K>
+    struct params_block {
+        alignas(P) unsigned char raw[K][sizeof(P)];
+
+        P *get(std::size_t i) noexcept {
+            return std::launder(reinterpret_cast<P *>(raw[i]));
+        }
+    };
+
+    // Stateless params take no space: all slots share a single object.
+    template <typename P, std::size_t K>
+        requires stateless_params<P>
+    struct params_block<P, K> {
+        [[no_unique_address]] P value{};
+
+        P *get(std::size_t) noexcept {
+            return &value;
+        }
+    };
+
+    // Tag of the copy constructor of play_slab that shares nothing.
+    struct deep_copy_t {
+        explicit deep_copy_t() = default;
+    };
+
+    inline constexpr deep_copy_t deep_copy{};
+
+    /* Slab of plays: fixed size chunks of K slots, each holding an array
+     * of links and an array of (possibly unconstructed) params. Chunks
+     * never move, so references to params stay valid until the play is
+     * removed. Free slots are chained through play_link::next.
+     *
+     * Stateless params (see above) are not stored per slot at all.
+     *
+     * K = 1 gives one allocation per play, like a linked list. Chunks come
+     * from a default constructed Alloc.
+     *
+     * Chunks are reference counted and shared by copies of a slab, so a
+     * copy costs one pointer per chunk. A chunk is copied on the first
+     * write through a slab that shares it: own(s) has to be called for
+     * every slot whose links or params are about to change, before
+     * anything is changed (it may throw, but changes nothing visible).
+     * Copying a chunk is a memcpy with trivially copyable P, otherwise
+     * params of the occupied slots are copy constructed one by one. With
+     * Atomic the counts are atomic, so slabs sharing chunks may live on
+     * different threads. Copies of chunks are reported to Instr.
+     */
+    template <typename P, std::size_t K = 64,
+              typename Alloc = std::allocator<P>, bool Atomic = true,
+              typename Instr = no_instrumentation>
+    class play_slab {
+        static_assert(std::has_single_bit(K),
+                      "chunk size has to be a power of two");
+
+        private:
+            static constexpr std::size_t words = (K + 63) / 64;
+
+            static constexpr bool stateless = stateless_params<P>;
+
+            struct body {
+                play_link links[K];
+                std::uint64_t used[words];
+                [[no_unique_address]] params_block<P, K> params;
+            };
+
+            struct chunk {
+                body data;
+                std::conditional_t<Atomic, std::atomic<long>, long> refs;
+
+                // Leaves data uninitialised.
+                chunk() noexcept : refs(1) {}
+            };
+
+            using chunk_alloc = rebind_alloc_t<Alloc, chunk>;
+            using chunk_traits = std::allocator_traits<chunk_alloc>;
+
+            std::vector<chunk *, rebind_alloc_t<Alloc, chunk *>> chunks_{};
+            slot_t free_ = no_slot;
+            slot_t top_ = 0;            // slots ever handed out
+            std::size_t size_ = 0;      // occupied slots
+
+            static std::uint64_t bit(std::size_t i) noexcept {
+                return std::uint64_t{1} << (i % 64);
+            }
+
+            static bool is_used(body const &b, std::size_t i) noexcept {
+                return b.used[i / 64] >> (i % 64) & 1;
+            }
+
+            static P *params_of(body &b, std::size_t i) noexcept {
+                return b.params.get(i);
+            }
+
+            // Chunk with no slot in use.
+            static chunk *new_chunk() {
+                chunk_alloc a;
+                chunk *c = chunk_traits::allocate(a, 1);
+                ::new (static_cast<void *>(c)) chunk;
+                std::fill_n(c->data.used, words, 0);
+                return c;
+            }
+
+            // Destroys params of occupied slots and frees the chunk.
+            static void free_chunk(chunk *c) noexcept {
+                if constexpr (!std::is_trivially_destructible_v<P>
+                              && !stateless) {
+                    for (std::size_t i = 0; i < K; ++i) {
+                        if (is_used(c->data, i))
+                            params_of(c->data, i)->~P();
+                    }
+                }
+                c->~chunk();
+                chunk_alloc a;
+                chunk_traits::deallocate(a, c, 1);
+            }
+
+            static chunk *clone(chunk const &from) {
+                chunk *c = new_chunk();
+                if constexpr (std::is_trivially_copyable_v<P>) {
+                    c->data = from.data;
+                } else {
+                    std::copy_n(from.data.links, K, c->data.links);
+                    // used bits follow constructed params, so that a
+                    // failed copy is cleaned up like any chunk.
+                    try {
+                        for (std::size_t i = 0; i < K; ++i) {
+                            if (is_used(from.data, i)) {
+                                ::new (c->data.params.get(i)) P(*params_of(
+                                    const_cast<body &>(from.data), i));
+                                c->data.used[i / 64] |= bit(i);
+                            }
+                        }
+                    } catch (...) {
+                        free_chunk(c);
+                        throw;
+                    }
+                }
+                return c;
+            }
+
+            static void retain(chunk &c) noexcept {
+                if constexpr (Atomic)
+                    c.refs.fetch_add(1, std::memory_order_relaxed);
+                else
+                    ++c.refs;
+            }
+
+            static void drop(chunk *c) noexcept {
+                if constexpr (Atomic) {
+                    if (c->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                        free_chunk(c);
+                } else if (--c->refs == 0) {
+                    free_chunk(c);
+                }
+            }
+
+            static bool shared(chunk const &c) noexcept {
+                if constexpr (Atomic)
+                    return c.refs.load(std::memory_order_acquire) > 1;
+                else
+                    return c.refs > 1;
+            }
+
+            void drop_all() noexcept {
+                for (chunk *c : chunks_)
+                    drop(c);
+                chunks_.clear();
+            }
+
+        public:
+            static constexpr std::size_t chunk_size = K;
+            static constexpr std::size_t chunk_bytes = sizeof(chunk);
+            // Part of a chunk taken by params.
+            static constexpr std::size_t params_bytes =
+                stateless ? 0 : sizeof(params_block<P, K>);
+
+            play_slab() = default;
+
+            // Shares all chunks with other.
+            play_slab(play_slab const &other)
+                : chunks_(other.chunks_), free_(other.free_),
+                  top_(other.top_), size_(other.size_) {
+                for (chunk *c : chunks_)
+                    retain(*c);
+            }
+
+            // Copies all chunks, for copies that must not share anything.
+            play_slab(play_slab const &other, deep_copy_t)
+                : free_(other.free_), top_(other.top_), size_(other.size_) {
+                chunks_.reserve(other.chunks_.size());
+                try {
+                    for (chunk const *c : other.chunks_)
+                        chunks_.push_back(clone(*c));
+                } catch (...) {
+                    drop_all();
+                    throw;
+                }
+            }
+
+            play_slab(play_slab &&other) noexcept
+                : chunks_(std::move(other.chunks_)), free_(other.free_),
+                  top_(other.top_), size_(other.size_) {
+                other.chunks_.clear();
+                other.free_ = no_slot;
+                other.top_ = 0;
+                other.size_ = 0;
+            }
+
+            play_slab & operator=(play_slab const &) = delete;
+
+            ~play_slab() {
+                drop_all();
+            }
+
+            /* Makes the chunk of slot s private to this slab, copying it
+             * when it is shared. Strong guarantee.
+             */
+            void own(slot_t s) {
+                chunk *&c = chunks_[s / K];
+                if (shared(*c)) {
+                    cow_timer<Instr> timer;
+                    chunk *copy = clone(*c);
+                    drop(c);
+                    c = copy;
+                    std::size_t plays = 0;
+                    for (std::uint64_t w : copy->data.used)
+                        plays += std::popcount(w);
+                    timer.done({cow_event_kind::chunk_copy, 0, plays});
+                }
+            }
+
+            // Writable links; the chunk of s has to be owned.
+            play_link &link(slot_t s) noexcept {
+                return chunks_[s / K]->data.links[s % K];
+            }
+
+            play_link const &link(slot_t s) const noexcept {
+                return chunks_[s / K]->data.links[s % K];
+            }
+
+            // Writable params; the chunk of s has to be owned.
+            P &params(slot_t s) noexcept {
+                return *params_of(chunks_[s / K]->data, s % K);
+            }
+
+            P const &params(slot_t s) const noexcept {
+                return *params_of(chunks_[s / K]->data, s % K);
+            }
+
+            // Makes every chunk private, see own.
+            void own_all() {
+                for (std::size_t c = 0; c < chunks_.size(); ++c)
+                    own(static_cast<slot_t>(c * K));
+            }
+
+            /* Room for splice(other): the table of chunks, and our last
+             * chunk owned, as its slots never handed out go to the free
+             * list. Strong guarantee.
+             */
+            void reserve_splice(play_slab const &other) {
+                if (chunks_.size() * K + other.top_ >= no_slot)
+                    throw std::length_error("playlist, too many plays");
+                // One more, so that allocate still grows the table ahead.
+                reserve_at_least(chunks_,
+                                 chunks_.size() + other.chunks_.size() + 1);
+                if (top_ % K != 0)
+                    own(top_);
+            }
+
+            /* Moves all chunks of other, which have to be owned, behind
+             * ours; other is left empty. Slot s of other becomes s + the
+             * returned offset: links are renumbered in place, and fix(l)
+             * is called for links of every play moved, to renumber what
+             * the slab does not know about (play_link::track). Room made
+             * by reserve_splice.
+             */
+            template <typename Fix>
+            slot_t splice(play_slab &other, Fix &&fix) noexcept {
+                slot_t off = static_cast<slot_t>(chunks_.size() * K);
+                auto shift = [off](slot_t &s) {
+                    if (s != no_slot)
+                        s += off;
+                };
+                for (; top_ < off; ++top_) {
+                    link(top_).next = free_;
+                    free_ = top_;
+                }
+                for (slot_t s = 0; s < other.top_; ++s) {
+                    body &b = other.chunks_[s / K]->data;
+                    play_link &l = b.links[s % K];
+                    if (!is_used(b, s % K)) {
+                        // Free lists are joined: ours follows theirs.
+                        l.next = l.next == no_slot ? free_ : l.next + off;
+                        continue;
+                    }
+                    shift(l.prev);
+                    shift(l.next);
+                    shift(l.occ_prev);
+                    shift(l.occ_next);
+                    fix(l);
+                }
+                chunks_.insert(chunks_.end(), other.chunks_.begin(),
+                               other.chunks_.end());
+                if (other.free_ != no_slot)
+                    free_ = other.free_ + off;
+                top_ = off + other.top_;
+                size_ += other.size_;
+
+                other.chunks_.clear();
+                other.free_ = no_slot;
+                other.top_ = 0;
+                other.size_ = 0;
+                return off;
+            }
+
+            /* Takes a free slot and constructs params in it from p (a copy
+             * or, for an rvalue, a move), links are left for the caller to
+             * fill. Strong guarantee, if moving P cannot throw.
+             */
+            template <typename Q>
+            slot_t allocate(Q &&p) {
+                slot_t s = free_;
+                bool fresh = s == no_slot;
+                if (fresh) {
+                    if (top_ == no_slot)
+                        throw std::length_error("playlist, too many plays");
+                    s = top_;
+                    if (s / K == chunks_.size()) {
+                        reserve_at_least(chunks_, chunks_.size() + 1);
+                        chunks_.push_back(new_chunk());
+                    } else if (s % K == K / 2
+                               && chunks_.size() == chunks_.capacity()) {
+                        // The table of chunks grows half a chunk ahead, so
+                        // that no single call allocates twice.
+                        reserve_at_least(chunks_, chunks_.size() + 1);
+                    }
+                }
+                // If this throws, a chunk added or copied above stays for
+                // later use.
+                own(s);
+                body &b = chunks_[s / K]->data;
+                if constexpr (!stateless)
+                    ::new (b.params.get(s % K)) P(std::forward<Q>(p));
+                if (fresh)
+                    ++top_;
+                else
+                    free_ = b.links[s % K].next;
+                b.used[s % K / 64] |= bit(s % K);
+                ++size_;
+                return s;
+            }
+
+            /* Destroys params of the slot and returns it to the free list;
+             * the chunk of s has to be owned.
+             */
+            void release(slot_t s) noexcept {
+                body &b = chunks_[s / K]->data;
+                if constexpr (!stateless)
+                    params_of(b, s % K)->~P();
+                b.used[s % K / 64] &= ~bit(s % K);
+                if (--size_ == 0) {
+                    // Nothing left, give the memory back.
+                    drop_all();
+                    free_ = no_slot;
+                    top_ = 0;
+                    return;
+                }
+                b.links[s % K].next = free_;
+                free_ = s;
+            }
+
+            std::size_t size() const noexcept {
+                return size_;
+            }
+
+            // One more than the greatest slot allocate may hand out next.
+            std::size_t slot_bound() const noexcept {
+                return std::size_t{top_} + 1;
+            }
+
+            // Bytes held by chunks, shared ones included.
+            std::size_t capacity_bytes() const noexcept {
+                return chunks_.size() * sizeof(chunk);
+            }
+
+            std::size_t chunk_count() const noexcept {
+                return chunks_.size();
+            }
+
+            // Bytes of the table of chunks.
+            std::size_t table_bytes() const noexcept {
+                return chunks_.capacity() * sizeof(chunk *);
+            }
+    };
+
+} // namespace cxx
+
+#endif //PLAYLIST_STORAGE_H
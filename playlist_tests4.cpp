@@ -0,0 +1,1996 @@
+#include "playlist.h"
+#include "playlist_view.h"
+#include "playlist_log.h"
+#include "playlist_journal.h"
+#include "playlist_checkpoint.h"
+#include "packed_params.h"
+
+#ifdef NDEBUG
+#  undef NDEBUG
+#endif
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <random>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// ======================== Narzędzia testowe ========================
+
+using params_t = std::pair<unsigned, unsigned>;
+using int_playlist_t = cxx::playlist<int, params_t>;
+using str_playlist_t = cxx::playlist<std::string, params_t>;
+
+// Porównuje kolejkę odtworzeń i liczniki dwóch plejlist.
+template <typename T, typename P, typename... Policies>
+static bool same_content(cxx::playlist<T, P, Policies...> const &a,
+                         cxx::playlist<T, P, Policies...> const &b) {
+    if (a.size() != b.size())
+        return false;
+    auto ia = a.play_begin();
+    auto ib = b.play_begin();
+    for (; ia != a.play_end(); ++ia, ++ib) {
+        if (a.play(ia).first != b.play(ib).first
+            || a.play(ia).second != b.play(ib).second)
+            return false;
+    }
+    auto sa = a.sorted_begin();
+    auto sb = b.sorted_begin();
+    for (; sa != a.sorted_end(); ++sa, ++sb) {
+        if (sb == b.sorted_end() || a.pay(sa) != b.pay(sb))
+            return false;
+    }
+    return sb == b.sorted_end();
+}
+
+template <typename T, typename P, typename... Policies>
+static cxx::playlist<T, P, Policies...>
+roundtrip(cxx::playlist<T, P, Policies...> const &pl) {
+    std::stringstream ss;
+    pl.serialize(ss);
+    return cxx::playlist<T, P, Policies...>::deserialize(ss);
+}
+
+// Ścieżka pliku tymczasowego, unikalna dla procesu.
+static std::string temp_path(std::string const &name) {
+    return "/tmp/playlist_tests4_" + std::to_string(::getpid()) + "_" + name;
+}
+
+template <typename T, typename P>
+static void save(cxx::playlist<T, P> const &pl, std::string const &path) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    pl.serialize(out);
+}
+
+// ======================== TESTY ========================
+
+// 01: zapis i odczyt binarny zachowuje kolejkę, parametry i liczniki
+void test_01_serialize_roundtrip() {
+    std::clog << "[01] serialize roundtrip\n";
+    int_playlist_t pl;
+    for (unsigned i = 0; i < 1000; ++i)
+        pl.push_back(static_cast<int>(i * 7919 % 13) - 6, {i, i + 1});
+
+    int_playlist_t loaded = roundtrip(pl);
+    assert(same_content(pl, loaded));
+
+    // Odtworzony indeks działa jak zwykły.
+    loaded.remove(0);
+    pl.remove(0);
+    assert(same_content(pl, loaded));
+
+    int_playlist_t empty;
+    assert(roundtrip(empty).size() == 0);
+}
+
+// 02: utwory o zmiennej długości trafiają do słownika z offsetami
+void test_02_serialize_strings() {
+    std::clog << "[02] serialize strings\n";
+    str_playlist_t pl;
+    pl.push_back("trzecie", {0, 3});
+    pl.push_back("", {0, 0});
+    pl.push_back("pierwsze", {0, 1});
+    pl.push_back("trzecie", {17, 52});
+
+    str_playlist_t loaded = roundtrip(pl);
+    assert(same_content(pl, loaded));
+    assert(loaded.pay(loaded.sorted_begin()).first.empty());
+}
+
+// 03: uszkodzone dane są odrzucane wyjątkiem
+void test_03_deserialize_rejects_garbage() {
+    std::clog << "[03] deserialize rejects garbage\n";
+    int_playlist_t pl;
+    pl.push_back(1, {1, 1});
+    pl.push_back(2, {2, 2});
+    std::stringstream ss;
+    pl.serialize(ss);
+    std::string bytes = ss.str();
+
+    auto fails = [](std::string const &data) {
+        std::stringstream in(data);
+        try {
+            (void) int_playlist_t::deserialize(in);
+        } catch (std::runtime_error const &) {
+            return true;
+        }
+        return false;
+    };
+
+    std::string bad_magic = bytes;
+    bad_magic[0] = 'X';
+    assert(fails(bad_magic));
+    assert(fails(bytes.substr(0, bytes.size() - 1)));
+
+    // Inny typ parametrów nie pasuje do nagłówka.
+    std::stringstream in(bytes);
+    bool thrown = false;
+    try {
+        (void) cxx::playlist<int, int>::deserialize(in);
+    } catch (std::runtime_error const &) {
+        thrown = true;
+    }
+    assert(thrown);
+
+    // Spójny nagłówek z ogromną liczbą odtworzeń lub utworów na krótkim
+    // strumieniu: runtime_error, a nie bad_alloc przy rezerwacji pamięci.
+    auto inflated = [](std::string data, std::uint64_t tracks,
+                       std::uint64_t plays) {
+        auto h = cxx::format::from_bytes<cxx::format::header>(data.data());
+        h.track_count = tracks;
+        h.play_count = plays;
+        if (!(h.flags & cxx::format::inline_tracks))
+            h.dict_size = (tracks + 1) * sizeof(std::uint64_t);
+        else
+            h.dict_size = tracks * h.track_size;
+        cxx::format::layout(h, plays * h.params_size);
+        std::memcpy(data.data(), &h, sizeof(h));
+        return data;
+    };
+    assert(fails(inflated(bytes, 2, UINT32_MAX)));
+    assert(fails(inflated(bytes, UINT32_MAX, 2)));
+    str_playlist_t spl;
+    spl.push_back("a", {1, 1});
+    std::stringstream sss;
+    spl.serialize(sss);
+    for (auto [tracks, plays] : {std::pair<std::uint64_t, std::uint64_t>
+                                     {1, UINT32_MAX}, {UINT32_MAX, 1}}) {
+        std::stringstream sin(inflated(sss.str(), tracks, plays));
+        thrown = false;
+        try {
+            (void) str_playlist_t::deserialize(sin);
+        } catch (std::runtime_error const &) {
+            thrown = true;
+        }
+        assert(thrown);
+    }
+}
+
+// 04: widok zmapowanego pliku odpowiada zapisanej plejliście
+void test_04_view_matches_playlist() {
+    std::clog << "[04] mapped view\n";
+    str_playlist_t pl;
+    for (unsigned i = 0; i < 500; ++i)
+        pl.push_back("utwor" + std::to_string(i % 17), {i, 2 * i});
+    std::string path = temp_path("view");
+    save(pl, path);
+
+    cxx::playlist_view<std::string, params_t> view(path);
+    assert(view.size() == pl.size());
+    auto it = pl.play_begin();
+    for (auto vit = view.play_begin(); vit != view.play_end(); ++vit, ++it) {
+        assert(view.play(vit).first == pl.play(it).first);
+        assert(view.play(vit).second == pl.play(it).second);
+    }
+    assert(it == pl.play_end());
+
+    auto sit = pl.sorted_begin();
+    for (auto vit = view.sorted_begin(); vit != view.sorted_end(); ++vit) {
+        assert(view.pay(vit).first == pl.pay(sit).first);
+        assert(view.pay(vit).second == pl.pay(sit).second);
+        ++sit;
+    }
+    assert(sit == pl.sorted_end());
+    assert(view.front().first == "utwor0");
+
+    // Utwory stałego rozmiaru są czytane wprost ze zmapowanych stron.
+    int_playlist_t ints;
+    ints.push_back(5, {1, 2});
+    ints.push_back(3, {3, 4});
+    save(ints, path);
+    cxx::playlist_view<int, params_t> iview(path);
+    assert(iview.pay(iview.sorted_begin()).first == 3);
+    assert(iview.front().second == params_t(1, 2));
+
+    std::remove(path.c_str());
+    cxx::playlist_view<int, params_t> empty;
+    assert(empty.play_begin() == empty.play_end());
+}
+
+// 05: dziennik odtworzeń ładowany bez kopiowania nazw utworów
+void test_05_load_play_log() {
+    std::clog << "[05] zero-copy play log loader\n";
+    std::string path = temp_path("log");
+    {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out << "# Odtwarzamy pierwszy raz.\n"
+            << "zerowe 0:0\n"
+            << "pierwsze 0:1\r\n"
+            << "\n"
+            << "drugie utwory 0:2\n"
+            << "pierwsze 17:52";
+    }
+
+    cxx::playlist<std::string_view, params_t> copy;
+    {
+        auto pl = cxx::load_play_log(path);
+        assert(pl.size() == 4);
+        assert(pl.front().first == "zerowe");
+        copy = pl;
+    }
+    // Plik usunięty, a plejlista nadal trzyma zmapowany bufor.
+    std::remove(path.c_str());
+    auto it = copy.play_begin();
+    assert(copy.play(it).second == params_t(0, 0));
+    assert(copy.play(++it).first == "pierwsze");
+    assert(copy.play(++it).first == "drugie utwory");
+    assert(copy.play(++it).second == params_t(17, 52));
+    assert(copy.pay(copy.sorted_begin()).first == "drugie utwory");
+
+    // Utwory typu string_view wracają z formatu binarnego razem z buforem.
+    auto loaded = roundtrip(copy);
+    copy.clear();
+    assert(loaded.pay(++loaded.sorted_begin()).second == 2);
+
+    // keep_alive na kopii nie dotyka danych współdzielonych z oryginałem.
+    auto marker = std::make_shared<int>(0);
+    auto other = loaded;
+    other.keep_alive(marker);
+    other.clear();
+    assert(marker.use_count() == 1);
+
+    std::string bad = "zerowe 0:0\nbez_parametrow\n";
+    bool thrown = false;
+    try {
+        cxx::play_window_parser parse;
+        cxx::parse_play_log<params_t>(bad, parse,
+            [](std::string_view, params_t const &) {});
+    } catch (std::invalid_argument const &) {
+        thrown = true;
+    }
+    assert(thrown);
+}
+
+static void copy_file(std::string const &from, std::string const &to) {
+    std::ifstream in(from, std::ios::binary);
+    std::ofstream out(to, std::ios::binary | std::ios::trunc);
+    out << in.rdbuf();
+}
+
+// 06: dziennik zmian odtwarza plejlistę po awarii
+void test_06_journal_recovery() {
+    std::clog << "[06] journal recovery\n";
+    using journal_t = cxx::playlist_journal<std::string, params_t>;
+    std::string jpath = temp_path("journal");
+    std::string cpath = temp_path("checkpoint");
+    std::string saved = temp_path("journal_saved");
+
+    str_playlist_t live;
+    {
+        journal_t j(jpath, {.commit_bytes = 256, .sync_every = 4});
+        for (unsigned i = 0; i < 100; ++i)
+            j.push_back(live, "t" + std::to_string(i % 7), {i, i});
+        j.pop_front(live);
+        j.remove(live, "t3");
+        j.params(live, 5, {77, 78});
+
+        // Nieudana operacja nie trafia do dziennika.
+        bool thrown = false;
+        try {
+            j.remove(live, "brak");
+        } catch (std::invalid_argument const &) {
+            thrown = true;
+        }
+        assert(thrown);
+        assert(j.last_sequence() == 103);
+    }
+    assert(same_content(live, journal_t::recover(cpath, jpath)));
+
+    // Urwany ostatni rekord jest pomijany, a dziennik daje się dalej pisać.
+    {
+        std::ofstream out(jpath, std::ios::binary | std::ios::app);
+        out << "\x20\x00\x00\x00garbage";
+    }
+    {
+        journal_t j(jpath);
+        assert(j.last_sequence() == 103);
+        j.checkpoint(live, cpath);
+        j.push_back(live, "po", {1, 2});
+        j.clear(live);
+        j.push_back(live, "nowe", {3, 4});
+        j.commit();
+        copy_file(jpath, saved);
+        j.checkpoint(live, cpath);
+        j.pop_front(live);
+    }
+    assert(same_content(live, journal_t::recover(cpath, jpath)));
+
+    // Awaria między zapisem punktu kontrolnego a obcięciem dziennika:
+    // rekordy objęte punktem kontrolnym są pomijane.
+    str_playlist_t expected = journal_t::recover(cpath, jpath);
+    copy_file(saved, jpath);
+    {
+        journal_t j(jpath);
+        str_playlist_t tmp = journal_t::recover(cpath, jpath);
+        j.pop_front(tmp);
+    }
+    assert(same_content(expected, journal_t::recover(cpath, jpath)));
+    assert(same_content(live, expected));
+
+    {
+        // Numeracja po ponownym otwarciu ciągnie się za punktem kontrolnym.
+        journal_t j(jpath);
+        assert(j.last_sequence() == 107);
+        j.checkpoint(live, cpath);
+    }
+    {
+        journal_t j(jpath);
+        j.push_back(live, "ostatnie", {5, 6});
+    }
+    assert(same_content(live, journal_t::recover(cpath, jpath)));
+
+    std::remove(jpath.c_str());
+    std::remove(cpath.c_str());
+    std::remove(saved.c_str());
+
+    // Seria zmian parametrów, po kolei i na wyrywki, przeplatana innymi
+    // rekordami. Po odtworzeniu plejlista i jej kopia współdzielą dane.
+    // Kopie (migawki) zmuszają zapis do odłączenia danych, a kursor
+    // dziennika musi trafiać w tę samą pozycję także po odłączeniu.
+    str_playlist_t edited, plain;
+    {
+        journal_t j(jpath);
+        for (unsigned i = 0; i < 300; ++i) {
+            j.push_back(edited, "t" + std::to_string(i % 13), {i, i});
+            plain.push_back("t" + std::to_string(i % 13), {i, i});
+        }
+        auto set = [&](std::size_t at, params_t value) {
+            j.params(edited, at, value);
+            auto it = plain.play_begin();
+            for (std::size_t k = 0; k < at; ++k)
+                ++it;
+            plain.params(it) = value;
+        };
+        std::deque<str_playlist_t> snapshots;
+        std::mt19937 rng(6);
+        std::size_t pos = 0;
+        for (unsigned i = 0; i < 2000; ++i) {
+            switch (rng() % 12) {
+                case 0:
+                    j.pop_front(edited);
+                    plain.pop_front();
+                    break;
+                case 1:
+                    j.push_back(edited, "n" + std::to_string(i % 5), {i, i});
+                    plain.push_back("n" + std::to_string(i % 5), {i, i});
+                    break;
+                case 2:
+                    pos = rng() % edited.size();
+                    set(pos, {i, i + 1});
+                    break;
+                case 3:
+                    snapshots.push_back(edited);
+                    if (snapshots.size() > 3)
+                        snapshots.pop_front();
+                    break;
+                default:
+                    pos = (pos + 1) % edited.size();
+                    set(pos, {i, i + 2});
+            }
+        }
+        assert(same_content(edited, plain));
+    }
+    str_playlist_t recovered = journal_t::recover(cpath, jpath);
+    assert(same_content(edited, recovered));
+    for (str_playlist_t const *pl : {&edited, &recovered}) {
+        str_playlist_t copy = *pl;
+        assert(&copy.play(copy.play_begin()).second
+               == &pl->play(pl->play_begin()).second);
+    }
+    std::remove(jpath.c_str());
+
+    // Awaria w trakcie zapisu nagłówka: krótki plik to pusty dziennik.
+    {
+        std::ofstream out(jpath, std::ios::binary | std::ios::trunc);
+        out << "CXXJ";
+    }
+    assert(journal_t::recover(cpath, jpath).size() == 0);
+    str_playlist_t fresh;
+    {
+        journal_t j(jpath);
+        assert(j.last_sequence() == 0);
+        j.push_back(fresh, "a", {1, 2});
+    }
+    assert(same_content(fresh, journal_t::recover(cpath, jpath)));
+    std::remove(jpath.c_str());
+
+    // Nieudany zapis pełnego bufora zgłasza operacja, która się nie
+    // wykonała; ponowienie nie dubluje ani odtworzenia, ani rekordu.
+    str_playlist_t retried;
+    {
+        journal_t j(jpath, {.commit_bytes = 256, .sync_every = 0});
+        while (j.last_sequence() < 100)
+            j.push_back(retried, "r", {1, 1});
+        j.commit();
+        for (unsigned i = 0; ; ++i) {
+            // Dziennik nie może już rosnąć: ten zapis bufora się nie uda.
+            struct stat st;
+            ::stat(jpath.c_str(), &st);
+            struct rlimit old_limit, limit;
+            ::getrlimit(RLIMIT_FSIZE, &old_limit);
+            limit = old_limit;
+            limit.rlim_cur = st.st_size;
+            auto old_handler = ::signal(SIGXFSZ, SIG_IGN);
+            ::setrlimit(RLIMIT_FSIZE, &limit);
+            std::size_t size = retried.size();
+            bool thrown = false;
+            try {
+                j.push_back(retried, "s" + std::to_string(i), {2, 2});
+            } catch (std::system_error const &) {
+                thrown = true;
+            }
+            ::setrlimit(RLIMIT_FSIZE, &old_limit);
+            ::signal(SIGXFSZ, old_handler);
+            if (thrown) {
+                assert(retried.size() == size);
+                j.push_back(retried, "s" + std::to_string(i), {2, 2});
+                break;
+            }
+        }
+    }
+    assert(same_content(retried, journal_t::recover(cpath, jpath)));
+    std::remove(jpath.c_str());
+}
+
+// 07: punkty kontrolne w tle zapisują tylko zmienione fragmenty
+void test_07_incremental_checkpoint() {
+    std::clog << "[07] incremental background checkpoint\n";
+    using checkpointer_t = cxx::playlist_checkpointer<int, params_t>;
+    std::string path = temp_path("ckpt");
+
+    int_playlist_t live;
+    for (unsigned i = 0; i < 200000; ++i)
+        live.push_back(static_cast<int>(i % 1000), {i, i + 180});
+    {
+        checkpointer_t ckpt(path, {.average_chunk = 1 << 12});
+        ckpt.submit(live, 1);
+        // Kopia żywej plejlisty odłącza się od migawki zapisywanej w tle.
+        for (int i = 0; i < 100; ++i)
+            live.pop_front();
+        live.push_back(5, {1, 2});
+        ckpt.wait();
+        auto [image, written] = ckpt.last_written();
+        assert(written > 0 && written <= image);
+
+        ckpt.submit(live, 2);
+        ckpt.wait();
+        std::tie(image, written) = ckpt.last_written();
+        assert(written * 10 < image);
+    }
+    cxx::serialize_options opts;
+    assert(same_content(live, checkpointer_t::load(path, &opts)));
+    assert(opts.sequence == 2);
+
+    // Nowy proces kontynuuje na istniejącej paczce fragmentów.
+    {
+        checkpointer_t ckpt(path);
+        live.remove(7);
+        ckpt.submit(live, 3);
+    }
+    assert(same_content(live, checkpointer_t::load(path)));
+
+    // Liczba fragmentów, której iloczyn się przekręca, nie wychodzi poza
+    // manifest.
+    {
+        std::fstream f(path, std::ios::binary | std::ios::in | std::ios::out);
+        f.seekg(offsetof(cxx::checkpoint_format::header, chunk_count));
+        std::uint64_t count;
+        f.read(reinterpret_cast<char *>(&count), sizeof(count));
+        count += std::uint64_t{1} << 59;
+        f.seekp(offsetof(cxx::checkpoint_format::header, chunk_count));
+        f.write(reinterpret_cast<char const *>(&count), sizeof(count));
+    }
+    try {
+        checkpointer_t::load(path);
+        assert(false);
+    } catch (std::runtime_error const &) {}
+    {
+        checkpointer_t ckpt(path);
+        ckpt.submit(live, 4);
+    }
+    assert(same_content(live, checkpointer_t::load(path)));
+
+    std::remove(path.c_str());
+    std::remove((path + ".pack.0").c_str());
+    std::remove((path + ".pack.1").c_str());
+}
+
+// 08: spakowane parametry zajmują mniej miejsca i odczytują się bez zmian
+void test_08_packed_params() {
+    std::clog << "[08] packed params\n";
+    int_playlist_t pl;
+    for (unsigned i = 0; i < 10000; ++i)
+        pl.push_back(static_cast<int>(i % 37), {i * 3, i * 3 + 180});
+    pl.push_back(1, {0, UINT_MAX});
+
+    std::stringstream raw, packed;
+    pl.serialize(raw);
+    pl.serialize(packed, {.pack_params = true});
+    // Kolumna parametrów kurczy się ponad dwukrotnie.
+    assert(raw.str().size() - packed.str().size()
+           > pl.size() * sizeof(params_t) / 2);
+
+    cxx::serialize_options opts;
+    assert(same_content(pl, int_playlist_t::deserialize(packed, &opts)));
+    assert(opts.pack_params);
+
+    std::string path = temp_path("packed");
+    {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        pl.serialize(out, {.pack_params = true});
+    }
+    cxx::playlist_view<int, params_t> view(path);
+    auto it = pl.play_begin();
+    for (auto vit = view.play_begin(); vit != view.play_end(); ++vit, ++it)
+        assert(view.params(vit) == pl.play(it).second);
+    std::remove(path.c_str());
+
+    // Kolumna w pamięci, także z bajtowymi pasami (rozmiar niepodzielny
+    // przez 4) i niepełnym ostatnim blokiem.
+    using rgb = std::array<unsigned char, 3>;
+    std::vector<rgb> colors;
+    cxx::packed_params<params_t> windows;
+    for (unsigned i = 0; i < 10000; ++i) {
+        colors.push_back({static_cast<unsigned char>(i),
+                          static_cast<unsigned char>(i * 31), 7});
+        windows.push_back({i, i + 30});
+    }
+    cxx::packed_params<rgb> packed_colors(colors.begin(), colors.end());
+    assert(packed_colors.size() == colors.size());
+    for (std::size_t i = 0; i < colors.size(); ++i) {
+        assert(packed_colors[i] == colors[i]);
+        assert(windows[i] == params_t(i, i + 30));
+    }
+    windows.shrink_to_fit();
+    assert(windows.memory_bytes() * 3 < windows.size() * sizeof(params_t));
+}
+
+// 09: puste parametry nie zajmują miejsca w odtworzeniach
+void test_09_empty_params() {
+    std::clog << "[09] empty params\n";
+    using order_t = cxx::playlist<int, std::monostate>;
+    static_assert(cxx::play_slab<std::monostate>::chunk_bytes
+                  < cxx::play_slab<char>::chunk_bytes);
+
+    order_t pl;
+    for (int i = 0; i < 1000; ++i)
+        pl.push_back(i % 10);
+    pl.push_back(3, {});
+    assert(pl.size() == 1001);
+    assert(pl.track(pl.play_begin()) == 0);
+    assert(pl.pay(pl.sorted_begin()).second == 100);
+
+    order_t copy = pl;
+    (void) copy.params(copy.play_begin());
+    copy.remove(3);
+    assert(copy.size() == 900 && pl.size() == 1001);
+    pl.pop_front();
+    assert(pl.track(pl.play_begin()) == 1);
+}
+
+// Losowe operacje na plejliście i na prostym modelu, po każdej porównanie.
+template <typename T, typename... Policies, typename Gen>
+static void check_against_model(Gen &&gen, unsigned steps) {
+    using playlist_t = cxx::playlist<T, unsigned, Policies...>;
+    std::mt19937 rng(7);
+    playlist_t pl;
+    std::deque<std::pair<T, unsigned>> queue;
+    std::map<T, std::size_t> counts;
+
+    for (unsigned step = 0; step < steps; ++step) {
+        unsigned op = rng() % 10;
+        if (op < 6 || queue.empty()) {
+            T track = gen(rng);
+            pl.push_back(track, step);
+            queue.emplace_back(track, step);
+            ++counts[track];
+        } else if (op < 8) {
+            pl.pop_front();
+            if (--counts[queue.front().first] == 0)
+                counts.erase(queue.front().first);
+            queue.pop_front();
+        } else {
+            T track = queue[rng() % queue.size()].first;
+            pl.remove(track);
+            std::erase_if(queue, [&](auto const &p) {
+                return p.first == track;
+            });
+            counts.erase(track);
+        }
+
+        if (step % 97 == 0 && !queue.empty()) {
+            playlist_t copy = pl;
+            pl.params(pl.play_begin());
+            pl = copy;
+        }
+
+        assert(pl.size() == queue.size());
+        if (!queue.empty())
+            assert(pl.front().first == queue.front().first);
+        if (step % 13 == 0 || step + 1 == steps) {
+            auto it = pl.sorted_begin();
+            for (auto const &[track, count] : counts) {
+                assert(it != pl.sorted_end());
+                assert(pl.pay(it).first == track);
+                assert(pl.pay(it).second == count);
+                ++it;
+            }
+            assert(it == pl.sorted_end());
+
+            // Kolejność po liczbie odtworzeń (z count_index).
+            if constexpr (requires { pl.top_k(0); }) {
+                auto top = pl.top_k(counts.size() + 1);
+                assert(top.size() == counts.size());
+                for (std::size_t i = 0; i < top.size(); ++i) {
+                    assert(counts.at(top[i].first) == top[i].second);
+                    assert(i == 0 || top[i - 1].second >= top[i].second);
+                }
+                std::size_t c = top.empty() ? 1
+                                            : top[top.size() / 2].second;
+                std::size_t above = std::count_if(counts.begin(),
+                    counts.end(),
+                    [&](auto const &kv) { return kv.second >= c; });
+                assert(pl.played_at_least(c).size() == above);
+            }
+
+            // Wyszukiwanie w kolejności kluczy.
+            T probe = gen(rng);
+            auto same = [&](auto it, auto mit) {
+                return mit == counts.end() ? it == pl.sorted_end()
+                                           : pl.pay(it).first == mit->first;
+            };
+            assert(same(pl.sorted_lower_bound(probe),
+                        counts.lower_bound(probe)));
+            assert(same(pl.sorted_upper_bound(probe),
+                        counts.upper_bound(probe)));
+
+            // Sumy w drzewie statystyk pozycyjnych.
+            if constexpr (requires { pl.plays_between(probe, probe); }) {
+                T to = gen(rng);
+                std::size_t sum = 0;
+                for (auto const &[track, count] : counts) {
+                    if (!(track < probe) && track < to)
+                        sum += count;
+                }
+                assert(pl.plays_between(probe, to) == sum);
+                std::size_t k = rng() % (counts.size() + 1);
+                auto nth = pl.sorted_nth(k);
+                assert(same(nth, std::next(counts.begin(), k)));
+            }
+        }
+    }
+}
+
+// 10: indeks kluczy całkowitych, w trybie gęstym i rzadkim
+void test_10_integral_index() {
+    std::clog << "[10] integral track index\n";
+    // Gęste identyfikatory katalogowe.
+    check_against_model<std::uint32_t>([](auto &rng) {
+        return static_cast<std::uint32_t>(1000 + rng() % 300);
+    }, 20000);
+    // Rzadkie, przechodzi w drzewo pozycyjne i z powrotem.
+    check_against_model<std::uint32_t>([](auto &rng) {
+        return rng() % 4 ? static_cast<std::uint32_t>(rng() % 50)
+                         : static_cast<std::uint32_t>(rng());
+    }, 20000);
+    // Ujemne i skrajne wartości zachowują kolejność.
+    check_against_model<long long>([](auto &rng) {
+        switch (rng() % 4) {
+            case 0: return std::numeric_limits<long long>::min();
+            case 1: return std::numeric_limits<long long>::max();
+            case 2: return -static_cast<long long>(rng() % 100);
+            default: return static_cast<long long>(rng()) << 20;
+        }
+    }, 20000);
+    check_against_model<signed char>([](auto &rng) {
+        return static_cast<signed char>(rng());
+    }, 5000);
+
+    cxx::integral_index<int> index;
+    for (int i = 0; i < 100; ++i)
+        index.insert(i);
+    assert(!index.sparse());
+    index.insert(1 << 30);
+    assert(index.sparse());
+    index.erase(index.find(1 << 30));
+    assert(!index.sparse());
+
+    // Po usunięciu prawie wszystkich kluczy indeks wraca do drzewa, a
+    // tablica znika z pamięci.
+    cxx::integral_index<std::uint32_t> wide;
+    for (std::uint32_t i = 0; i <= 200000; ++i)
+        wide.insert(i);
+    std::size_t dense_bytes = wide.memory_bytes();
+    for (std::uint32_t i = 1; i < 200000; ++i)
+        wide.erase(wide.find(i));
+    assert(wide.sparse());
+    assert(wide.memory_bytes() + 200000 * sizeof(std::uint32_t)
+           < dense_bytes);
+
+    using ids_t = cxx::playlist<std::uint32_t, params_t>;
+    ids_t ids;
+    for (std::uint32_t i = 0; i <= 200000; ++i)
+        ids.push_back(i, {i, i});
+    while (ids.size() > 1)
+        ids.pop_front();
+    ids.push_back(0, {0, 0});
+    assert(ids.pay(ids.sorted_lower_bound(1)).first == 200000);
+    assert(ids.pay(ids.sorted_begin()).first == 0);
+    assert(ids.sorted_upper_bound(200000) == ids.sorted_end());
+
+    // Luki w gęstej tablicy przeskakiwane przez mapę bitową.
+    cxx::integral_index<int> gaps;
+    for (int i = 0; i < 5000; ++i)
+        gaps.insert(i * 3);
+    for (int i = 0; i < 5000; ++i) {
+        if (i % 1000 != 7)
+            gaps.erase(gaps.find(i * 3));
+    }
+    std::vector<int> left;
+    for (auto it = gaps.begin(); it != gaps.end(); ++it)
+        left.push_back(it->first);
+    assert((left == std::vector<int>{21, 3021, 6021, 9021, 12021}));
+    assert(gaps.lower_bound(22)->first == 3021);
+    assert(gaps.upper_bound(12021) == gaps.end());
+}
+
+// Alokator zliczający przydziały, żeby sprawdzić, że polityka działa.
+static std::size_t counted_allocations = 0;
+
+template <typename U>
+struct counting_allocator {
+    using value_type = U;
+
+    counting_allocator() = default;
+    template <typename V>
+    counting_allocator(counting_allocator<V> const &) noexcept {}
+
+    U *allocate(std::size_t n) {
+        ++counted_allocations;
+        return std::allocator<U>().allocate(n);
+    }
+
+    void deallocate(U *p, std::size_t n) noexcept {
+        std::allocator<U>().deallocate(p, n);
+    }
+
+    template <typename V>
+    bool operator==(counting_allocator<V> const &) const noexcept {
+        return true;
+    }
+};
+
+// 11: polityki magazynu, indeksu i alokatora dają tę samą plejlistę
+void test_11_policies() {
+    std::clog << "[11] storage, index and allocator policies\n";
+    // Indeks haszujący sortuje leniwie, więc sorted_begin() może rzucić.
+    static_assert(noexcept(std::declval<int_playlist_t const &>()
+                               .sorted_begin()));
+    static_assert(!noexcept(std::declval<cxx::playlist<int, params_t,
+        cxx::hashed_index> const &>().sorted_begin()));
+    auto small = [](auto &rng) { return static_cast<int>(rng() % 200); };
+    check_against_model<int, cxx::node_storage>(small, 5000);
+    check_against_model<int, cxx::map_index, cxx::slab_storage<512>>(
+        small, 5000);
+    check_against_model<int, cxx::hashed_index>(small, 5000);
+    check_against_model<int, cxx::radix_index, cxx::node_storage>(
+        [](auto &rng) { return static_cast<int>(rng()); }, 5000);
+
+    // Ten sam ciąg operacji na różnych konfiguracjach.
+    using hashed_t = cxx::playlist<std::string, params_t, cxx::hashed_index,
+                                   cxx::node_storage>;
+    str_playlist_t plain;
+    hashed_t hashed;
+    for (unsigned i = 0; i < 300; ++i) {
+        std::string track = "t" + std::to_string(i * 37 % 101);
+        plain.push_back(track, {i, i + 1});
+        hashed.push_back(track, {i, i + 1});
+    }
+    plain.remove("t5");
+    hashed.remove("t5");
+    assert(plain.size() == hashed.size());
+    auto a = plain.sorted_begin();
+    for (auto b = hashed.sorted_begin(); b != hashed.sorted_end(); ++a, ++b)
+        assert(plain.pay(a) == hashed.pay(b));
+    assert(a == plain.sorted_end());
+    assert(same_content(hashed, roundtrip(hashed)));
+
+    using counted_t = cxx::playlist<
+        std::string, params_t,
+        cxx::allocator_policy<counting_allocator<params_t>>>;
+    counted_allocations = 0;
+    {
+        counted_t pl;
+        for (unsigned i = 0; i < 100; ++i)
+            pl.push_back(std::to_string(i), {i, i});
+        counted_t copy = pl;
+        copy.params(copy.play_begin()).first = 7;
+        assert(pl.front().second.first == 0);
+        assert(same_content(pl, roundtrip(pl)));
+    }
+    assert(counted_allocations > 100);
+}
+
+// 12: nieatomowe liczniki współdzielenia zachowują semantykę COW
+void test_12_local_sharing() {
+    std::clog << "[12] non-atomic sharing\n";
+    check_against_model<int, cxx::local_sharing>(
+        [](auto &rng) { return static_cast<int>(rng() % 300); }, 5000);
+
+    using local_t = cxx::playlist<std::string, params_t, cxx::local_sharing>;
+    local_t p1;
+    p1.push_back("a", {1, 1});
+    local_t p2 = p1;
+    local_t p3 = p2;
+    auto const &c1 = p1;
+    auto const &c3 = p3;
+    assert(&c1.params(c1.play_begin()) == &c3.params(c3.play_begin()));
+
+    p2.push_back("b", {2, 2});
+    assert(p1.size() == 1 && p3.size() == 1 && p2.size() == 2);
+    assert(&c1.params(c1.play_begin()) == &c3.params(c3.play_begin()));
+
+    // Referencja do parametrów wyłącza współdzielenie dla kolejnej kopii.
+    p1.params(p1.play_begin()).first = 9;
+    assert(c3.front().second.first == 1);
+    local_t p4 = p1;
+    p1.params(p1.play_begin()).first = 10;
+    assert(p4.front().second.first == 9);
+
+    p3 = local_t();
+    p2 = p4;
+    p4.pop_front();
+    assert(p2.size() == 1 && p4.size() == 0);
+    assert(same_content(p2, roundtrip(p2)));
+}
+
+// Parametry zliczające swoje kopie.
+struct counted_params {
+    static inline std::size_t copies = 0;
+    unsigned value;
+
+    counted_params(unsigned v) : value(v) {}
+    counted_params(counted_params const &o) : value(o.value) { ++copies; }
+};
+
+// 13: niestałe params() na współdzielonej plejliście kopiuje jeden kawałek
+void test_13_chunk_unshare() {
+    std::clog << "[13] params() copies only the chunk of the play\n";
+    using pl_t = cxx::playlist<int, counted_params>;
+    pl_t pl;
+    for (unsigned i = 0; i < 10000; ++i)
+        pl.push_back(static_cast<int>(i % 100), counted_params(i));
+
+    pl_t copy = pl;
+    auto it = copy.play_begin();
+    for (int i = 0; i < 5000; ++i)
+        ++it;
+    counted_params::copies = 0;
+    copy.params(it).value = 123456;
+    assert(counted_params::copies > 0 && counted_params::copies <= 64);
+
+    pl_t const &c = pl;
+    pl_t const &cc = copy;
+    assert(&c.params(c.play_begin()) == &cc.params(cc.play_begin()));
+    auto it2 = c.play_begin();
+    auto it3 = cc.play_begin();
+    for (int i = 0; i < 5000; ++i, ++it3)
+        ++it2;
+    assert(c.params(it2).value == 5000 && cc.params(it3).value == 123456);
+
+    // Dalsze zmiany po obu stronach nie przeciekają do drugiej kopii.
+    pl_t third = pl;
+    pl.pop_front();
+    copy.remove(7);
+    third.push_back(1000, counted_params(1));
+    assert(pl.size() == 9999 && copy.size() == 9900 && third.size() == 10001);
+    assert(third.front().second.value == 0 && cc.front().second.value == 0);
+    assert(c.front().second.value == 1);
+    std::size_t sevens = 0;
+    for (auto i = c.play_begin(); i != c.play_end(); ++i)
+        sevens += c.play(i).first == 7;
+    assert(sevens == 100);
+
+    // Kopia po wydaniu referencji nie może dzielić z nią kawałka.
+    counted_params &ref = pl.params(pl.play_begin());
+    pl_t fourth = pl;
+    ref.value = 77;
+    assert(fourth.front().second.value == 1);
+}
+
+// 14: modify() i edit() nie wyłączają współdzielenia na stałe
+void test_14_scoped_params() {
+    std::clog << "[14] modify() and edit() keep copies cheap\n";
+    int_playlist_t pl;
+    for (unsigned i = 0; i < 200; ++i)
+        pl.push_back(static_cast<int>(i % 10), {i, i});
+    int_playlist_t const &c = pl;
+    auto shares = [&](int_playlist_t const &copy) {
+        return &c.params(c.play_begin()) == &copy.params(copy.play_begin());
+    };
+
+    int_playlist_t before = pl;
+    unsigned old = pl.modify(pl.play_begin(), [](params_t &p) {
+        return std::exchange(p.first, 42u);
+    });
+    assert(old == 0 && c.front().second.first == 42);
+    assert(before.front().second.first == 0);
+    int_playlist_t after = pl;
+    assert(shares(after));
+
+    {
+        auto guard = pl.edit(pl.play_begin());
+        guard->second = 7;
+        int_playlist_t during = pl;
+        assert(!shares(during));
+        (*guard).second = 8;
+        assert(during.front().second.second == 7);
+        assert(after.front().second.second == 0);
+    }
+    assert(c.front().second.second == 8);
+    int_playlist_t later = pl;
+    assert(shares(later));
+
+    // Po params() współdzielenie nadal jest wyłączone aż do modyfikacji.
+    pl.params(pl.play_begin()).first = 1;
+    pl.modify(pl.play_begin(), [](params_t &p) { p.first = 2; });
+    int_playlist_t still = pl;
+    assert(!shares(still));
+
+    bool thrown = false;
+    try {
+        pl.modify(pl.play_begin(), [](params_t &) -> void {
+            throw std::runtime_error("fn");
+        });
+    } catch (std::runtime_error const &) {
+        thrown = true;
+    }
+    assert(thrown && c.front().second.first == 2);
+
+    // params() wywołane w trakcie edit() zostawia współdzielenie wyłączone,
+    // jego referencja żyje dłużej niż strażnik.
+    pl.push_back(1, {0, 0});
+    int_playlist_t shared = pl;
+    assert(shares(shared));
+    params_t *kept;
+    {
+        auto guard = pl.edit(pl.play_begin());
+        kept = &pl.params(++pl.play_begin());
+        {
+            auto inner = pl.edit(pl.play_begin());
+            inner->first = 3;
+        }
+        guard->first = 4;
+    }
+    int_playlist_t mixed = pl;
+    kept->first = 5;
+    assert(mixed.params(++mixed.play_begin()).first != 5);
+    assert(c.params(++c.play_begin()).first == 5);
+
+    // Bez params() ostatni strażnik przywraca współdzielenie.
+    pl.push_back(1, {0, 0});
+    {
+        auto outer = pl.edit(pl.play_begin());
+        auto inner = pl.edit(pl.play_begin());
+        inner->second = 1;
+    }
+    int_playlist_t again = pl;
+    assert(shares(again));
+}
+
+// Ostatnie zdarzenie zgłoszone przez hak instrumentacji.
+static cxx::cow_event last_event{cxx::cow_event_kind::unique_write};
+static std::size_t hook_calls = 0;
+
+// 15: liczniki kopiowania przy zapisie
+void test_15_cow_stats() {
+    std::clog << "[15] COW instrumentation\n";
+    struct tag {};
+    using stats_t = cxx::cow_instrumentation<tag>;
+    using pl_t = cxx::playlist<int, params_t, stats_t>;
+    static_assert(sizeof(pl_t) == sizeof(int_playlist_t));
+
+    pl_t pl;
+    for (unsigned i = 0; i < 1000; ++i)
+        pl.push_back(static_cast<int>(i % 50), {i, i});
+    cxx::cow_stats s = stats_t::stats();
+    assert(s.unique_writes == 1000 && s.shared_writes == 0);
+    assert(s.data_copies == 0 && s.shareable_flips == 0);
+
+    stats_t::reset();
+    stats_t::set_hook([](cxx::cow_event const &e) {
+        last_event = e;
+        ++hook_calls;
+    });
+    pl_t copy = pl;
+    copy.push_back(7, {0, 0});
+    s = stats_t::stats();
+    assert(s.shared_writes == 1 && s.data_copies == 1);
+    assert(s.deep_copies == 0 && s.tracks_cloned == 50);
+    // Skopiowane tylko kawałki ogona kolejki i ostatniego odtworzenia 7.
+    assert(s.chunk_copies == 2 && s.plays_cloned == 1000 % 64 + 64);
+    assert(last_event.kind == cxx::cow_event_kind::chunk_copy);
+    assert(hook_calls == 4);
+
+    stats_t::reset();
+    copy.params(copy.play_begin()).first = 5;
+    pl_t deep = copy;
+    copy.pop_front();
+    s = stats_t::stats();
+    assert(s.shareable_flips == 2 && s.deep_copies == 1);
+    assert(s.plays_cloned >= 1001 && s.unique_writes == 2);
+    stats_t::set_hook(nullptr);
+    copy.pop_front();
+    assert(hook_calls == 4 + 6);
+}
+
+// 16: memory_usage() rośnie i maleje z zawartością, widać współdzielenie
+void test_16_memory_usage() {
+    std::clog << "[16] memory usage\n";
+    int_playlist_t pl;
+    cxx::memory_stats m = pl.memory_usage();
+    assert(m.owners == 1 && !m.shared);
+    assert(m.params == 0 && m.occurrences == 0);
+    std::size_t empty = m.queue;
+
+    for (unsigned i = 0; i < 10000; ++i)
+        pl.push_back(static_cast<int>(i % 1000), {i, i});
+    m = pl.memory_usage();
+    assert(m.params >= 10000 * sizeof(params_t));
+    assert(m.params < 10064 * sizeof(params_t));
+    assert(m.occurrences >= 10000 * 2 * sizeof(cxx::slot_t)
+                            + 1000 * sizeof(cxx::track_info));
+    assert(m.queue >= 10000 * 3 * sizeof(cxx::slot_t));
+    assert(m.index >= 1000 * sizeof(int));
+    assert(m.total() == m.queue + m.index + m.occurrences + m.params);
+
+    int_playlist_t copy = pl;
+    assert(pl.memory_usage().owners == 2 && copy.memory_usage().shared);
+    assert(copy.memory_usage().total() == m.total());
+    copy.push_back(1, {0, 0});
+    assert(!pl.memory_usage().shared && copy.memory_usage().owners == 1);
+
+    // Bufory długich nazw liczą się do indeksu, map_index i hashed_index.
+    auto names = [](auto pl) {
+        std::size_t before = pl.memory_usage().index;
+        for (int i = 0; i < 100; ++i)
+            pl.push_back(std::string(100, 'a') + std::to_string(i), {0, 0});
+        std::size_t after = pl.memory_usage().index;
+        assert(after - before >= 100 * 101);
+        for (int i = 0; i < 100; ++i)
+            pl.remove(std::string(100, 'a') + std::to_string(i));
+        assert(pl.memory_usage().index <= after - 100 * 101);
+        assert(pl.memory_usage().occurrences == 0);
+    };
+    names(str_playlist_t{});
+    names(cxx::playlist<std::string, params_t, cxx::hashed_index>{});
+
+    // Rzadkie klucze: drzewo pozycyjne.
+    int_playlist_t sparse;
+    for (int i = 0; i < 1000; ++i)
+        sparse.push_back(i * 1000003, {0, 0});
+    assert(sparse.memory_usage().index >= 1000 * (8 + 4));
+
+    // Kawałki wracają od razu, tablice (kawałków, indeksu) zostają.
+    while (pl.size() > 0)
+        pl.pop_front();
+    m = pl.memory_usage();
+    assert(m.params == 0 && m.occurrences == 0);
+    assert(m.queue <= empty + 256 * sizeof(void *));
+}
+
+template <typename PL>
+concept has_top_k = requires (PL const &pl) { pl.top_k(1); };
+
+// 17: top_k() i played_at_least(), tylko z polityką count_index
+void test_17_top_k() {
+    std::clog << "[17] most played tracks\n";
+    static_assert(!has_top_k<str_playlist_t>);
+    using counted_t = cxx::playlist<std::string, params_t, cxx::count_index>;
+    counted_t pl;
+    assert(pl.top_k(10).empty() && pl.played_at_least(0).empty());
+    for (unsigned i = 0; i < 30; ++i)
+        for (unsigned j = 0; j <= i % 10; ++j)
+            pl.push_back("t" + std::to_string(i), {i, j});
+    // Liczności 1..10, każda trzy razy.
+    auto top = pl.top_k(4);
+    assert(top.size() == 4);
+    assert(top[0].first.back() == '9' && top[3].first.back() == '8');
+    assert(top[0].second == 10 && top[2].second == 10 && top[3].second == 9);
+    assert(pl.top_k(0).empty() && pl.top_k(100).size() == 30);
+    assert(pl.played_at_least(9).size() == 6);
+    assert(pl.played_at_least(11).empty());
+
+    // Kopia ma własną kolejność po odłączeniu.
+    counted_t copy = pl;
+    copy.remove("t9");
+    copy.remove("t19");
+    assert(copy.top_k(1)[0].first == "t29");
+    assert(pl.played_at_least(10).size() == 3);
+    while (copy.front().first != "t29")
+        copy.pop_front();
+    copy.pop_front();
+    assert(copy.top_k(1)[0].second == 9);
+    for (auto const &[track, count] : copy.played_at_least(9))
+        assert(count == 9 && (track.back() == '8' || track == "t29"));
+
+    auto small = [](auto &rng) { return static_cast<int>(rng() % 200); };
+    check_against_model<int, cxx::count_index>(small, 5000);
+    check_against_model<int, cxx::hashed_index, cxx::count_index>(small,
+                                                                  5000);
+}
+
+// Utwory z zakresu, po kolei.
+template <typename PL>
+static std::vector<std::string> tracks_in(
+        PL const &pl, std::pair<typename PL::sorted_iterator,
+                                typename PL::sorted_iterator> range) {
+    std::vector<std::string> res;
+    for (auto it = range.first; it != range.second; ++it)
+        res.emplace_back(pl.pay(it).first);
+    return res;
+}
+
+// 18: zakresy w kolejności kluczy i zakres prefiksu
+template <typename PL>
+static void check_ranges() {
+    PL pl;
+    for (char const *t : {"abba/waterloo", "label/a/1", "label/a/2",
+                          "label/b/1", "label\xff", "label\xff\xff/x",
+                          "labem/z", "zz"}) {
+        pl.push_back(t, {0, 0});
+    }
+    pl.push_back("label/a/2", {1, 1});
+
+    auto [lo, hi] = pl.sorted_equal_range("label/a/2");
+    assert(pl.pay(lo).first == "label/a/2" && pl.pay(lo).second == 2);
+    assert(++lo == hi && pl.pay(hi).first == "label/b/1");
+    auto none = pl.sorted_equal_range("label/a/3");
+    assert(none.first == none.second);
+    assert(pl.sorted_lower_bound("zzz") == pl.sorted_end());
+    assert(pl.sorted_upper_bound("") == pl.sorted_begin());
+
+    using v = std::vector<std::string>;
+    assert(tracks_in(pl, pl.sorted_prefix_range("label/"))
+           == (v{"label/a/1", "label/a/2", "label/b/1"}));
+    assert(tracks_in(pl, pl.sorted_prefix_range("label/a/"))
+           == (v{"label/a/1", "label/a/2"}));
+    assert(tracks_in(pl, pl.sorted_prefix_range("label"))
+           == (v{"label/a/1", "label/a/2", "label/b/1", "label\xff",
+                 "label\xff\xff/x"}));
+    // Znaki 0xff na końcu prefiksu: granica przesuwa się wcześniej.
+    assert(tracks_in(pl, pl.sorted_prefix_range("label\xff"))
+           == (v{"label\xff", "label\xff\xff/x"}));
+    assert(tracks_in(pl, pl.sorted_prefix_range("z")) == v{"zz"});
+    assert(tracks_in(pl, pl.sorted_prefix_range("")).size() == 8);
+    assert(tracks_in(pl, pl.sorted_prefix_range("x")).empty());
+}
+
+void test_18_sorted_ranges() {
+    std::clog << "[18] sorted ranges and prefix ranges\n";
+    check_ranges<str_playlist_t>();
+    check_ranges<cxx::playlist<std::string, params_t, cxx::hashed_index>>();
+    check_ranges<cxx::playlist<std::string_view, params_t>>();
+
+    cxx::playlist<std::uint64_t, params_t> ids;
+    for (std::uint64_t i = 0; i < 100; ++i)
+        ids.push_back(i * i * i * 1000, {0, 0});
+    auto it = ids.sorted_lower_bound(8000 * 1000 + 1);
+    assert(ids.pay(it).first == 9261 * 1000);
+    it = ids.sorted_upper_bound(27000 * 1000);
+    assert(ids.pay(it).first == 29791 * 1000);
+}
+
+// 19: sumy odtworzeń w zakresie kluczy i k-ty utwór
+void test_19_order_statistics() {
+    std::clog << "[19] order statistic index\n";
+    auto small = [](auto &rng) { return static_cast<int>(rng() % 200); };
+    check_against_model<int, cxx::order_statistic_index>(small, 20000);
+    check_against_model<int, cxx::order_statistic_index,
+                        cxx::local_sharing>([](auto &rng) {
+        return static_cast<int>(rng() % 5000);
+    }, 20000);
+    check_against_model<std::string, cxx::order_statistic_index>(
+        [](auto &rng) { return std::to_string(rng() % 300); }, 10000);
+
+    using pl_t = cxx::playlist<std::string, params_t,
+                               cxx::order_statistic_index>;
+    pl_t pl;
+    for (unsigned i = 0; i < 10; ++i)
+        for (unsigned j = 0; j <= i; ++j)
+            pl.push_back("k" + std::to_string(i), {i, j});
+    assert(pl.plays_between("k0", "k9") == 45);
+    assert(pl.plays_between("k3", "k5") == 4 + 5);
+    assert(pl.plays_between("k5", "k3") == 0);
+    assert(pl.plays_between("a", "z") == 55);
+    assert(pl.pay(pl.sorted_nth(3)).first == "k3");
+    assert(pl.sorted_nth(10) == pl.sorted_end());
+
+    pl_t copy = pl;
+    copy.remove("k4");
+    copy.pop_front();
+    assert(copy.plays_between("k3", "k5") == 4);
+    assert(copy.plays_between("k0", "k1") == 0);
+    assert(pl.plays_between("k3", "k5") == 9);
+    assert(copy.pay(copy.sorted_nth(3)).first == "k5");
+
+    // Odczyt z pliku dokłada utwory na koniec indeksu.
+    std::stringstream ss;
+    pl.serialize(ss);
+    pl_t loaded = pl_t::deserialize(ss);
+    assert(same_content(loaded, pl));
+    assert(loaded.plays_between("k2", "k8") == 3 + 4 + 5 + 6 + 7 + 8);
+}
+
+// Długość odtworzenia: koniec minus początek, jak w playlist_example.
+struct play_length {
+    unsigned operator()(params_t const &p) const {
+        return p.second - p.first;
+    }
+};
+
+// 20: przewijanie do chwili t względem początku kolejki
+void test_20_seek_time() {
+    std::clog << "[20] seek by time\n";
+    using pl_t = cxx::playlist<int, params_t,
+                               cxx::duration_index<play_length>>;
+    std::mt19937 rng(20);
+    pl_t pl;
+    std::deque<std::pair<int, unsigned>> model;     // utwór, długość
+
+    auto check = [&](pl_t const &p, auto const &m) {
+        unsigned total = 0;
+        for (auto const &e : m)
+            total += e.second;
+        assert(p.total_duration() == total);
+        for (int i = 0; i < 20; ++i) {
+            unsigned t = rng() % (total + 10);
+            auto it = p.seek_time(t);
+            unsigned start = 0;
+            std::size_t k = 0;
+            while (k < m.size() && start + m[k].second <= t)
+                start += m[k++].second;
+            if (k == m.size()) {
+                assert(it == p.play_end());
+                continue;
+            }
+            assert(p.start_time(it) == start);
+            assert(p.play(it).first == m[k].first);
+            assert(play_length()(p.play(it).second) == m[k].second);
+        }
+    };
+
+    for (unsigned step = 0; step < 5000; ++step) {
+        unsigned op = rng() % 10;
+        if (op < 6 || model.empty()) {
+            int track = static_cast<int>(rng() % 50);
+            unsigned len = rng() % 300;
+            pl.push_back(track, {step, step + len});
+            model.emplace_back(track, len);
+        } else if (op < 7) {
+            pl.pop_front();
+            model.pop_front();
+        } else if (op < 8) {
+            int track = model[rng() % model.size()].first;
+            pl.remove(track);
+            std::erase_if(model, [&](auto const &e) {
+                return e.first == track;
+            });
+        } else {
+            // Zmiana długości przez params() i przez modify().
+            std::size_t k = rng() % model.size();
+            auto it = pl.play_begin();
+            for (std::size_t i = 0; i < k; ++i)
+                ++it;
+            unsigned len = rng() % 300;
+            if (op == 8) {
+                params_t &p = pl.params(it);
+                p.second = p.first + len;
+            } else {
+                pl.modify(it, [&](params_t &p) { p.second = p.first + len; });
+            }
+            model[k].second = len;
+        }
+        if (step % 50 == 0)
+            check(pl, model);
+        if (step % 500 == 0 && model.size() > 1) {
+            // Kopia ma własne sumy.
+            pl_t copy = pl;
+            auto old = model;
+            copy.pop_front();
+            copy.params(copy.play_begin()).second += 1000;
+            check(pl, model);
+            old.pop_front();
+            old.front().second += 1000;
+            check(copy, old);
+        }
+    }
+    check(pl, model);
+    while (pl.size() > 0)
+        pl.pop_front();
+    assert(pl.total_duration() == 0 && pl.seek_time(0) == pl.play_end());
+
+    // Zmiana → zapytanie → zmiana → zapytanie przez jedną referencję:
+    // drugie zapytanie widzi drugą zmianę.
+    pl.push_back(1, {0, 10});
+    pl.push_back(2, {0, 10});
+    params_t &ref = pl.params(pl.play_begin());
+    ref.second = 20;
+    assert(pl.total_duration() == 30);
+    ref.second = 50;
+    assert(pl.total_duration() == 60);
+    assert(pl.seek_time(40) == pl.play_begin());
+    assert(pl.seek_time(55) == ++pl.play_begin());
+    assert(pl.start_time(++pl.play_begin()) == 50);
+    {
+        auto guard = pl.edit(++pl.play_begin());
+        guard->second = 5;
+        assert(pl.total_duration() == 55);
+        guard->second = 15;
+        assert(pl.total_duration() == 65);
+    }
+    assert(pl.total_duration() == 65);
+    // Po splice referencja wskazuje już w dane docelowej plejlisty.
+    pl_t joined;
+    joined.push_back(3, {0, 1});
+    params_t &moved = pl.params(pl.play_begin());
+    joined.splice_back(std::move(pl));
+    assert(joined.total_duration() == 66);
+    moved.second = 1;
+    assert(joined.total_duration() == 17);
+    assert(joined.seek_time(1) == ++joined.play_begin());
+    // Modyfikacja unieważnia referencję, sumy są już stałe.
+    joined.pop_front();
+    assert(joined.total_duration() == 16);
+
+    // Długości zmiennoprzecinkowe.
+    struct seconds {
+        double operator()(double p) const { return p; }
+    };
+    cxx::playlist<std::string, double, cxx::duration_index<seconds>> radio;
+    radio.push_back("a", 2.5);
+    radio.push_back("b", 0.5);
+    radio.push_back("a", 1.0);
+    assert(radio.play(radio.seek_time(2.9)).first == "b");
+    assert(radio.start_time(radio.seek_time(3.0)) == 3.0);
+    radio.remove("b");
+    assert(radio.total_duration() == 3.5);
+}
+
+// Iterator na k-te odtworzenie (k == size() daje koniec).
+template <typename PL>
+static auto nth_play(PL const &pl, std::size_t k) {
+    auto it = pl.play_begin();
+    for (std::size_t i = 0; i < k; ++i)
+        ++it;
+    return it;
+}
+
+// Losowe insert / erase / move w środku kolejki, porównywane z modelem.
+template <typename... Policies>
+static void check_positional_edits(unsigned steps) {
+    using pl_t = cxx::playlist<int, params_t, Policies...>;
+    std::mt19937 rng(21);
+    pl_t pl;
+    std::deque<std::pair<int, params_t>> model;
+
+    auto check = [&](pl_t const &p, auto const &m) {
+        std::map<int, std::size_t> counts;
+        auto it = p.play_begin();
+        for (auto const &[track, params] : m) {
+            assert(it != p.play_end());
+            assert(p.play(it).first == track && p.play(it).second == params);
+            ++counts[track];
+            ++it;
+        }
+        assert(it == p.play_end() && p.size() == m.size());
+        auto sit = p.sorted_begin();
+        for (auto const &[track, count] : counts) {
+            assert(pl.pay(sit).first == track);
+            assert(pl.pay(sit).second == count);
+            ++sit;
+        }
+        assert(sit == p.sorted_end());
+        if constexpr (requires { p.total_duration(); }) {
+            unsigned start = 0;
+            std::size_t k = 0;
+            for (auto i = p.play_begin(); i != p.play_end(); ++i, ++k) {
+                if (k % 7 == 0)
+                    assert(p.start_time(i) == start);
+                start += play_length()(p.play(i).second);
+            }
+            assert(p.total_duration() == start);
+        }
+        if constexpr (requires { p.plays_between(0, 1); })
+            assert(p.plays_between(0, 100) == m.size());
+    };
+
+    for (unsigned step = 0; step < steps; ++step) {
+        unsigned op = rng() % 10;
+        std::size_t k = model.empty() ? 0 : rng() % (model.size() + 1);
+        if (op < 5 || model.empty()) {
+            int track = static_cast<int>(rng() % 40);
+            params_t params{step, step + rng() % 100};
+            auto it = pl.insert(nth_play(pl, k), track, params);
+            assert(pl.play(it).first == track);
+            model.insert(model.begin() + k, {track, params});
+        } else if (op < 7) {
+            k = rng() % model.size();
+            auto next = pl.erase(nth_play(pl, k));
+            model.erase(model.begin() + k);
+            assert(next == nth_play(pl, k));
+        } else {
+            std::size_t from = rng() % model.size();
+            pl.move(nth_play(pl, from), nth_play(pl, k));
+            auto e = model[from];
+            model.insert(model.begin() + k, e);
+            model.erase(model.begin() + (from < k ? from : from + 1));
+        }
+        if (step % 37 == 0)
+            check(pl, model);
+        if (step % 200 == 0 && model.size() > 2) {
+            // Zmiany w kopii nie widać w oryginale i odwrotnie.
+            pl_t copy = pl;
+            auto old = model;
+            copy.move(copy.play_begin(), copy.play_end());
+            copy.erase(nth_play(copy, 1));
+            copy.insert(copy.play_begin(), 99, {0, 5});
+            old.push_back(old.front());
+            old.pop_front();
+            old.erase(old.begin() + 1);
+            old.push_front({99, {0, 5}});
+            check(pl, model);
+            check(copy, old);
+        }
+    }
+    check(pl, model);
+}
+
+// 21: wstawianie, usuwanie i przenoszenie pojedynczych odtworzeń
+void test_21_positional_edits() {
+    std::clog << "[21] insert, erase and move of single plays\n";
+    check_positional_edits(3000);
+    check_positional_edits<cxx::duration_index<play_length>,
+                           cxx::order_statistic_index,
+                           cxx::count_index>(3000);
+    check_positional_edits<cxx::map_index, cxx::node_storage>(1000);
+
+    str_playlist_t pl;
+    pl.push_back("a", {0, 0});
+    pl.push_back("b", {0, 0});
+    // Przeniesienie na miejsce, które już zajmuje, nic nie zmienia.
+    pl.move(pl.play_begin(), pl.play_begin());
+    pl.move(pl.play_begin(), nth_play(pl, 1));
+    assert(pl.front().first == "a");
+    pl.move(pl.play_begin(), pl.play_end());
+    assert(pl.front().first == "b");
+    // Ostatnie odtworzenie zabiera utwór.
+    auto next = pl.erase(pl.play_begin());
+    assert(next == pl.play_begin() && pl.play(next).first == "a");
+    assert(pl.erase(pl.play_begin()) == pl.play_end());
+    assert(pl.sorted_begin() == pl.sorted_end());
+    try {
+        pl.erase(pl.play_end());
+        assert(false);
+    } catch (std::out_of_range const &) {}
+    try {
+        pl.move(pl.play_end(), pl.play_end());
+        assert(false);
+    } catch (std::out_of_range const &) {}
+}
+
+// Plejlista z n losowymi odtworzeniami utworów 0..tracks-1 i jej model.
+template <typename PL>
+static std::deque<std::pair<int, params_t>>
+fill_random(PL &pl, std::mt19937 &rng, std::size_t n, unsigned tracks) {
+    std::deque<std::pair<int, params_t>> model;
+    for (std::size_t i = 0; i < n; ++i) {
+        int track = static_cast<int>(rng() % tracks);
+        params_t params{static_cast<unsigned>(i), static_cast<unsigned>(
+                                                      i + rng() % 50)};
+        pl.push_back(track, params);
+        model.emplace_back(track, params);
+        // Dziury w slabie, żeby łączone były też listy wolnych miejsc.
+        if (rng() % 4 == 0) {
+            std::size_t k = rng() % model.size();
+            pl.erase(nth_play(pl, k));
+            model.erase(model.begin() + k);
+        }
+    }
+    return model;
+}
+
+// Kolejka, liczniki i (jeśli są) długości zgodne z modelem.
+template <typename PL>
+static void check_model(PL const &pl,
+                        std::deque<std::pair<int, params_t>> const &model) {
+    std::map<int, std::size_t> counts;
+    auto it = pl.play_begin();
+    for (auto const &[track, params] : model) {
+        assert(it != pl.play_end());
+        assert(pl.play(it).first == track && pl.play(it).second == params);
+        ++counts[track];
+        ++it;
+    }
+    assert(it == pl.play_end() && pl.size() == model.size());
+    auto sit = pl.sorted_begin();
+    for (auto const &[track, count] : counts) {
+        assert(pl.pay(sit).first == track && pl.pay(sit).second == count);
+        ++sit;
+    }
+    assert(sit == pl.sorted_end());
+    if constexpr (requires { pl.top_k(0); }) {
+        auto top = pl.top_k(counts.size());
+        assert(top.size() == counts.size());
+        for (auto const &[track, count] : top)
+            assert(counts.at(track) == count);
+    }
+    if constexpr (requires { pl.total_duration(); }) {
+        unsigned total = 0;
+        for (auto const &e : model)
+            total += play_length()(e.second);
+        assert(pl.total_duration() == total);
+        if (!model.empty()) {
+            auto last = nth_play(pl, model.size() - 1);
+            assert(pl.start_time(last)
+                   == total - play_length()(model.back().second));
+        }
+    }
+    if constexpr (requires { pl.plays_between(0, 1); })
+        assert(pl.plays_between(0, 1000) == model.size());
+}
+
+template <typename... Policies>
+static void check_splice(unsigned seed) {
+    using pl_t = cxx::playlist<int, params_t, Policies...>;
+    std::mt19937 rng(seed);
+    for (int round = 0; round < 20; ++round) {
+        pl_t a, b;
+        auto ma = fill_random(a, rng, rng() % 300, 30);
+        auto mb = fill_random(b, rng, rng() % 300, 1 + rng() % 60);
+        pl_t a_copy = a;
+        pl_t b_copy = b;
+        // Odłączona kopia: b znowu ma dane na wyłączność.
+        if (round % 3 == 0 && !mb.empty())
+            (void) b_copy.params(b_copy.play_begin());
+        if (round % 2 == 0) {
+            // Połowa przypadków z kopią, która współdzieli dane b.
+            a.splice_back(std::move(b));
+            assert(b.size() == 0 && b.sorted_begin() == b.sorted_end());
+            check_model(b_copy, mb);
+        } else {
+            pl_t only = std::move(b);
+            a.splice_back(std::move(only));
+            assert(only.size() == 0);
+        }
+        check_model(a_copy, ma);
+        auto const ma_copy = ma;
+        ma.insert(ma.end(), mb.begin(), mb.end());
+        check_model(a, ma);
+
+        // Dalsze zmiany na połączonej plejliście.
+        for (int i = 0; i < 100; ++i) {
+            if (rng() % 2 && !ma.empty()) {
+                std::size_t k = rng() % ma.size();
+                a.erase(nth_play(a, k));
+                ma.erase(ma.begin() + k);
+            } else {
+                int track = static_cast<int>(rng() % 90);
+                a.push_back(track, {1, 1 + rng() % 9});
+                ma.emplace_back(track, a.play(nth_play(a, ma.size())).second);
+            }
+        }
+        check_model(a, ma);
+        a.append(a_copy);
+        ma.insert(ma.end(), ma_copy.begin(), ma_copy.end());
+        a.append(a);
+        auto const twice = ma;
+        ma.insert(ma.end(), twice.begin(), twice.end());
+        check_model(a, ma);
+        check_model(a_copy, ma_copy);
+        while (a.size() > 0)
+            a.pop_front();
+        check_model(a, {});
+    }
+}
+
+// 22: łączenie plejlist, splice_back i append
+void test_22_splice() {
+    std::clog << "[22] splice and append of playlists\n";
+    check_splice(1);
+    check_splice<cxx::duration_index<play_length>,
+                 cxx::order_statistic_index, cxx::count_index>(2);
+    check_splice<cxx::map_index, cxx::node_storage>(3);
+    check_splice<cxx::hashed_index, cxx::slab_storage<512>>(4);
+
+    // Do pustej plejlisty: przejęcie danych, append tylko współdzieli.
+    str_playlist_t a, b;
+    b.push_back("x", {0, 1});
+    b.push_back("y", {0, 2});
+    a.append(b);
+    assert(same_content(a, b));
+    str_playlist_t c;
+    c.splice_back(std::move(b));
+    assert(same_content(a, c) && b.size() == 0);
+    c.splice_back(std::move(c));
+    assert(c.size() == 2);
+    c.splice_back(str_playlist_t());
+    assert(c.size() == 2);
+
+    // Referencja do parametrów d przechodzi razem z danymi: kopia po
+    // splice_back nie może ich współdzielić, tak do pustej, jak i do
+    // niepustej plejlisty.
+    for (bool empty : {true, false}) {
+        str_playlist_t d, e;
+        if (!empty)
+            e.push_back("w", {0, 0});
+        d.push_back("z", {0, 3});
+        params_t &ref = d.params(d.play_begin());
+        e.splice_back(std::move(d));
+        str_playlist_t e_copy = e;
+        ref.second = 4;
+        std::size_t k = empty ? 0 : 1;
+        assert(e.play(nth_play(e, k)).second == params_t(0, 4));
+        assert(e_copy.play(nth_play(e_copy, k)).second == params_t(0, 3));
+        // Po zwykłej zmianie znowu współdzieli.
+        e.push_back("v", {0, 5});
+        str_playlist_t e_copy2 = e;
+        assert(&e_copy2.play(e_copy2.play_begin()).second
+               == &e.play(e.play_begin()).second);
+    }
+}
+
+// Parametry, których kopia zawodzi na żądanie; przeniesienie nie jest
+// noexcept, więc plejlista je kopiuje.
+struct fragile_params {
+    static inline bool fail = false;
+    unsigned value = 0;
+
+    explicit fragile_params(unsigned v) : value(v) {}
+    fragile_params(fragile_params const &o) : value(o.value) {
+        if (fail)
+            throw std::runtime_error("copy of params");
+    }
+    fragile_params(fragile_params &&o) noexcept(false) : value(o.value) {}
+    fragile_params & operator=(fragile_params const &) = default;
+};
+
+template <typename... Policies>
+static void check_node_transfer(unsigned seed) {
+    using pl_t = cxx::playlist<std::string, params_t, Policies...>;
+    std::mt19937 rng(seed);
+    pl_t pending, air;
+    std::deque<std::pair<std::string, params_t>> mp, ma;
+    for (unsigned i = 0; i < 500; ++i) {
+        std::string track = "track " + std::to_string(rng() % 70);
+        pending.push_back(track, {i, i});
+        mp.emplace_back(track, params_t{i, i});
+    }
+    auto same = [](pl_t const &pl, auto const &m) {
+        auto it = pl.play_begin();
+        for (auto const &[track, params] : m) {
+            assert(pl.play(it).first == track && pl.play(it).second == params);
+            ++it;
+        }
+        assert(it == pl.play_end() && pl.size() == m.size());
+        std::map<std::string, std::size_t> counts;
+        for (auto const &e : m)
+            ++counts[e.first];
+        auto sit = pl.sorted_begin();
+        for (auto const &[track, count] : counts) {
+            assert(pl.pay(sit).first == track && pl.pay(sit).second == count);
+            ++sit;
+        }
+        assert(sit == pl.sorted_end());
+    };
+
+    while (!mp.empty()) {
+        std::size_t from = rng() % mp.size();
+        std::size_t to = rng() % (ma.size() + 1);
+        pl_t pending_copy = pending;
+        auto node = pending.extract(nth_play(pending, from));
+        assert(node && node.track() == mp[from].first);
+        node.params().second += 1;
+        auto it = air.insert(nth_play(air, to), std::move(node));
+        assert(node.empty() && air.play(it).second.second
+                               == mp[from].second.second + 1);
+        ++mp[from].second.second;
+        ma.insert(ma.begin() + to, mp[from]);
+        mp.erase(mp.begin() + from);
+        if (mp.size() % 50 == 0) {
+            same(pending, mp);
+            same(air, ma);
+            assert(pending_copy.size() == mp.size() + 1);
+        }
+    }
+    same(pending, mp);
+    same(air, ma);
+    // I z powrotem, w obrębie jednej plejlisty.
+    for (int i = 0; i < 100; ++i) {
+        std::size_t from = rng() % ma.size();
+        auto node = air.extract(nth_play(air, from));
+        auto e = ma[from];
+        ma.erase(ma.begin() + from);
+        std::size_t to = rng() % (ma.size() + 1);
+        air.insert(nth_play(air, to), std::move(node));
+        ma.insert(ma.begin() + to, e);
+    }
+    same(air, ma);
+}
+
+// 23: extract i insert pojedynczych odtworzeń między plejlistami
+void test_23_node_handles() {
+    std::clog << "[23] extract and insert of plays\n";
+    check_node_transfer(1);
+    check_node_transfer<cxx::hashed_index>(2);
+    check_node_transfer<cxx::order_statistic_index, cxx::count_index>(3);
+
+    int_playlist_t a, b;
+    a.push_back(1, {1, 1});
+    a.push_back(2, {2, 2});
+    int_playlist_t::node_type empty;
+    assert(empty.empty() && !empty);
+    try {
+        b.insert(b.play_end(), std::move(empty));
+        assert(false);
+    } catch (std::invalid_argument const &) {}
+    try {
+        (void) a.extract(a.play_end());
+        assert(false);
+    } catch (std::out_of_range const &) {}
+    auto n = a.extract(a.play_begin());
+    b.insert(b.play_end(), std::move(n));
+    assert(a.front().first == 2 && b.front().first == 1);
+
+    // Nieudane extract i insert niczego nie zmieniają.
+    using fragile_t = cxx::playlist<std::string, fragile_params>;
+    fragile_t src, dst;
+    src.push_back("a", fragile_params(1));
+    src.push_back("b", fragile_params(2));
+    dst.push_back("c", fragile_params(3));
+    fragile_params::fail = true;
+    try {
+        (void) src.extract(src.play_begin());
+        assert(false);
+    } catch (std::runtime_error const &) {}
+    fragile_params::fail = false;
+    assert(src.size() == 2 && src.front().first == "a");
+    auto node = src.extract(src.play_begin());
+    fragile_params::fail = true;
+    try {
+        dst.insert(dst.play_begin(), std::move(node));
+        assert(false);
+    } catch (std::runtime_error const &) {}
+    fragile_params::fail = false;
+    assert(node && node.track() == "a" && node.params().value == 1);
+    assert(dst.size() == 1 && dst.front().first == "c");
+    assert(dst.sorted_begin() != dst.sorted_end()
+           && dst.pay(dst.sorted_begin()).first == "c");
+    dst.insert(dst.play_begin(), std::move(node));
+    assert(dst.front().first == "a" && dst.size() == 2);
+
+    // Utwory string_view wskazują w zmapowany plik źródła: węzeł przenosi
+    // go ze sobą, plejlista docelowa trzyma go dalej.
+    std::string path = temp_path("nodes");
+    {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out << "pierwsze 0:1\n" << "drugie 0:2\n";
+    }
+    using view_t = cxx::playlist<std::string_view, params_t>;
+    view_t views;
+    view_t::node_type moved;
+    {
+        auto log = cxx::load_play_log(path);
+        views.insert(views.play_end(), log.extract(log.play_begin()));
+        moved = log.extract(log.play_begin());
+    }
+    std::remove(path.c_str());
+    assert(moved.track() == "drugie");
+    views.insert(views.play_end(), std::move(moved));
+    views.insert(views.play_begin(), views.extract(views.play_begin()));
+    assert(views.size() == 2 && views.front().first == "pierwsze");
+    assert(views.pay(views.sorted_begin()).first == "drugie");
+}
+
+// Najmniejsza liczba innych odtworzeń między dwoma odtworzeniami jednego
+// utworu (SIZE_MAX, gdy żaden się nie powtarza).
+template <typename PL>
+static std::size_t smallest_gap(PL const &pl) {
+    std::map<int, std::size_t> last;
+    std::size_t res = SIZE_MAX;
+    std::size_t pos = 0;
+    for (auto it = pl.play_begin(); it != pl.play_end(); ++it, ++pos) {
+        auto [at, fresh] = last.try_emplace(pl.play(it).first, pos);
+        if (!fresh) {
+            res = std::min(res, pos - at->second - 1);
+            at->second = pos;
+        }
+    }
+    return res;
+}
+
+// Ten sam multizbiór odtworzeń (utwór z parametrami) co w modelu.
+template <typename PL>
+static bool same_plays(PL const &pl,
+                       std::deque<std::pair<int, params_t>> model) {
+    std::vector<std::pair<int, params_t>> got;
+    for (auto it = pl.play_begin(); it != pl.play_end(); ++it)
+        got.emplace_back(pl.play(it).first, pl.play(it).second);
+    std::sort(got.begin(), got.end());
+    std::sort(model.begin(), model.end());
+    return std::equal(got.begin(), got.end(), model.begin(), model.end());
+}
+
+template <typename... Policies>
+static void check_shuffle(unsigned seed) {
+    using pl_t = cxx::playlist<int, params_t, Policies...>;
+    std::mt19937 rng(seed);
+    for (int round = 0; round < 30; ++round) {
+        pl_t pl;
+        unsigned tracks = 1 + rng() % 40;
+        auto model = fill_random(pl, rng, rng() % 400, tracks);
+        pl_t copy = pl;
+
+        pl.shuffle(rng);
+        assert(same_plays(pl, model));
+        check_model(copy, model);
+        std::deque<std::pair<int, params_t>> now;
+        for (auto it = pl.play_begin(); it != pl.play_end(); ++it)
+            now.emplace_back(pl.play(it).first, pl.play(it).second);
+        check_model(pl, now);
+
+        // Największa przerwa, jaką dopuszczają liczniki.
+        std::map<int, std::size_t> counts;
+        for (auto const &e : model)
+            ++counts[e.first];
+        std::size_t top = 0;
+        std::size_t at_top = 0;
+        for (auto const &[track, count] : counts) {
+            if (count > top) {
+                top = count;
+                at_top = 1;
+            } else if (count == top) {
+                ++at_top;
+            }
+        }
+        if (top < 2)
+            continue;
+        std::size_t best = (model.size() - at_top) / (top - 1) - 1;
+        for (std::size_t gap : {std::min<std::size_t>(1, best), best / 2,
+                                best}) {
+            pl.shuffle(rng, gap);
+            assert(same_plays(pl, model) && smallest_gap(pl) >= gap);
+            now.clear();
+            for (auto it = pl.play_begin(); it != pl.play_end(); ++it)
+                now.emplace_back(pl.play(it).first, pl.play(it).second);
+            check_model(pl, now);
+        }
+        // O jeden za dużo: wyjątek i plejlista bez zmian.
+        pl_t before = pl;
+        try {
+            pl.shuffle(rng, best + 1);
+            assert(false);
+        } catch (std::invalid_argument const &) {}
+        check_model(pl, now);
+        check_model(before, now);
+    }
+}
+
+// 24: tasowanie kolejki, także z odstępem między odtworzeniami utworu
+void test_24_shuffle() {
+    std::clog << "[24] shuffle\n";
+    check_shuffle(1);
+    check_shuffle<cxx::duration_index<play_length>,
+                  cxx::order_statistic_index, cxx::count_index>(2);
+    check_shuffle<cxx::node_storage>(3);
+
+    // Tasowanie nie jest przypadkiem stałą permutacją.
+    int_playlist_t pl;
+    for (int i = 0; i < 100; ++i)
+        pl.push_back(i % 10, {static_cast<unsigned>(i), 0});
+    std::mt19937 rng(24);
+    std::set<std::vector<unsigned>> seen;
+    for (int i = 0; i < 20; ++i) {
+        pl.shuffle(rng, 5);
+        std::vector<unsigned> order;
+        for (auto it = pl.play_begin(); it != pl.play_end(); ++it)
+            order.push_back(pl.play(it).second.first);
+        seen.insert(order);
+        assert(smallest_gap(pl) >= 5);
+    }
+    assert(seen.size() == 20);
+    // Przy 10 utworach po 10 odtworzeń więcej niż 9 się nie da.
+    pl.shuffle(rng, 9);
+    assert(smallest_gap(pl) == 9);
+    try {
+        pl.shuffle(rng, 10);
+        assert(false);
+    } catch (std::invalid_argument const &) {}
+
+    int_playlist_t small;
+    small.shuffle(rng, 100);
+    small.push_back(1, {0, 0});
+    small.shuffle(rng);
+    small.shuffle(rng, 100);
+    assert(small.size() == 1);
+}
+
+// ======================== main ========================
+
+int main() {
+    try {
+        test_01_serialize_roundtrip();
+        test_02_serialize_strings();
+        test_03_deserialize_rejects_garbage();
+        test_04_view_matches_playlist();
+        test_05_load_play_log();
+        test_06_journal_recovery();
+        test_07_incremental_checkpoint();
+        test_08_packed_params();
+        test_09_empty_params();
+        test_10_integral_index();
+        test_11_policies();
+        test_12_local_sharing();
+        test_13_chunk_unshare();
+        test_14_scoped_params();
+        test_15_cow_stats();
+        test_16_memory_usage();
+        test_17_top_k();
+        test_18_sorted_ranges();
+        test_19_order_statistics();
+        test_20_seek_time();
+        test_21_positional_edits();
+        test_22_splice();
+        test_23_node_handles();
+        test_24_shuffle();
+    } catch (...) {
+        assert(false && "Uncaught exception in tests");
+    }
+
+    std::clog << "ALL EXTENDED PLAYLIST TESTS PASSED\n";
+    return 0;
+}
@@ -0,0 +1,392 @@
+#include "playlist.h"
+
+#ifdef NDEBUG
+#  undef NDEBUG
+#endif
+
+#include <cassert>
+#include <cstddef>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Testy liczby alokacji: globalne operator new / delete są podmienione na
+// wersje zliczające, a każda operacja plejlisty ma swój budżet. Przekroczenie
+// budżetu oznacza regresję w gorącej ścieżce.
+
+// ======================== Licznik alokacji ========================
+
+static std::size_t allocations = 0;
+
+// Wszystkie operator delete zwalniają przez tę funkcję. Nie jest rozwijana
+// w miejscu wywołania, więc kompilator nie zestawia free z operator new
+// (-Wmismatched-new-delete); pamięć i tak pochodzi z malloc/aligned_alloc.
+[[gnu::noinline]] static void release(void *p) noexcept {
+    std::free(p);
+}
+
+void *operator new(std::size_t n) {
+    ++allocations;
+    if (void *p = std::malloc(n ? n : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void *operator new(std::size_t n, std::align_val_t al) {
+    ++allocations;
+    std::size_t a = static_cast<std::size_t>(al);
+    if (void *p = std::aligned_alloc(a, (n + a - 1) / a * a))
+        return p;
+    throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t n) {
+    return operator new(n);
+}
+
+void *operator new[](std::size_t n, std::align_val_t al) {
+    return operator new(n, al);
+}
+
+void operator delete(void *p) noexcept {
+    release(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept {
+    release(p);
+}
+
+void operator delete(void *p, std::align_val_t) noexcept {
+    release(p);
+}
+
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept {
+    release(p);
+}
+
+void operator delete[](void *p) noexcept {
+    release(p);
+}
+
+void operator delete[](void *p, std::size_t) noexcept {
+    release(p);
+}
+
+void operator delete[](void *p, std::align_val_t) noexcept {
+    release(p);
+}
+
+void operator delete[](void *p, std::size_t, std::align_val_t) noexcept {
+    release(p);
+}
+
+// ======================== Narzędzia testowe ========================
+
+using params_t = std::pair<unsigned, unsigned>;
+using int_playlist_t = cxx::playlist<int, params_t>;
+using str_playlist_t = cxx::playlist<std::string, params_t>;
+
+// Liczba alokacji wykonanych przez f.
+template <typename F>
+static std::size_t allocations_in(F &&f) {
+    std::size_t before = allocations;
+    f();
+    return allocations - before;
+}
+
+// Największa i łączna liczba alokacji w count wywołaniach op(i).
+struct budget_result {
+    std::size_t max = 0;
+    std::size_t total = 0;
+};
+
+template <typename Op>
+static budget_result per_operation(std::size_t count, Op &&op) {
+    budget_result res;
+    for (std::size_t i = 0; i < count; ++i) {
+        std::size_t a = allocations_in([&] { op(i); });
+        res.max = a > res.max ? a : res.max;
+        res.total += a;
+    }
+    return res;
+}
+
+// Nazwa utworu dłuższa niż bufor SSO, żeby string też alokował.
+static std::string name(std::size_t i) {
+    return "track number " + std::to_string(i) + " of the station";
+}
+
+// ======================== TESTY ========================
+
+// 01: push_back znanego utworu - najwyżej jedna alokacja (nowy kawałek
+// kolejki), średnio dużo mniej
+void test_01_push_back_existing_track() {
+    std::clog << "[01] push_back of an existing track\n";
+    int_playlist_t pl;
+    for (int t = 0; t < 100; ++t)
+        pl.push_back(t, {0, 0});
+    auto r = per_operation(10000, [&](std::size_t i) {
+        pl.push_back(static_cast<int>(i % 100), {1, 1});
+    });
+    assert(r.max <= 1);
+    assert(r.total <= 10000 / 64 + 16);
+
+    str_playlist_t spl;
+    for (std::size_t t = 0; t < 100; ++t)
+        spl.push_back(name(t), {0, 0});
+    std::string const known = name(42);
+    r = per_operation(10000, [&](std::size_t) {
+        spl.push_back(known, {1, 1});
+    });
+    assert(r.max <= 1);
+    assert(r.total <= 10000 / 64 + 16);
+}
+
+// 02: push_back nowego utworu - węzeł indeksu, kopia nazwy i zamortyzowany
+// wzrost tablic
+void test_02_push_back_new_track() {
+    std::clog << "[02] push_back of a new track\n";
+    std::vector<std::string> names;
+    for (std::size_t i = 0; i < 5000; ++i)
+        names.push_back(name(i));
+    str_playlist_t pl;
+    auto r = per_operation(5000, [&](std::size_t i) {
+        pl.push_back(names[i], {1, 1});
+    });
+    // Węzeł mapy i kopia nazwy; rzadziej do tego wzrost tablic indeksu,
+    // tablicy kawałków i nowy kawałek.
+    assert(r.max <= 6);
+    assert(r.total <= 5000 * 2 + 5000 / 16);
+
+    int_playlist_t ipl;
+    r = per_operation(5000, [&](std::size_t i) {
+        ipl.push_back(static_cast<int>(i), {1, 1});
+    });
+    // Indeks pozycyjny nie ma węzłów: tylko zamortyzowany wzrost tablic.
+    assert(r.max <= 7);
+    assert(r.total <= 5000 / 10);
+}
+
+// 03: pop_front i remove na niewspółdzielonej plejliście nie alokują
+void test_03_pop_front_and_remove() {
+    std::clog << "[03] pop_front and remove\n";
+    str_playlist_t pl;
+    for (std::size_t i = 0; i < 3000; ++i)
+        pl.push_back(name(i % 300), {0, 0});
+    auto r = per_operation(1000, [&](std::size_t) {
+        pl.pop_front();
+    });
+    assert(r.max == 0);
+
+    std::size_t tracks = 0;
+    for (auto it = pl.sorted_begin(); it != pl.sorted_end(); ++it)
+        ++tracks;
+    assert(tracks == 300);
+    r = per_operation(150, [&](std::size_t) {
+        // Referencja do utworu, żeby nie liczyć kopii nazwy.
+        pl.remove(pl.front().first);
+    });
+    assert(r.max == 0);
+
+    int_playlist_t ipl;
+    for (int i = 0; i < 3000; ++i)
+        ipl.push_back(i % 300, {0, 0});
+    r = per_operation(3000, [&](std::size_t) {
+        ipl.pop_front();
+    });
+    assert(r.max == 0 && ipl.size() == 0);
+}
+
+// 04: kopia współdzieli dane - zero alokacji; odłączenie kopiuje indeks
+// i tablicę kawałków, ale nie odtworzenia
+void test_04_copy_and_detach() {
+    std::clog << "[04] copy and detach\n";
+    int_playlist_t pl;
+    for (int i = 0; i < 64000; ++i)
+        pl.push_back(i % 100, {0, 0});
+
+    assert(allocations_in([&] { int_playlist_t copy = pl; }) == 0);
+    // Pusty `other` tworzy własne dane: blok danych i pusty indeks (deque
+    // alokuje od razu), przypisanie już nic.
+    assert(allocations_in([&] {
+        int_playlist_t copy = pl;
+        int_playlist_t other;
+        other = copy;
+    }) <= 3);
+
+    int_playlist_t copy = pl;
+    // Dane, tablica kawałków, kopia indeksu (kilka bloków deque i tablice,
+    // w tym mapa bitowa zajętych komórek i jej podsumowanie) oraz kawałek
+    // ogona i kawałek poprzedniego odtworzenia utworu.
+    assert(allocations_in([&] { copy.push_back(5, {1, 1}); }) <= 18);
+
+    int_playlist_t copy2 = pl;
+    auto it = copy2.play_begin();
+    for (int i = 0; i < 30000; ++i)
+        ++it;
+    // Jak wyżej, ale kawałek jeden.
+    assert(allocations_in([&] { copy2.params(it).first = 7; }) <= 15);
+
+    // Pełna kopia tylko wtedy, gdy wydano referencję do parametrów.
+    std::size_t deep = allocations_in([&] { int_playlist_t c = copy2; });
+    assert(deep >= 1000 && deep <= 1000 + 15);
+
+    int_playlist_t copy3 = pl;
+    // Jak przy push_back, z kawałkami wokół usuwanej głowy.
+    assert(allocations_in([&] { copy3.pop_front(); }) <= 16);
+    int_playlist_t copy4 = pl;
+    // 640 odtworzeń utworu, każde w innym kawałku, plus kawałki sąsiadów
+    // na granicach.
+    assert(allocations_in([&] { copy4.remove(7); }) <= 700);
+}
+
+// 05: const dostęp i memory_usage() nie alokują
+void test_05_const_access() {
+    std::clog << "[05] const access\n";
+    str_playlist_t pl;
+    for (std::size_t i = 0; i < 1000; ++i)
+        pl.push_back(name(i % 37), {0, 0});
+    str_playlist_t const copy = pl;
+    assert(allocations_in([&] {
+        std::size_t sum = 0;
+        for (auto it = copy.play_begin(); it != copy.play_end(); ++it)
+            sum += copy.params(it).first + copy.play(it).first.size();
+        for (auto it = copy.sorted_begin(); it != copy.sorted_end(); ++it)
+            sum += copy.pay(it).second;
+        (void) copy.front();
+        (void) copy.memory_usage();
+        assert(sum > 0);
+    }) == 0);
+}
+
+// 06: insert znanego utworu w środek kolejki - jak push_back; erase
+// i move na niewspółdzielonej plejliście nie alokują
+void test_06_positional_edits() {
+    std::clog << "[06] insert, erase and move\n";
+    int_playlist_t pl;
+    for (int t = 0; t < 100; ++t)
+        pl.push_back(t, {0, 0});
+    auto middle = pl.play_begin();
+    for (int i = 0; i < 50; ++i)
+        ++middle;
+    auto r = per_operation(10000, [&](std::size_t i) {
+        middle = pl.insert(middle, static_cast<int>(i % 100), {1, 1});
+    });
+    assert(r.max <= 1);
+    assert(r.total <= 10000 / 64 + 16);
+
+    r = per_operation(5000, [&](std::size_t) {
+        auto it = pl.play_begin();
+        ++it;
+        pl.move(it, middle);
+        middle = pl.erase(middle);
+    });
+    assert(r.max == 0);
+}
+
+// 07: splice_back przenosi kawałki - bez kopii odtworzeń, tylko tablice
+// pomocnicze i wzrost tablicy kawałków
+void test_07_splice() {
+    std::clog << "[07] splice_back\n";
+    int_playlist_t pl;
+    for (int i = 0; i < 1000; ++i)
+        pl.push_back(i % 100, {0, 0});
+    int_playlist_t other;
+    for (int i = 0; i < 64000; ++i)
+        other.push_back(i % 100, {1, 1});
+    // Trzy tablice pomocnicze, nowe puste dane dla other (blok danych
+    // i deque indeksu) i wzrost tablicy kawałków.
+    assert(allocations_in([&] { pl.splice_back(std::move(other)); }) <= 7);
+    assert(pl.size() == 65000 && other.size() == 0);
+}
+
+// 08: przeniesienie odtworzenia przez extract / insert - bez alokacji,
+// gdy utwór jest znany, a w kolejce docelowej jest wolne miejsce; ostatnie
+// odtworzenie utworu oddaje swoją nazwę bez kopii
+void test_08_node_handles() {
+    std::clog << "[08] extract and insert\n";
+    str_playlist_t pending, air;
+    for (std::size_t i = 0; i < 1000; ++i) {
+        pending.push_back(name(i % 100), {0, 0});
+        air.push_back(name(i % 100), {0, 0});
+    }
+    // Zostaje po jednym odtworzeniu każdego utworu i 900 wolnych miejsc.
+    for (std::size_t i = 0; i < 900; ++i)
+        air.pop_front();
+    auto r = per_operation(900, [&](std::size_t) {
+        air.insert(air.play_end(), pending.extract(pending.play_begin()));
+    });
+    // Kopie nazw: utwory zostają w pending.
+    assert(r.total == 900);
+    // Ostatnie odtworzenia oddają nazwę bez kopii; tylko nowe kawałki.
+    r = per_operation(100, [&](std::size_t) {
+        air.insert(air.play_end(), pending.extract(pending.play_begin()));
+    });
+    assert(r.total <= 2);
+    assert(air.size() == 1100 && pending.size() == 0);
+
+    int_playlist_t from, to;
+    for (int i = 0; i < 1000; ++i) {
+        from.push_back(i % 10, {0, 0});
+        to.push_back(i % 10, {0, 0});
+    }
+    r = per_operation(1000, [&](std::size_t) {
+        to.pop_front();
+        to.insert(to.play_end(), from.extract(from.play_begin()));
+    });
+    assert(r.max == 0);
+
+    // Lista właścicieli (keep_alive) przechodzi z węzłem bez kopii.
+    auto owner = std::make_shared<int>(0);
+    from.keep_alive(owner);
+    to.keep_alive(owner);
+    for (int i = 0; i < 1000; ++i)
+        from.push_back(i % 10, {0, 0});
+    r = per_operation(1000, [&](std::size_t) {
+        to.pop_front();
+        to.insert(to.play_end(), from.extract(from.play_begin()));
+    });
+    assert(r.max == 0);
+}
+
+// 09: tasowanie w miejscu - tylko tablica kolejności (z odstępem także
+// tablice pomocnicze), bez kopii odtworzeń i bez zmian w indeksie
+void test_09_shuffle() {
+    std::clog << "[09] shuffle\n";
+    str_playlist_t pl;
+    for (std::size_t i = 0; i < 5000; ++i)
+        pl.push_back(name(i % 50), {0, 0});
+    std::minstd_rand rng(9);
+    std::size_t index = pl.memory_usage().index;
+    assert(allocations_in([&] { pl.shuffle(rng); }) == 1);
+    assert(pl.memory_usage().index == index);
+    // Tablice pomocnicze: liczniki, grupy odtworzeń utworów, stan
+    // losowania i kopiec, gdy zostaje mało swobody.
+    assert(allocations_in([&] { pl.shuffle(rng, 40); }) <= 16);
+    assert(pl.memory_usage().index == index);
+}
+
+// ======================== main ========================
+
+int main() {
+    try {
+        test_01_push_back_existing_track();
+        test_02_push_back_new_track();
+        test_03_pop_front_and_remove();
+        test_04_copy_and_detach();
+        test_05_const_access();
+        test_06_positional_edits();
+        test_07_splice();
+        test_08_node_handles();
+        test_09_shuffle();
+    } catch (...) {
+        assert(false && "Uncaught exception in tests");
+    }
+
+    std::clog << "ALL ALLOCATION TESTS PASSED\n";
+    return 0;
+}
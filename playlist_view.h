@@ -0,0 +1,207 @@
+#ifndef PLAYLIST_VIEW_H
+#define PLAYLIST_VIEW_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include "mapped_file.h"
+#include "packed_params.h"
+#include "playlist_format.h"
+
+namespace cxx {
+
+    /* Read-only playlist served directly from a file written by
+     * playlist::serialize. Opening validates only the header, every play,
+     * track and count is read from the mapped pages when asked for, so
+     * the cost of a view does not depend on the number of plays.
+     * Interface mirrors the const part of playlist: tracks are returned
+     * as const references (inline tracks) or views of the stored bytes,
+     * params by value (decoded in place when the file packs them).
+     */
+    template <typename T, typename P>
+        requires serializable_track<T> && serializable_params<P>
+    class playlist_view {
+        private:
+            using codec = track_codec<T>;
+
+        public:
+            using track_ref = typename codec::view_type;
+
+            playlist_view() = default;
+
+            explicit playlist_view(std::string const &path)
+                : file_(path) {
+                if (file_.size() < sizeof(format::header)) {
+                    throw std::runtime_error("playlist_view, file too short");
+                }
+                header_ = format::from_bytes<format::header>(file_.data());
+                format::validate<T, P>(header_, file_.size());
+                if (header_.flags & format::packed_params) {
+                    packed_ = packed::column_reader<P>(
+                        file_.data() + header_.params_offset,
+                        format::params_bytes(header_), header_.play_count);
+                }
+            }
+
+            playlist_view(playlist_view &&) noexcept = default;
+            playlist_view & operator=(playlist_view &&) noexcept = default;
+            ~playlist_view() = default;
+
+            size_t size() const noexcept {
+                return header_.play_count;
+            }
+
+            // Number of distinct tracks.
+            size_t track_count() const noexcept {
+                return header_.track_count;
+            }
+
+            // Sequence number stored by serialize.
+            std::uint64_t sequence() const noexcept {
+                return header_.sequence;
+            }
+
+            // Both iterators are positions in the corresponding section.
+            class play_iterator {
+                friend class playlist_view;
+
+                public:
+                    using iterator_category = std::forward_iterator_tag;
+                    using value_type = std::uint64_t;
+                    using difference_type = std::ptrdiff_t;
+
+                    play_iterator & operator++() {
+                        ++pos;
+                        return *this;
+                    }
+
+                    play_iterator operator++(int) {
+                        play_iterator tmp(*this);
+                        ++pos;
+                        return tmp;
+                    }
+
+                    bool operator==(const play_iterator & oth) const = default;
+                    bool operator!=(const play_iterator & oth) const = default;
+                private:
+                    std::uint64_t pos;
+
+                    play_iterator(std::uint64_t p = 0): pos{p} {}
+            };
+
+            class sorted_iterator {
+                friend class playlist_view;
+
+                public:
+                    using iterator_category = std::forward_iterator_tag;
+                    using value_type = std::uint64_t;
+                    using difference_type = std::ptrdiff_t;
+
+                    sorted_iterator & operator++() {
+                        ++pos;
+                        return *this;
+                    }
+
+                    sorted_iterator operator++(int) {
+                        sorted_iterator tmp(*this);
+                        ++pos;
+                        return tmp;
+                    }
+
+                    bool operator==(const sorted_iterator & oth) const = default;
+                    bool operator!=(const sorted_iterator & oth) const = default;
+                private:
+                    std::uint64_t pos;
+
+                    sorted_iterator(std::uint64_t p = 0): pos{p} {}
+            };
+
+            const std::pair<track_ref, P> front() const {
+                if (size() == 0) {
+                    throw std::out_of_range("front, playlist empty");
+                }
+                return play(play_begin());
+            }
+
+            const std::pair<track_ref, P> play(play_iterator const &it) const {
+                return {track(play_track(it.pos)), params(it)};
+            }
+
+            P params(play_iterator const &it) const {
+                if (header_.flags & format::packed_params)
+                    return packed_[it.pos];
+                return format::from_bytes<P>(file_.data() +
+                    header_.params_offset + it.pos * sizeof(P));
+            }
+
+            const std::pair<track_ref, size_t> pay(sorted_iterator const &it)
+            const {
+                return {track(it.pos), format::from_bytes<std::uint64_t>(
+                    file_.data() + header_.counts_offset +
+                    it.pos * sizeof(std::uint64_t))};
+            }
+
+            play_iterator play_begin() const noexcept {
+                return play_iterator(0);
+            }
+
+            play_iterator play_end() const noexcept {
+                return play_iterator(header_.play_count);
+            }
+
+            sorted_iterator sorted_begin() const noexcept {
+                return sorted_iterator(0);
+            }
+
+            sorted_iterator sorted_end() const noexcept {
+                return sorted_iterator(header_.track_count);
+            }
+
+        private:
+            mapped_file file_;
+            format::header header_{};
+            packed::column_reader<P> packed_;
+
+            // Dictionary position of a play, checked as the file is trusted
+            // only as far as the header goes.
+            std::uint64_t play_track(std::uint64_t pos) const {
+                auto id = format::from_bytes<std::uint32_t>(file_.data() +
+                    header_.plays_offset + pos * sizeof(std::uint32_t));
+                if (id >= header_.track_count) {
+                    throw std::runtime_error("playlist_view, corrupt plays");
+                }
+                return id;
+            }
+
+            track_ref track(std::uint64_t id) const {
+                char const *dict = file_.data() + header_.dict_offset;
+                if constexpr (codec::is_inline) {
+                    // Section is aligned, so the object can be used in place.
+                    return *std::launder(reinterpret_cast<T const *>(
+                        dict + id * sizeof(T)));
+                } else {
+                    auto table = (header_.track_count + 1) *
+                                 sizeof(std::uint64_t);
+                    auto begin = format::from_bytes<std::uint64_t>(
+                        dict + id * sizeof(std::uint64_t));
+                    auto end = format::from_bytes<std::uint64_t>(
+                        dict + (id + 1) * sizeof(std::uint64_t));
+                    if (begin > end || end > header_.dict_size - table) {
+                        throw std::runtime_error(
+                            "playlist_view, corrupt dictionary");
+                    }
+                    return codec::view(dict + table + begin, end - begin);
+                }
+            }
+    };
+
+} // namespace cxx
+
+#endif //PLAYLIST_VIEW_H
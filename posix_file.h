@@ -0,0 +1,163 @@
+#ifndef POSIX_FILE_H
+#define POSIX_FILE_H
+
+#include <cerrno>
+#include <cstddef>
+#include <streambuf>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace cxx {
+
+    // Throws std::system_error for errno of a failed call.
+    [[noreturn]] inline void throw_errno(std::string const &what) {
+        throw std::system_error(errno, std::generic_category(), what);
+    }
+
+    // Owning file descriptor. Move-only, closes on destruction.
+    class unique_fd {
+        public:
+            unique_fd() noexcept = default;
+
+            unique_fd(std::string const &path, int flags, mode_t mode = 0644)
+                : fd_(::open(path.c_str(), flags | O_CLOEXEC, mode)) {
+                if (fd_ < 0) {
+                    throw_errno("open " + path);
+                }
+            }
+
+            unique_fd(unique_fd const &) = delete;
+            unique_fd & operator=(unique_fd const &) = delete;
+
+            unique_fd(unique_fd &&other) noexcept
+                : fd_(std::exchange(other.fd_, -1)) {}
+
+            unique_fd & operator=(unique_fd &&other) noexcept {
+                if (this != &other) {
+                    reset();
+                    fd_ = std::exchange(other.fd_, -1);
+                }
+                return *this;
+            }
+
+            ~unique_fd() {
+                reset();
+            }
+
+            int get() const noexcept {
+                return fd_;
+            }
+
+            void reset() noexcept {
+                if (fd_ >= 0)
+                    ::close(fd_);
+                fd_ = -1;
+            }
+
+        private:
+            int fd_ = -1;
+    };
+
+    // write(2) until everything is written.
+    inline void write_all(int fd, void const *src, std::size_t n) {
+        char const *p = static_cast<char const *>(src);
+        while (n > 0) {
+            ssize_t w = ::write(fd, p, n);
+            if (w < 0) {
+                if (errno == EINTR)
+                    continue;
+                throw_errno("write");
+            }
+            p += w;
+            n -= static_cast<std::size_t>(w);
+        }
+    }
+
+    // pwrite(2) until everything is written.
+    inline void pwrite_all(int fd, void const *src, std::size_t n,
+                           off_t offset) {
+        char const *p = static_cast<char const *>(src);
+        while (n > 0) {
+            ssize_t w = ::pwrite(fd, p, n, offset);
+            if (w < 0) {
+                if (errno == EINTR)
+                    continue;
+                throw_errno("pwrite");
+            }
+            p += w;
+            n -= static_cast<std::size_t>(w);
+            offset += w;
+        }
+    }
+
+    inline void sync_fd(int fd) {
+        if (::fdatasync(fd) != 0) {
+            throw_errno("fdatasync");
+        }
+    }
+
+    // Makes a rename or creation inside the directory of path durable.
+    inline void sync_parent_dir(std::string const &path) {
+        auto slash = path.rfind('/');
+        std::string dir = slash == std::string::npos ? "."
+                        : slash == 0 ? "/" : path.substr(0, slash);
+        unique_fd fd(dir, O_RDONLY | O_DIRECTORY);
+        if (::fsync(fd.get()) != 0) {
+            throw_errno("fsync " + dir);
+        }
+    }
+
+    /* Atomically replaces path with tmp (already synced), the new name
+     * surviving a crash once this returns.
+     */
+    inline void replace_file(std::string const &tmp, std::string const &path) {
+        if (::rename(tmp.c_str(), path.c_str()) != 0) {
+            throw_errno("rename " + tmp);
+        }
+        sync_parent_dir(path);
+    }
+
+    /* Output stream buffer over a file descriptor, so that std::ostream
+     * writers (playlist::serialize) can be followed by fdatasync. Errors
+     * surface as a failed stream.
+     */
+    class fd_streambuf : public std::streambuf {
+        public:
+            explicit fd_streambuf(int fd) : fd_(fd), buf_(1 << 16) {
+                setp(buf_.data(), buf_.data() + buf_.size());
+            }
+
+        protected:
+            int_type overflow(int_type ch) override {
+                if (sync() != 0)
+                    return traits_type::eof();
+                if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+                    *pptr() = traits_type::to_char_type(ch);
+                    pbump(1);
+                }
+                return traits_type::not_eof(ch);
+            }
+
+            int sync() override {
+                try {
+                    write_all(fd_, pbase(), pptr() - pbase());
+                } catch (std::system_error const &) {
+                    return -1;
+                }
+                setp(buf_.data(), buf_.data() + buf_.size());
+                return 0;
+            }
+
+        private:
+            int fd_;
+            std::vector<char> buf_;
+    };
+
+} // namespace cxx
+
+#endif //POSIX_FILE_H